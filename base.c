@@ -41,7 +41,9 @@
 #include "osGlobals.h"
 #include "osSchedulePrinter.h"
 #include "diskManagement.h"
+#include "directoryIndex.h"
 #include "memoryManagement.h"
+#include "osOptions.h"
 
 
 
@@ -76,7 +78,8 @@ void InterruptHandler(void) {
 
     MEMORY_MAPPED_IO mmio;       // Enables communication with hardware
    
-    // Get cause of interrupt
+    // Get cause of interrupt. With batched interrupts there can be
+    // several device events waiting and they are all taken here.
     mmio.Mode = Z502GetInterruptInfo;
     mmio.Field1 = mmio.Field2 = mmio.Field3 = mmio.Field4 = 0;
     MEM_READ(Z502InterruptDevice, &mmio);
@@ -147,6 +150,10 @@ void FaultHandler(void) {
 void svc(SYSTEM_CALL_DATA *SystemCallData) {
 
   short call_type;
+  //The latency includes any time spent blocked in the dispatcher
+  UINT32 StartTime = Z502StatisticsClock();
+  UINT64 StartHostTime = Z502HostNanoseconds();
+  UINT32 StartWaitTime = Z502ContextWaitTime(0);
 
   call_type = (short) SystemCallData->SystemCallNumber;
   
@@ -373,8 +380,82 @@ void svc(SYSTEM_CALL_DATA *SystemCallData) {
       
       break;
     }
+
+    if(call_type >= 0 && call_type < NUMBER_OF_SYSTEM_CALLS){
+      Z502AddToStatistic(svc_ticks_stat[call_type],
+			 (INT32)(Z502StatisticsClock() - StartTime));
+      Z502AddToStatistic(svc_ns_stat[call_type],
+			 (INT64)(Z502HostNanoseconds() - StartHostTime));
+      Z502AddToStatistic(svc_wait_stat[call_type],
+			 (INT32)(Z502ContextWaitTime(0) - StartWaitTime));
+    }
 }           // End of SVC
 
+/************************************************************************
+ RegisterOsStatistics
+ Add the statistics the OS keeps to the hardware's registry. The system
+ call statistics are named svc.<call>.ticks, .ns and .wait after
+ call_names without the padding.
+ ************************************************************************/
+
+void RegisterOsStatistics(void) {
+    char Call[16];
+    char Name[32];
+    INT32 Length;
+
+    for (INT32 i = 0; i < NUMBER_OF_SYSTEM_CALLS; i++) {
+        Length = sprintf(Call, "%s", call_names[i]);
+        while (Length > 0 && Call[Length - 1] == ' ')
+            Call[--Length] = '\0';
+        sprintf(Name, "svc.%s.ticks", Call);
+        svc_ticks_stat[i] = Z502RegisterStatistic(Name, STAT_HISTOGRAM);
+        sprintf(Name, "svc.%s.ns", Call);
+        svc_ns_stat[i] = Z502RegisterStatistic(Name, STAT_HISTOGRAM);
+        sprintf(Name, "svc.%s.wait", Call);
+        svc_wait_stat[i] = Z502RegisterStatistic(Name, STAT_COUNTER);
+    }
+    disk_depth_stat = Z502RegisterStatistic("disk_queue_depth",
+            STAT_HISTOGRAM);
+    ready_wait_stat = Z502RegisterStatistic("ready_queue_wait",
+            STAT_HISTOGRAM);
+}           // End of RegisterOsStatistics
+
+/************************************************************************
+ PrintSystemCallStats
+ Called when the simulation halts. For every system call that was made
+ print its latency in simulated ticks and in host microseconds, and the
+ share of the ticks spent waiting in the dispatcher - for a disk or a
+ timer, or for the processor. Nothing is printed if no calls finished.
+ ************************************************************************/
+
+void PrintSystemCallStats(void) {
+    INT64 Count, Sum, Max, P99;
+    INT64 HostCount, HostSum, HostMax, HostP99;
+    INT64 WaitSum, Unused;
+    BOOL Header = FALSE;
+
+    for (INT32 i = 0; i < NUMBER_OF_SYSTEM_CALLS; i++) {
+        Z502ReadStatistic(svc_ticks_stat[i], 99, &Count, &Sum, &Max, &P99);
+        if (Count == 0)
+            continue;
+        Z502ReadStatistic(svc_ns_stat[i], 99, &HostCount, &HostSum,
+                &HostMax, &HostP99);
+        Z502ReadStatistic(svc_wait_stat[i], 0, &WaitSum, &Unused, &Unused,
+                &Unused);
+        if (Header == FALSE) {
+            aprintf("\nSystem Call Latency  (simulated ticks / host usecs)\n");
+            aprintf("Call        Count      Mean    p99     Max  Waiting"
+                    "   Host Mean   Host p99\n");
+            Header = TRUE;
+        }
+        aprintf("%s %6lld %9.1f %6lld %7lld  %6.1f%% %11.2f %10.2f\n",
+                call_names[i], Count, (double) Sum / (double) Count, P99, Max,
+                Sum > 0 ? (100.0 * (double) WaitSum) / (double) Sum : 0.0,
+                (double) HostSum / (double) HostCount / 1000.0,
+                (double) HostP99 / 1000.0);
+    }
+}           // End of PrintSystemCallStats
+
 /************************************************************************
  osInit
  This is the first routine called after the simulation begins.  This
@@ -388,6 +469,7 @@ void osInit(int argc, char *argv[]) {
     void *PageTable = (void *) calloc(2, NUMBER_VIRTUAL_PAGES);
     INT32 i;
     MEMORY_MAPPED_IO mmio;
+    char TimingOptions[EVENT_LOG_OPTIONS_LENGTH];
 
     // Demonstrates how calling arguments are passed thru to here
 
@@ -417,7 +499,8 @@ void osInit(int argc, char *argv[]) {
 	    //set flag in OS to indicate multiprocessor mode
 	    M = MULTI;
         }
-    } else {
+    }
+    if (M != MULTI) {
         aprintf("Simulation is running as a UniProcessor\n");
         aprintf("Add an 'M' to the command line to invoke multiprocessor operation.\n\n");
 	
@@ -446,6 +529,63 @@ void osInit(int argc, char *argv[]) {
 
 
     
+    //Defaults that can be changed by the options
+    DirectoryIndexEnabled = TRUE;
+    PageOutEnabled = TRUE;
+    LoadControlEnabled = TRUE;
+    ResidentMin = 2;
+    ResidentMax = NUMBER_PHYSICAL_PAGES;
+    TimerSlack = DEFAULT_TIMER_SLACK;
+    BatchInterrupts = TRUE;
+    DeterministicRun = FALSE;
+    RunSeed = 0;
+    EventLogging = EVENT_LOG_OFF;
+    RecordTrace = FALSE;
+    AsyncPrinting = FALSE;
+    StatisticsExport = 0;
+
+    //Options given after the test name
+    SetOsOptions(argc, argv);
+    if (AsyncPrinting == TRUE)
+        StartAsyncPrinting();
+
+    //Tell the hardware how to deliver device events
+    mmio.Mode = Z502SetInterruptBatching;
+    mmio.Field1 = BatchInterrupts;
+    mmio.Field2 = mmio.Field3 = mmio.Field4 = 0;
+    MEM_WRITE(Z502InterruptDevice, &mmio);
+
+    //Ask for a repeatable run if seed= or eventlog= was given. The event
+    //log keeps the options that change the timing so a replay can check
+    //it is run the same way.
+    if (DeterministicRun == TRUE) {
+        DescribeTimingOptions(argv[1], TimingOptions);
+        mmio.Mode = Z502SetDeterministicMode;
+        mmio.Field1 = RunSeed;
+        mmio.Field2 = EventLogging;
+        mmio.Field3 = (long) TimingOptions;
+        mmio.Field4 = 0;
+        MEM_WRITE(Z502InterruptDevice, &mmio);
+    }
+
+    //Start the binary trace if trace=on was given
+    if (RecordTrace == TRUE) {
+        mmio.Mode = Z502SetTracing;
+        mmio.Field1 = TRUE;
+        mmio.Field2 = mmio.Field3 = mmio.Field4 = 0;
+        MEM_WRITE(Z502InterruptDevice, &mmio);
+    }
+
+    //Keep the OS statistics and have them written at halt if stats= was given
+    RegisterOsStatistics();
+    if (StatisticsExport != 0) {
+        mmio.Mode = Z502ExportStatistics;
+        mmio.Field1 = StatisticsExport;
+        mmio.Field2 = STATS_EXPORT_AT_HALT;
+        mmio.Field3 = mmio.Field4 = 0;
+        MEM_WRITE(Z502InterruptDevice, &mmio);
+    }
+
     //create the structures for the OS
     InitializeProcessInfo();
 
@@ -458,11 +598,11 @@ void osInit(int argc, char *argv[]) {
     CreateMessageBuffer();
 
     NextFrame = 0;
-    NextSwapLocation = 0x600;
+    InitializeSwapSpace();
     Cache = NULL;
 
     //for shared memory
-    SharedIDCount = 0;
+    InitializeSharedAreas();
 
     for(int i=0; i<MAX_NUMBER_OF_DISKS; i++){
       CreateDiskQueue(i);
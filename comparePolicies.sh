@@ -0,0 +1,42 @@
+#!/bin/bash
+#
+# comparePolicies.sh
+#
+# Run the paging tests under each page replacement policy and print the
+# page faults, swap disk I/O and simulated completion time of each run.
+#
+#   ./comparePolicies.sh [os executable] [test ...]
+#
+# The executable defaults to ./os and the tests to test44, test45 and
+# test45 on the multiprocessor. A test with options is given in quotes,
+# for example "test45 M".
+
+OS=${1:-./os}
+shift
+TESTS=("$@")
+if [ ${#TESTS[@]} -eq 0 ]; then
+    TESTS=("test44" "test45" "test45 M")
+fi
+POLICIES="clock eclock wsclock aging fifo"
+
+printf "%-10s %-8s %8s %8s %8s %8s %8s %10s\n" \
+    "Test" "Policy" "Faults" "Reads" "Writes" "Avoided" "SwapIO" "EndTime"
+
+for TEST in "${TESTS[@]}"; do
+    for POLICY in $POLICIES; do
+	OUT=$(timeout 300 $OS $TEST replace=$POLICY 2>&1)
+	STATS=$(echo "$OUT" | grep "Replacement Policy:" | tail -1)
+	FAULTS=$(echo "$STATS" | sed -n 's/.*Page Faults: \([0-9]*\).*/\1/p')
+	READS=$(echo "$STATS" | sed -n 's/.*Swap Reads: \([0-9]*\).*/\1/p')
+	WRITES=$(echo "$STATS" | sed -n 's/.*Swap Writes: \([0-9]*\).*/\1/p')
+	AVOIDED=$(echo "$STATS" | sed -n 's/.*Avoided: \([0-9]*\).*/\1/p')
+	END=$(echo "$OUT" | grep -o "Ends at Time [0-9]*" | tail -1 | \
+	    grep -o "[0-9]*$")
+	if [ -z "$FAULTS" ]; then
+	    FAULTS=0; READS=0; WRITES=0; AVOIDED=0
+	fi
+	printf "%-10s %-8s %8s %8s %8s %8s %8s %10s\n" "$TEST" "$POLICY" \
+	    "$FAULTS" "$READS" "$WRITES" "$AVOIDED" "$((READS + WRITES))" \
+	    "${END:--}"
+    done
+done
@@ -0,0 +1,142 @@
+/*
+directoryIndex.c
+
+This file holds the functions for the in memory name index of each
+directory. Looking a name up in a directory used to mean reading every
+header the directory points to. The index maps a name straight to the
+sector of its header. It is built the first time a directory is
+searched and kept up to date when files and directories are created.
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include "protos.h"
+#include "osGlobals.h"
+#include "directoryIndex.h"
+
+/*
+Hash a file name into one of the buckets of a directory index.
+*/
+INT16 HashFileName(char *Name){
+
+  unsigned int Hash = 5381;
+
+  for(INT16 i=0; i<7 && Name[i] != '\0'; i++){
+    Hash = Hash*33 + (unsigned char)Name[i];
+  }
+  return Hash % DIR_HASH_BUCKETS;
+}
+
+/*
+Throw away all the directory indices. This is done when a disk is
+formatted since the directories they describe are gone.
+*/
+void ClearDirectoryIndexes(){
+
+  DIR_NAME_ENTRY *Entry;
+  DIR_NAME_ENTRY *Next;
+
+  for(INT32 i=0; i<NUMBER_LOGICAL_SECTORS; i++){
+    if(DirectoryIndex[i] == NULL){
+      continue;
+    }
+    for(INT16 j=0; j<DIR_HASH_BUCKETS; j++){
+      Entry = DirectoryIndex[i]->bucket[j];
+      while(Entry != NULL){
+	Next = Entry->next;
+	free(Entry);
+	Entry = Next;
+      }
+    }
+    free(DirectoryIndex[i]);
+    DirectoryIndex[i] = NULL;
+  }
+}
+
+/*
+Put the header at HeaderSector into the name index. The name is copied
+out of the header itself.
+*/
+void InsertDirectoryEntry(DISK_CACHE *Cache, DIR_NAME_INDEX *DirIndex,
+			  INT16 HeaderSector){
+
+  DIR_NAME_ENTRY *Entry = malloc(sizeof(DIR_NAME_ENTRY));
+  if(Entry == NULL){
+    aprintf("\n\nERROR: Unable to allocate Directory Index Entry\n\n");
+    return;
+  }
+
+  for(INT16 i=0; i<7; i++){
+    Entry->name[i] = Cache->Block[HeaderSector].Byte[i+1];
+  }
+  Entry->name[7] = '\0';
+  Entry->header_sector = HeaderSector;
+
+  INT16 Bucket = HashFileName(Entry->name);
+  Entry->next = DirIndex->bucket[Bucket];
+  DirIndex->bucket[Bucket] = Entry;
+}
+
+/*
+Build the name index for the directory whose index is at IndexSector
+by walking the index once.
+*/
+DIR_NAME_INDEX* BuildDirectoryIndex(DISK_CACHE *Cache, INT16 IndexSector){
+
+  DIR_NAME_INDEX *DirIndex = calloc(1, sizeof(DIR_NAME_INDEX));
+  if(DirIndex == NULL){
+    aprintf("\n\nERROR: Unable to allocate Directory Index\n\n");
+    return NULL;
+  }
+  DirIndex->index_sector = IndexSector;
+
+  DISK_BLOCK *Index = &Cache->Block[IndexSector];
+
+  for(INT16 i=0; i<PGSIZE; i=i+2){
+    INT16 HeaderSector = (Index->Byte[i]<<8) + Index->Byte[i+1];
+    if(HeaderSector != 0){
+      InsertDirectoryEntry(Cache, DirIndex, HeaderSector);
+    }
+  }
+  DirectoryIndex[IndexSector] = DirIndex;
+  return DirIndex;
+}
+
+/*
+Return the header sector of the file or directory called Name in the
+directory whose index is at IndexSector. Return 0 if there is none.
+*/
+INT16 LookUpDirectoryIndex(DISK_CACHE *Cache, INT16 IndexSector,
+			   char *Name){
+
+  DIR_NAME_INDEX *DirIndex = DirectoryIndex[IndexSector];
+
+  if(DirIndex == NULL){
+    DirIndex = BuildDirectoryIndex(Cache, IndexSector);
+    if(DirIndex == NULL){
+      return 0;
+    }
+  }
+
+  DIR_NAME_ENTRY *Entry = DirIndex->bucket[HashFileName(Name)];
+  while(Entry != NULL){
+    if(strcmp(Name, Entry->name) == 0){
+      return Entry->header_sector;
+    }
+    Entry = Entry->next;
+  }
+  return 0;
+}
+
+/*
+A new header has been put in the directory whose index is at
+IndexSector. If that directory has been indexed already add the new
+name. Otherwise it will be picked up when the index is built.
+*/
+void AddToDirectoryIndex(DISK_CACHE *Cache, INT16 IndexSector,
+			 INT16 HeaderSector){
+
+  if(DirectoryIndex[IndexSector] != NULL){
+    InsertDirectoryEntry(Cache, DirectoryIndex[IndexSector], HeaderSector);
+  }
+}
@@ -0,0 +1,48 @@
+/*
+directoryIndex.h
+
+This file is the include file for the in memory name index kept for
+each directory.
+
+*/
+
+#ifndef DIRECTORY_INDEX_H
+#define DIRECTORY_INDEX_H
+
+#include "global.h"
+#include "osGlobals.h"
+
+#define DIR_HASH_BUCKETS 16
+
+/*
+One name in a directory. Names are kept the way they are stored in the
+header, so they are at most 7 characters long.
+*/
+typedef struct DIR_NAME_ENTRY{
+  char name[8];
+  INT16 header_sector;
+  struct DIR_NAME_ENTRY *next;
+}DIR_NAME_ENTRY;
+
+/*
+The name index of one directory. It is found by the disk sector that
+holds the directory's index.
+*/
+typedef struct{
+  INT16 index_sector;
+  DIR_NAME_ENTRY *bucket[DIR_HASH_BUCKETS];
+}DIR_NAME_INDEX;
+
+//Name indices by directory index sector. NULL until first looked at.
+DIR_NAME_INDEX *DirectoryIndex[NUMBER_LOGICAL_SECTORS];
+
+//FALSE to search directories by reading every header (dirindex=off)
+INT32 DirectoryIndexEnabled;
+
+void ClearDirectoryIndexes();
+INT16 LookUpDirectoryIndex(DISK_CACHE *Cache, INT16 IndexSector,
+			   char *Name);
+void AddToDirectoryIndex(DISK_CACHE *Cache, INT16 IndexSector,
+			 INT16 HeaderSector);
+
+#endif //DIRECTORY_INDEX_H
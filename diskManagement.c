@@ -15,6 +15,8 @@ on the disk.
 #include "osSchedulePrinter.h"
 #include "diskManagement.h"
 #include "diskQueue.h"
+#include "directoryIndex.h"
+#include "openFileTable.h"
 
 /*
 This function initializes an array to track the available and in use
@@ -64,10 +66,26 @@ DISK_CACHE* CreateDiskCache(){
   }
   for(INT32 i=0; i<NUMBER_LOGICAL_SECTORS; i++){
     Cache->Modified[i] = 0;
+    for(INT32 Disk=0; Disk<MAX_NUMBER_OF_DISKS; Disk++){
+      Cache->Loaded[Disk][i] = SECTOR_NOT_LOADED;
+    }
   }
   return Cache;
 }
 
+/*
+Record that the cache copy of Sector is on its way from, or holds, the
+sector of disk DiskID. The cache keeps one copy of each sector number,
+so a copy that came from another disk is no longer good.
+*/
+void SetSectorLoaded(long DiskID, INT16 Sector, unsigned char State){
+
+  for(INT32 Disk=0; Disk<MAX_NUMBER_OF_DISKS; Disk++){
+    Cache->Loaded[Disk][Sector] = SECTOR_NOT_LOADED;
+  }
+  Cache->Loaded[DiskID][Sector] = State;
+}
+
 /*
 Puts the magic number 5A into the first byte of the first sector.
 */
@@ -276,6 +294,14 @@ void SetFileLevel(DISK_BLOCK *Header, unsigned char Level){
   Header->Byte[11] = (Mask & Header->Byte[11]) + Level;
 }
 
+/*
+Return the file level held in bits 00000XX0 of byte 11.
+*/
+void GetFileLevel(DISK_BLOCK *Header, unsigned char *Level){
+
+  (*Level) = (Header->Byte[11] >> 1) & 0x03;
+}
+
 /*
 Get the Inode of the parent.
 */
@@ -422,6 +448,10 @@ void SetBit(unsigned char *CharPtr, INT16 position){
   (*CharPtr) |= (0x80 >> position);
 }
 
+void ClearBit(unsigned char *CharPtr, INT16 position){
+  (*CharPtr) &= ~(0x80 >> position);
+}
+
 /*
 Indicate that the Sector Number is in use by setting the correct position
 in the bitmap.
@@ -448,80 +478,398 @@ void SetBitInBitMap(DISK_CACHE* Cache, INT16 SectorNumber){
   Cache->Modified[BitRow] = 1;
 }
 
+/*
+Indicate that the Sector Number is free again by clearing its position
+in the bitmap.
+*/
+void ClearBitInBitMap(DISK_CACHE* Cache, INT16 SectorNumber){
+
+  INT16 BitRow = BITMAP_START_SECTOR + SectorNumber/128;
+  INT16 BitColumn = (SectorNumber%128)/8;
+
+  ClearBit(&Cache->Block[BitRow].Byte[BitColumn], SectorNumber%8);
+  Cache->Modified[BitRow] = 1;
+}
+
 /*
 Look through the current directory to find the directory given by 
 DirName. Otherwise return NULL.
+The name index of the directory is used so the headers of the other
+files in the directory don't need to be read. With dirindex=off every
+header is read and compared instead.
 */
 DISK_BLOCK* FindDirectory(DISK_CACHE *Cache, DISK_BLOCK *Index, char *DirName){
 
-  DISK_BLOCK *SubDirectory = NULL;
-  char Buffer[8];
-  
-  for(INT16 i=0; i<PGSIZE; i=i+2){
-    
-    if(CheckIndexSpot(Index, i) == TRUE){
-      
-      SubDirectory = GetSubDirectoryHeader(Cache, Index, i);
-      GetFileName(SubDirectory, Buffer);
-      
-      if(strcmp(DirName, Buffer) == 0){
-        return SubDirectory;
+  if(DirectoryIndexEnabled == FALSE){
+    DISK_BLOCK *SubDirectory;
+    char Buffer[8];
+
+    for(INT16 i=0; i<PGSIZE; i=i+2){
+      if(CheckIndexSpot(Index, i) == TRUE){
+	SubDirectory = GetSubDirectoryHeader(Cache, Index, i);
+	GetFileName(SubDirectory, Buffer);
+	if(strcmp(DirName, Buffer) == 0){
+	  return SubDirectory;
+	}
       }
     }
+    return NULL;
+  }
+
+  INT16 IndexSector = Index - Cache->Block;
+  INT16 HeaderSector = LookUpDirectoryIndex(Cache, IndexSector, DirName);
+
+  if(HeaderSector == 0){
+    return NULL;
   }
-  return NULL;
+  return &Cache->Block[HeaderSector];
 }
 
 /*
-Return the position of the first bit to be 0. Work from left to right.
-Note that 1101 1111 would return 2 as the second bit from the left is
-not set.
+Build one 64 bit word of the bitmap. Word 0 covers sectors 0 to 63,
+word 1 covers sectors 64 to 127 and so on. The bitmap is stored MSB
+first so the first sector of the word ends up in the top bit.
 */
-INT16 TestBit(unsigned char Byte){
+unsigned long long GetBitMapWord(DISK_CACHE *Cache, INT16 WordNumber){
 
-  INT16 position = 0;
-  unsigned int Mask = 0x80;
-  
-  for(INT16 i=7; i>=0; i--){
-    if((Byte & Mask) == 0){
-      return position;
+  unsigned long long Word = 0;
+  DISK_BLOCK *BitMapSector = &Cache->Block[BITMAP_START_SECTOR +
+					   WordNumber/BITMAP_WORDS_PER_SECTOR];
+  INT16 FirstByte = (WordNumber%BITMAP_WORDS_PER_SECTOR)*8;
+
+  for(INT16 i=0; i<8; i++){
+    Word = (Word<<8) | BitMapSector->Byte[FirstByte + i];
+  }
+  return Word;
+}
+
+/*
+Look for the first free sector at or after From and before To.
+Full words are skipped 64 sectors at a time. Returns -1 if every
+sector in the range is in use.
+*/
+INT16 FindFreeSector(DISK_CACHE *Cache, INT16 From, INT16 To){
+
+  INT16 WordNumber = From/64;
+  INT16 Offset = From%64;
+
+  while(WordNumber*64 < To){
+
+    unsigned long long Word = GetBitMapWord(Cache, WordNumber);
+
+    //Sectors before From count as used
+    if(Offset != 0){
+      Word |= ~0ULL << (64 - Offset);
+    }
+
+    if(Word != ~0ULL){
+      INT16 Position = 0;
+      while(Word & (0x8000000000000000ULL >> Position)){
+	Position++;
+      }
+      if(WordNumber*64 + Position >= To){
+	return -1;
+      }
+      return WordNumber*64 + Position;
     }
-    position++;
-    Mask = Mask>>1;
+    WordNumber++;
+    Offset = 0;
   }
-  aprintf("\n\nError: All Bits Set\n\n");
   return -1;
 }
 
+/*
+Count how many free sectors follow Start, stopping at Limit or at the
+first sector in use. Empty words are counted 64 sectors at a time.
+*/
+INT16 CountFreeRun(DISK_CACHE *Cache, INT16 Start, INT16 Limit){
+
+  INT16 Sector = Start;
+
+  while(Sector < Limit){
+    unsigned long long Word = GetBitMapWord(Cache, Sector/64);
+
+    if(Sector%64 == 0 && Word == 0){
+      Sector = Sector + 64;
+      continue;
+    }
+    if(Word & (0x8000000000000000ULL >> (Sector%64))){
+      break;
+    }
+    Sector++;
+  }
+  if(Sector > Limit){
+    Sector = Limit;
+  }
+  return Sector - Start;
+}
+
+/*
+Search the range From to To for Length free sectors in a row.
+StartSector is set to the first sector of the run or 0 if there is
+no run long enough.
+*/
+void FindExtentInRange(DISK_CACHE *Cache, INT16 From, INT16 To,
+		       INT16 Length, INT16 *StartSector){
+
+  INT16 Sector = From;
+
+  while(Sector >= 0 && Sector + Length <= To){
+
+    Sector = FindFreeSector(Cache, Sector, To);
+    if(Sector < 0 || Sector + Length > To){
+      break;
+    }
+
+    INT16 RunLength = CountFreeRun(Cache, Sector, Sector + Length);
+    if(RunLength == Length){
+      (*StartSector) = Sector;
+      return;
+    }
+    //Skip past the used sector that ended this run
+    Sector = Sector + RunLength + 1;
+  }
+  (*StartSector) = 0;
+}
 
 /*
-Passed the address of the BIT_MAP structure. Step through it to find 
-the next available sector.
-We need to fill the Bit Map structure with Disk Reads as necessary.
+Find Length contiguous free sectors and mark them in use in the bitmap.
+The search is next fit: it starts where the last allocation ended and
+wraps around to the start of the disk. This keeps the sectors of a file
+that is written sequentially next to each other on the disk.
+StartSector is set to 0 if no run of that length is free.
+*/
+void GetAvailableExtent(DISK_CACHE *Cache, long DiskID, INT16 Length,
+			INT16 *StartSector){
+
+  INT16 Hint = NextFreeSectorHint[DiskID];
+  if(Hint <= 0 || Hint >= NUMBER_LOGICAL_SECTORS){
+    Hint = 1;
+  }
+
+  FindExtentInRange(Cache, Hint, NUMBER_LOGICAL_SECTORS, Length,
+		    StartSector);
+  if((*StartSector) == 0){
+    INT16 WrapLimit = Hint + Length - 1;
+    if(WrapLimit > NUMBER_LOGICAL_SECTORS){
+      WrapLimit = NUMBER_LOGICAL_SECTORS;
+    }
+    FindExtentInRange(Cache, 1, WrapLimit, Length, StartSector);
+  }
+  if((*StartSector) == 0){
+    return;
+  }
+
+  for(INT16 i=0; i<Length; i++){
+    SetBitInBitMap(Cache, (*StartSector) + i);
+  }
+  NextFreeSectorHint[DiskID] = (*StartSector) + Length;
+}
+
+/*
+Find the next available sector and mark it in use in the bitmap.
 Set the flag to indicate a change has been made in the bitmap sectors.
+If Nothing is available on disk AvailableSector is set to 0.
 */
-void GetAvailableSector(DISK_CACHE *Cache, INT16 *AvailableSector){
+void GetAvailableSector(DISK_CACHE *Cache, long DiskID,
+			INT16 *AvailableSector){
 
-  INT16 BitMapStart = 1;
-  
-  for(INT16 i=BitMapStart; i<BitMapStart+0x10; i++){
-    for(INT16 j=0; j<16; j++){
-      if(Cache->Block[i].Byte[j] != 0xFF){
+  GetAvailableExtent(Cache, DiskID, 1, AvailableSector);
+}
 
-	INT16 Position = TestBit(Cache->Block[i].Byte[j]);
+/*
+Claim the Length sectors starting at Start if every one of them is
+free. Returns TRUE if they were claimed.
+*/
+INT32 ClaimSectorsAt(DISK_CACHE *Cache, long DiskID, INT16 Start,
+		     INT16 Length){
 
-	(*AvailableSector) = 128*(i-1) + 8*j + Position;
-	SetBitInBitMap(Cache, *AvailableSector);
-	return;
-      }
+  if(Start <= 0 || Start + Length > NUMBER_LOGICAL_SECTORS){
+    return FALSE;
+  }
+  if(CountFreeRun(Cache, Start, Start + Length) != Length){
+    return FALSE;
+  }
+  for(INT16 i=0; i<Length; i++){
+    SetBitInBitMap(Cache, Start + i);
+  }
+  NextFreeSectorHint[DiskID] = Start + Length;
+  return TRUE;
+}
+
+/*
+An extent table has 4 entries of 4 bytes. Each entry is the first
+sector of a run followed by the number of sectors in the run. Both are
+stored MSB first like the index entries. A start of 0 is an unused
+entry.
+*/
+void GetExtent(DISK_BLOCK *Table, INT16 Entry, INT16 *Start,
+	       INT16 *Length){
+
+  (*Start) = (Table->Byte[Entry*4]<<8) + Table->Byte[Entry*4+1];
+  (*Length) = (Table->Byte[Entry*4+2]<<8) + Table->Byte[Entry*4+3];
+}
+
+void SetExtent(DISK_BLOCK *Table, INT16 Entry, INT16 Start, INT16 Length){
+
+  Table->Byte[Entry*4] = Start>>8;
+  Table->Byte[Entry*4+1] = Start & 0x00FF;
+  Table->Byte[Entry*4+2] = Length>>8;
+  Table->Byte[Entry*4+3] = Length & 0x00FF;
+}
+
+/*
+Find the disk sector that holds logical block Block of an extent file.
+Remaining is set to the number of sectors left in the run, counting the
+one returned. Returns 0 if the block has no sector yet.
+*/
+INT16 FindExtentSector(DISK_BLOCK *Table, INT16 Block, INT16 *Remaining){
+
+  INT16 Start;
+  INT16 Length;
+
+  for(INT16 i=0; i<EXTENTS_PER_TABLE; i++){
+    GetExtent(Table, i, &Start, &Length);
+    if(Start == 0){
+      break;
+    }
+    if(Block < Length){
+      (*Remaining) = Length - Block;
+      return Start + Block;
     }
+    Block = Block - Length;
   }
-  //If Nothing is available on disk set return to 0
-  (*AvailableSector) = 0;
-  return;
+  (*Remaining) = 0;
+  return 0;
+}
+
+/*
+Return the data sector for logical block Block of an extent file,
+adding sectors to the file if needed. The first run holds just the
+block being written so a one block file takes one sector. After that
+the last run is grown by EXTENT_GROW sectors in place when the sectors
+after it are free. Otherwise a new run of EXTENT_GROW is started.
+Returns 0 when the extent table is full or the disk is too fragmented,
+in which case the file has to fall back to the index.
+*/
+INT16 ExtendExtentFile(DISK_CACHE *Cache, long DiskID, INT16 TableSector,
+		       INT16 Block){
+
+  DISK_BLOCK *Table = &Cache->Block[TableSector];
+  INT16 Remaining;
+  INT16 DataSector = FindExtentSector(Table, Block, &Remaining);
+
+  if(DataSector != 0){
+    return DataSector;
+  }
+
+  INT16 Last = -1;
+  INT16 Start;
+  INT16 Length;
+  for(INT16 i=0; i<EXTENTS_PER_TABLE; i++){
+    GetExtent(Table, i, &Start, &Length);
+    if(Start == 0){
+      break;
+    }
+    Last = i;
+  }
+
+  if(Last >= 0){
+    GetExtent(Table, Last, &Start, &Length);
+    if(ClaimSectorsAt(Cache, DiskID, Start + Length, EXTENT_GROW) == TRUE){
+      SetExtent(Table, Last, Start, Length + EXTENT_GROW);
+      Cache->Modified[TableSector] = 1;
+      return FindExtentSector(Table, Block, &Remaining);
+    }
+  }
+
+  if(Last == EXTENTS_PER_TABLE - 1){
+    return 0;
+  }
+  INT16 Grow = EXTENT_GROW;
+  if(Last < 0){
+    Grow = 1;
+  }
+  GetAvailableExtent(Cache, DiskID, Grow, &Start);
+  if(Start == 0){
+    return 0;
+  }
+  SetExtent(Table, Last + 1, Start, Grow);
+  Cache->Modified[TableSector] = 1;
+
+  return FindExtentSector(Table, Block, &Remaining);
+}
+
+/*
+Point logical block Block of a file that uses the three level index at
+DataSector. Any index sectors that are missing along the way are
+allocated.
+*/
+void SetIndexedDataSector(DISK_CACHE *Cache, long DiskID, INT16 TopSector,
+			  INT16 Block, INT16 DataSector){
+
+  INT16 Position[3];
+  Position[0] = Block%8;
+  Position[1] = (Block/8)%8;
+  Position[2] = (Block/64)%8;
+
+  INT16 Sector = TopSector;
+  INT16 NextSector;
+
+  for(INT16 Level=2; Level>0; Level--){
+    GetSubIndex(&Cache->Block[Sector], &NextSector, Position[Level]*2);
+    if(NextSector == 0){
+      GetAvailableSector(Cache, DiskID, &NextSector);
+      SetIndexSpot(&Cache->Block[Sector], Position[Level]*2, NextSector);
+      Cache->Modified[Sector] = 1;
+    }
+    Sector = NextSector;
+  }
+  SetIndexSpot(&Cache->Block[Sector], Position[0]*2, DataSector);
+  Cache->Modified[Sector] = 1;
 }
 
+/*
+Turn an extent file into a file with the three level index. The extent
+table sector becomes the top level index. The data sectors stay where
+they are and sectors that were reserved but never written are freed.
+*/
+void ConvertExtentFileToIndex(DISK_CACHE *Cache, long DiskID,
+			      DISK_BLOCK *Header, INT16 FileBlocks){
+
+  INT16 TableSector;
+  GetHeaderIndexSector(Header, &TableSector);
+
+  DISK_BLOCK Table = Cache->Block[TableSector];
+  INT16 Remaining;
+  INT16 Start;
+  INT16 Length;
+
+  for(INT16 i=0; i<PGSIZE; i++){
+    Cache->Block[TableSector].Byte[i] = 0;
+  }
+  SetFileLevel(Header, 3);
+
+  for(INT16 Block=0; Block<FileBlocks; Block++){
+    SetIndexedDataSector(Cache, DiskID, TableSector, Block,
+			 FindExtentSector(&Table, Block, &Remaining));
+  }
 
+  //Give back the sectors past the end of the file
+  INT16 Block = 0;
+  for(INT16 i=0; i<EXTENTS_PER_TABLE; i++){
+    GetExtent(&Table, i, &Start, &Length);
+    if(Start == 0){
+      break;
+    }
+    for(INT16 j=0; j<Length; j++, Block++){
+      if(Block >= FileBlocks){
+	ClearBitInBitMap(Cache, Start + j);
+      }
+    }
+  }
+  Cache->Modified[TableSector] = 1;
+}
 
 
 void InitializeBitMap(unsigned char BitArray[16][16]){
@@ -564,6 +912,8 @@ void osFormatDisk(long DiskID, long *ReturnError){
 
   if(DiskID < 0 || DiskID >= MAX_NUMBER_OF_DISKS){
     aprintf("\n\nERROR: Disk is not in the proper range\n\n");
+    (*ReturnError) = ERR_BAD_PARAM;
+    return;
   }
 
   //get the Current Process information
@@ -615,6 +965,17 @@ void osFormatDisk(long DiskID, long *ReturnError){
   for(INT16 i=0x0600; i<= 0x7FF; i++){
     SetBitInBitMap(Cache, i);
   }
+
+  //Start looking for free space just past the root directory
+  NextFreeSectorHint[DiskID] = 0x13;
+
+  //Any directories we had indexed are gone
+  ClearDirectoryIndexes();
+
+  //and so is anything read ahead from the old file system
+  for(INT16 i=0; i<NUMBER_LOGICAL_SECTORS; i++){
+    Cache->Loaded[DiskID][i] = SECTOR_NOT_LOADED;
+  }
   
   //Atomic Section
   LockLocation(DISK_LOCK[DiskID]);
@@ -735,12 +1096,19 @@ DISK_BLOCK* osCreateFile(char *FileName, long *ReturnError,
 
   DISK_BLOCK *CurrentDirectory = CurrentPCB->current_directory;
 
-  //look in bitmap address until find two blocks available
+  //look in bitmap for two blocks available. Keep the header next to
+  //its index if we can.
   INT16 NewHeaderSector;
   INT16 NewIndexSector;
 
-  GetAvailableSector(Cache, &NewHeaderSector);
-  GetAvailableSector(Cache, &NewIndexSector);
+  GetAvailableExtent(Cache, DiskID, 2, &NewHeaderSector);
+  if(NewHeaderSector != 0){
+    NewIndexSector = NewHeaderSector + 1;
+  }
+  else{
+    GetAvailableSector(Cache, DiskID, &NewHeaderSector);
+    GetAvailableSector(Cache, DiskID, &NewIndexSector);
+  }
   
   INT16 IndexSector;
   GetHeaderIndexSector(CurrentDirectory, &IndexSector);
@@ -766,6 +1134,10 @@ DISK_BLOCK* osCreateFile(char *FileName, long *ReturnError,
     SetFileOrDirectory(NewHeader, DIR);
     SetFileLevel(NewHeader, 1); //default for directory is 1 level
   }
+  else if(FileLayout == FILE_LAYOUT_EXTENT){
+    SetFileOrDirectory(NewHeader, FILE);
+    SetFileLevel(NewHeader, EXTENT_LEVEL); //Index sector holds extents
+  }
   else{
     SetFileOrDirectory(NewHeader, FILE);
     SetFileLevel(NewHeader, 3); //Default for file is 3 level
@@ -780,6 +1152,8 @@ DISK_BLOCK* osCreateFile(char *FileName, long *ReturnError,
 
   Cache->Modified[NewHeaderSector] = 1;
 
+  AddToDirectoryIndex(Cache, IndexSector, NewHeaderSector);
+
     //Atomic Section
   LockLocation(DISK_LOCK[DiskID]);
   
@@ -823,10 +1197,24 @@ void osOpenFile(char *FileName, long *Inode, long *ReturnError){
     FileToOpen = osCreateFile(FileName, ReturnError, FILE);
   }
 
-  pcb->open_file = FileToOpen;
   unsigned char OpenFileInode;
   GetParentInode(FileToOpen, &OpenFileInode);
-  pcb->open_file_inode = OpenFileInode;
+
+  //Opening a file that is already open just hands back the same Inode
+  if(FindOpenFile(pcb, OpenFileInode) == NULL){
+
+    IN_CORE_INODE *InCore = GetInCoreInode(FileToOpen, pcb->current_disk);
+    if(InCore == NULL){
+      (*ReturnError) = ERR_BAD_PARAM;
+      return;
+    }
+    if(AddOpenFile(pcb, InCore) == FALSE){
+      aprintf("\n\nERROR: Too many open files\n\n");
+      ReleaseInCoreInode(InCore);
+      (*ReturnError) = ERR_BAD_PARAM;
+      return;
+    }
+  }
 
   (*Inode) = OpenFileInode;
   (*ReturnError) = ERR_SUCCESS;
@@ -834,39 +1222,21 @@ void osOpenFile(char *FileName, long *Inode, long *ReturnError){
 }
 
 /*
-Write a block of data to the open file given by Inode.
+Find the data sector for logical block Block of a file that uses the
+three level index, allocating whatever index and data sectors are
+missing. A first level index is allocated along with the data sectors
+it points to.
 */
-void osWriteFile(long Inode, long Index, char *WriteBuffer,
-		 long *ReturnError){
-
-  PROCESS_CONTROL_BLOCK *CurrentPCB = GetCurrentPCB();
-
-  if(CurrentPCB->open_file_inode != Inode){
-    aprintf("\n\nERROR: File Not Open\n\n");
-    (*ReturnError) = ERR_BAD_PARAM;
-    return;
-  }
-
-  DISK_BLOCK *Header = CurrentPCB->open_file;
-  INT16 ThirdLevelSector;
-
-  //Get the Disk Sector where the Header has its top most index
-  GetHeaderIndexSector(Header, &ThirdLevelSector);
-  
-  //File Size in Bytes
-  INT16 FileSize;
-  GetFileSize(Header, &FileSize);
-
-  INT16 FileBlocks = FileSize/PGSIZE;
+INT16 GetIndexedSectorForWrite(DISK_CACHE *Cache, long DiskID,
+			       INT16 ThirdLevelSector, INT16 Block){
 
   //Calculate the SubIndices
-  INT16 Position1 = FileBlocks%8;
-  FileBlocks = FileBlocks/8;
-  INT16 Position2 = FileBlocks%8;
-  FileBlocks = FileBlocks/8;
-  INT16 Position3 = FileBlocks%8;
+  INT16 Position1 = Block%8;
+  Block = Block/8;
+  INT16 Position2 = Block%8;
+  Block = Block/8;
+  INT16 Position3 = Block%8;
 
-    
   DISK_BLOCK *ThirdLevelIndex = &Cache->Block[ThirdLevelSector]; 
 
   INT16 SecondLevelSector;
@@ -876,7 +1246,7 @@ void osWriteFile(long Inode, long Index, char *WriteBuffer,
 
   if(SecondLevelSector == 0){
 
-    GetAvailableSector(Cache, &SecondLevelSector);
+    GetAvailableSector(Cache, DiskID, &SecondLevelSector);
     SetIndexSpot(ThirdLevelIndex, Position3*2, SecondLevelSector);
     Cache->Modified[ThirdLevelSector] = 1;
   }
@@ -889,19 +1259,120 @@ void osWriteFile(long Inode, long Index, char *WriteBuffer,
   GetSubIndex(SecondLevelIndex, &FirstLevelSector, Position2*2);
 
   if(FirstLevelSector == 0){
-    GetAvailableSector(Cache, &FirstLevelSector);
+
+    //Grab the index and its data sectors as one run so the blocks of
+    //the file follow each other on the disk.
+    GetAvailableExtent(Cache, DiskID, DATA_SECTORS_PER_INDEX + 1,
+		       &FirstLevelSector);
+    if(FirstLevelSector != 0){
+      for(INT16 i=0; i<DATA_SECTORS_PER_INDEX; i++){
+	SetIndexSpot(&Cache->Block[FirstLevelSector], i*2,
+		     FirstLevelSector + 1 + i);
+      }
+    }
+    else{
+      GetAvailableSector(Cache, DiskID, &FirstLevelSector);
+    }
     SetIndexSpot(SecondLevelIndex, Position2*2, FirstLevelSector);
     Cache->Modified[SecondLevelSector] = 1;
+    Cache->Modified[FirstLevelSector] = 1;
   }
 
   FirstLevelIndex = &Cache->Block[FirstLevelSector];
 
-  
-  //Now grab a disk sector and copy the Buffer into it
+  //Now find the disk sector for this block.
+  //It was normally reserved along with the first level index.
+  INT16 DataSector;
+  GetSubIndex(FirstLevelIndex, &DataSector, Position1*2);
+  if(DataSector == 0){
+    GetAvailableSector(Cache, DiskID, &DataSector);
+    SetIndexSpot(FirstLevelIndex, Position1*2, DataSector);
+    Cache->Modified[FirstLevelSector] = 1;
+  }
+  return DataSector;
+}
+
+/*
+Find the data sector of logical block Block of an open file that uses
+the three level index. The first level index found last time is kept in
+the in core inode, so a sequential scan only walks the upper two levels
+once every 8 blocks.
+*/
+INT16 GetIndexedSector(DISK_CACHE *Cache, IN_CORE_INODE *InCore,
+		       INT16 Block){
+
+  if(InCore->first_level_sector == 0 ||
+     InCore->first_level_block != Block/8){
+
+    //Calculate the SubIndices above the first level
+    INT16 Position2 = (Block/8)%8;
+    INT16 Position3 = (Block/64)%8;
+
+    INT16 SecondLevelSector;
+    GetSubIndex(&Cache->Block[InCore->index_sector], &SecondLevelSector,
+		Position3*2);
+
+    INT16 FirstLevelSector;
+    GetSubIndex(&Cache->Block[SecondLevelSector], &FirstLevelSector,
+		Position2*2);
+    if(FirstLevelSector == 0){
+      return 0;
+    }
+    InCore->first_level_block = Block/8;
+    InCore->first_level_sector = FirstLevelSector;
+  }
+
+  //Now grab the data sector.
   INT16 DataSector;
-  GetAvailableSector(Cache, &DataSector);
-  SetIndexSpot(FirstLevelIndex, Position1*2, DataSector);
-  Cache->Modified[FirstLevelSector] = 1;
+  GetSubIndex(&Cache->Block[InCore->first_level_sector], &DataSector,
+	      (Block%8)*2);
+
+  return DataSector;
+}
+
+/*
+Write a block of data to the open file given by Inode.
+*/
+void osWriteFile(long Inode, long Index, char *WriteBuffer,
+		 long *ReturnError){
+
+  PROCESS_CONTROL_BLOCK *CurrentPCB = GetCurrentPCB();
+  OPEN_FILE *OpenFile = FindOpenFile(CurrentPCB, Inode);
+
+  if(OpenFile == NULL){
+    aprintf("\n\nERROR: File Not Open\n\n");
+    (*ReturnError) = ERR_BAD_PARAM;
+    return;
+  }
+
+  IN_CORE_INODE *InCore = OpenFile->in_core;
+  DISK_BLOCK *Header = InCore->header;
+  long DiskID = CurrentPCB->current_disk;
+  INT16 ThirdLevelSector = InCore->index_sector;
+  
+  //File Size in Bytes
+  INT16 FileSize;
+  GetFileSize(Header, &FileSize);
+
+  INT16 FileBlocks = FileSize/PGSIZE;
+
+  INT16 DataSector = 0;
+  unsigned char Level;
+  GetFileLevel(Header, &Level);
+
+  //Extent files fall back to the index when they can't grow any more
+  if(Level == EXTENT_LEVEL){
+    DataSector = ExtendExtentFile(Cache, DiskID, ThirdLevelSector,
+				  FileBlocks);
+    if(DataSector == 0){
+      ConvertExtentFileToIndex(Cache, DiskID, Header, FileBlocks);
+      InCore->first_level_sector = 0;
+    }
+  }
+  if(DataSector == 0){
+    DataSector = GetIndexedSectorForWrite(Cache, DiskID, ThirdLevelSector,
+					  FileBlocks);
+  }
 
   for(int i=0; i<PGSIZE; i++){
     Cache->Block[DataSector].Byte[i] = WriteBuffer[i];
@@ -911,8 +1382,6 @@ void osWriteFile(long Inode, long Index, char *WriteBuffer,
   //Update file size in file header
   FileSize = FileSize + PGSIZE;
   SetFileLength(Header, FileSize);
-  
-  long DiskID = CurrentPCB->current_disk;
     
   //Atomic Section
   LockLocation(DISK_LOCK[DiskID]);
@@ -930,10 +1399,10 @@ void osWriteFile(long Inode, long Index, char *WriteBuffer,
 void osCloseFile(long Inode, long *ReturnError){
 
   PROCESS_CONTROL_BLOCK *CurrentPCB = GetCurrentPCB();
+  OPEN_FILE *OpenFile = FindOpenFile(CurrentPCB, Inode);
 
-  if(CurrentPCB->open_file_inode == Inode){
-    CurrentPCB->open_file_inode = -1;
-    CurrentPCB->open_file = NULL;
+  if(OpenFile != NULL){
+    CloseOpenFile(OpenFile);
     (*ReturnError) = ERR_SUCCESS;
     return;
   }
@@ -941,49 +1410,189 @@ void osCloseFile(long Inode, long *ReturnError){
   (*ReturnError) = ERR_BAD_PARAM;
 }
 
+/*
+Read block Index of an extent file. The rest of the run, up to the end
+of the file, is fetched by the same multi sector transfer so the reads
+that follow in a sequential scan are found in the cache.
+*/
+void ReadExtentFile(long DiskID, DISK_BLOCK *Header, INT16 TableSector,
+		    INT16 Block, char *ReadBuffer){
+
+  INT16 Remaining;
+  INT16 DataSector = FindExtentSector(&Cache->Block[TableSector], Block,
+				      &Remaining);
+
+  if(Cache->Loaded[DiskID][DataSector] == SECTOR_LOADED){
+    ReadAheadHits++;
+  }
+  else{
+    if(Cache->Loaded[DiskID][DataSector] == SECTOR_LOADING){
+      ReadAheadLate++;
+    }
+    ReadMisses++;
+
+    INT16 FileSize;
+    GetFileSize(Header, &FileSize);
+
+    INT16 Count = FileSize/PGSIZE - Block;
+    if(Count > Remaining){
+      Count = Remaining;
+    }
+    if(Count > MAX_SECTORS_PER_READ){
+      Count = MAX_SECTORS_PER_READ;
+    }
+    if(Count < 1){
+      Count = 1;
+    }
+    //Don't fetch again what read ahead already has on the way
+    for(INT16 i=1; i<Count; i++){
+      if(Cache->Loaded[DiskID][DataSector + i] != SECTOR_NOT_LOADED){
+	Count = i;
+	break;
+      }
+    }
+
+    osDiskReadSectors(DiskID, (long)DataSector, (long)Count,
+		      (long)(&Cache->Block[DataSector]));
+    for(INT16 i=0; i<Count; i++){
+      SetSectorLoaded(DiskID, DataSector + i, SECTOR_LOADED);
+    }
+  }
+
+  for(INT16 i=0; i<PGSIZE; i++){
+    ReadBuffer[i] = Cache->Block[DataSector].Byte[i];
+  }
+}
+
+/*
+Find the data sector of logical block Block of an open file for either
+layout. Returns 0 if the block has no sector.
+*/
+INT16 GetReadSector(IN_CORE_INODE *InCore, INT16 Block){
+
+  unsigned char Level;
+  GetFileLevel(InCore->header, &Level);
+
+  if(Level == EXTENT_LEVEL){
+    INT16 Remaining;
+    return FindExtentSector(&Cache->Block[InCore->index_sector], Block,
+			    &Remaining);
+  }
+  return GetIndexedSector(Cache, InCore, Block);
+}
+
+/*
+Called after block Block of an open file has been read. If the process
+is reading the file in order the read ahead window grows, up to
+READ_AHEAD_MAX blocks, and the blocks in the window that have not been
+asked for yet are read into the disk cache without waiting. A read out
+of order shuts read ahead off until the process reads in order again.
+*/
+void ReadAhead(long DiskID, OPEN_FILE *OpenFile, INT16 Block){
+
+  if(Block == OpenFile->last_block_read + 1){
+    if(OpenFile->read_ahead_window == 0){
+      OpenFile->read_ahead_window = READ_AHEAD_MIN;
+    }
+    else if(OpenFile->read_ahead_window < READ_AHEAD_MAX){
+      OpenFile->read_ahead_window = OpenFile->read_ahead_window*2;
+    }
+  }
+  else{
+    OpenFile->read_ahead_window = 0;
+    OpenFile->read_ahead_next = Block + 1;
+  }
+  OpenFile->last_block_read = Block;
+
+  if(OpenFile->read_ahead_window == 0){
+    return;
+  }
+
+  INT16 FileSize;
+  GetFileSize(OpenFile->in_core->header, &FileSize);
+
+  INT16 First = Block + 1;
+  if(First < OpenFile->read_ahead_next){
+    First = OpenFile->read_ahead_next;
+  }
+  INT16 Last = Block + OpenFile->read_ahead_window;
+  if(Last > FileSize/PGSIZE - 1){
+    Last = FileSize/PGSIZE - 1;
+  }
+
+  for(INT16 b=First; b<=Last; b++){
+    INT16 DataSector = GetReadSector(OpenFile->in_core, b);
+    if(DataSector == 0){
+      break;
+    }
+    if(Cache->Loaded[DiskID][DataSector] == SECTOR_NOT_LOADED){
+      SetSectorLoaded(DiskID, DataSector, SECTOR_LOADING);
+      osDiskPrefetchRequest(DiskID, (long)DataSector,
+			    (long)(&Cache->Block[DataSector]));
+      ReadAheadIssued++;
+    }
+    OpenFile->read_ahead_next = b + 1;
+  }
+}
+
+/*
+Print how well read ahead did. Nothing is printed if no files were read.
+*/
+void PrintReadAheadStats(){
+
+  INT32 Reads = ReadAheadHits + ReadMisses;
+
+  if(Reads == 0){
+    return;
+  }
+  aprintf("\nFile Reads: %d  Read Ahead Issued: %d  Hits: %d (%d%%)  "
+	  "Late: %d\n", Reads, ReadAheadIssued, ReadAheadHits,
+	  (ReadAheadHits*100)/Reads, ReadAheadLate);
+}
+
 void osReadFile(long Inode, long Index, char *ReadBuffer, long *ReturnError){
 
   PROCESS_CONTROL_BLOCK *CurrentPCB = GetCurrentPCB();
+  OPEN_FILE *OpenFile = FindOpenFile(CurrentPCB, Inode);
 
-  if(CurrentPCB->open_file_inode != Inode){
+  if(OpenFile == NULL){
     aprintf("\n\nERROR: File Not Open\n\n");
     (*ReturnError) = ERR_BAD_PARAM;
     return;
   }
 
-  DISK_BLOCK *Header = CurrentPCB->open_file;
-  long DiskID = CurrentPCB->current_disk;
-  INT16 ThirdLevelSector;
-
-  //Get the Disk Sector where the Header has its top most index
-  GetHeaderIndexSector(Header, &ThirdLevelSector);
-
-  //Calculate the SubIndices
-  INT16 Position1 = Index%8;
-  Index = Index/8;
-  INT16 Position2 = Index%8;
-  Index = Index/8;
-  INT16 Position3 = Index%8;
+  IN_CORE_INODE *InCore = OpenFile->in_core;
+  DISK_BLOCK *Header = InCore->header;
+  long DiskID = InCore->disk_id;
+  INT16 ThirdLevelSector = InCore->index_sector;
 
-  DISK_BLOCK *ThirdLevelIndex = &Cache->Block[ThirdLevelSector]; 
+  unsigned char Level;
+  GetFileLevel(Header, &Level);
 
-  INT16 SecondLevelSector;
-  DISK_BLOCK *SecondLevelIndex;
-  
-  GetSubIndex(ThirdLevelIndex, &SecondLevelSector, Position3*2);
-  SecondLevelIndex = &Cache->Block[SecondLevelSector];
+  if(Level == EXTENT_LEVEL){
+    ReadExtentFile(DiskID, Header, ThirdLevelSector, Index, ReadBuffer);
+    ReadAhead(DiskID, OpenFile, Index);
+    (*ReturnError) = ERR_SUCCESS;
+    return;
+  }
 
-  INT16 FirstLevelSector;
-  DISK_BLOCK *FirstLevelIndex;
-  
-  GetSubIndex(SecondLevelIndex, &FirstLevelSector, Position2*2);
-  FirstLevelIndex = &Cache->Block[FirstLevelSector];
+  INT16 DataSector = GetIndexedSector(Cache, InCore, Index);
 
-  //Now grab the data sector.
-  INT16 DataSector;
-  GetSubIndex(FirstLevelIndex, &DataSector, Position1*2);
-  
-  osDiskReadRequest(DiskID, (long)DataSector, (long)ReadBuffer);
+  //A block brought in by read ahead doesn't need the disk
+  if(Cache->Loaded[DiskID][DataSector] == SECTOR_LOADED){
+    for(INT16 i=0; i<PGSIZE; i++){
+      ReadBuffer[i] = Cache->Block[DataSector].Byte[i];
+    }
+    ReadAheadHits++;
+  }
+  else{
+    if(Cache->Loaded[DiskID][DataSector] == SECTOR_LOADING){
+      ReadAheadLate++;
+    }
+    ReadMisses++;
+    osDiskReadRequest(DiskID, (long)DataSector, (long)ReadBuffer);
+  }
+  ReadAhead(DiskID, OpenFile, Index);
 
   (*ReturnError) = ERR_SUCCESS;
 }
@@ -6,6 +6,42 @@
 #define FILE 0
 #define DIR 1
 
+//The bitmap starts at sector 1. Each 16 byte sector holds two 64 bit words
+#define BITMAP_START_SECTOR 1
+#define BITMAP_WORDS_PER_SECTOR 2
+
+//A first level index is allocated along with the 8 data sectors it
+//points to so a sequentially written file sits in one run on the disk
+#define DATA_SECTORS_PER_INDEX 8
+
+//Sector on each disk where the next free space search starts (next fit)
+INT16 NextFreeSectorHint[MAX_NUMBER_OF_DISKS];
+
+//Files can be laid out with the three level index or as extents.
+//An extent file has level 0 and its header points to a table of runs
+//(start sector, length) instead of an index.
+#define FILE_LAYOUT_INDEX 0
+#define FILE_LAYOUT_EXTENT 1
+#define EXTENT_LEVEL 0
+#define EXTENTS_PER_TABLE 4
+//Sectors added to an extent file each time it runs out of room
+#define EXTENT_GROW 8
+//Largest number of sectors fetched by one read of an extent file
+#define MAX_SECTORS_PER_READ 8
+
+INT32 FileLayout;
+
+//Read ahead starts at READ_AHEAD_MIN blocks once a file is read in
+//order and doubles on each read in order up to READ_AHEAD_MAX
+#define READ_AHEAD_MIN 2
+#define READ_AHEAD_MAX 8
+
+//Read ahead statistics
+INT32 ReadAheadIssued;
+INT32 ReadAheadHits;
+INT32 ReadAheadLate;
+INT32 ReadMisses;
+
 unsigned int InodeArray[MAX_NUMBER_INODES];
 
 
@@ -17,8 +53,15 @@ void osWriteFile(long Inode, long Index, char *WriteBuffer, long *ReturnError);
 void osReadFile(long Inode, long Index, char *WriteBuffer, long *ReturnError);
 void osCloseFile(long Inode, long *ReturnError);
 void osPrintCurrentDirContents(long *ReturnError);
+void PrintReadAheadStats();
 void InitializeInodes();
 void GetInode(unsigned char *NewInode);
 DISK_CACHE* CreateDiskCache();
+void GetHeaderIndexSector(DISK_BLOCK *Header, INT16 *IndexAddress);
+void SetSectorLoaded(long DiskID, INT16 Sector, unsigned char State);
+void GetAvailableSector(DISK_CACHE *Cache, long DiskID,
+			INT16 *AvailableSector);
+void GetAvailableExtent(DISK_CACHE *Cache, long DiskID, INT16 Length,
+			INT16 *StartSector);
 
 #endif //DISK_MANAGE_H
@@ -13,6 +13,7 @@ This file holds the functions that deal with the Disk Queues. Note that there is
 #include "timerQueue.h" 
 #include "readyQueue.h"
 #include "diskQueue.h"
+#include "diskManagement.h"
 #include "osSchedulePrinter.h"
 
 /*
@@ -27,7 +28,7 @@ void CreateDiskQueue(INT32 DiskNumber){
   //This serves as the Queue Name
   char num[2];
   snprintf((char *)(&num), 2, "%d", DiskNumber);
-  char queue_name[8];
+  char queue_name[10];
   strcpy(queue_name, "DQUEUE_");
   strcat(queue_name, num);
 
@@ -35,6 +36,14 @@ void CreateDiskQueue(INT32 DiskNumber){
   if(disk_queue[DiskNumber] == -1){
     aprintf("\n\nUnable to create Disk Queue!\n\n");
   }    
+
+  //The write behind queue is WQUEUE_ + DiskNumber
+  queue_name[0] = 'W';
+  write_behind_queue[DiskNumber] = QCreate(queue_name);
+  write_behind_count[DiskNumber] = 0;
+  if(write_behind_queue[DiskNumber] == -1){
+    aprintf("\n\nUnable to create Write Behind Queue!\n\n");
+  }
 }
 
 /*
@@ -74,6 +83,8 @@ void AddToDiskQueue(long DiskID, DQ_ELEMENT *dqe){
   //LockLocation(DISK_LOCK[DiskID]);
   QInsertOnTail(disk_queue[DiskID], (void *) dqe);
   //UnlockLocation(DISK_LOCK[DiskID]);
+  disk_queue_depth[DiskID]++;
+  Z502AddToStatistic(disk_depth_stat, disk_queue_depth[DiskID]);
 }
 
 /*
@@ -85,6 +96,9 @@ DQ_ELEMENT* RemoveFromDiskQueueHead(long DiskID){
   //LockLocation(DISK_LOCK[DiskID]);
   DQ_ELEMENT* dqe = (DQ_ELEMENT *)QRemoveHead(disk_queue[DiskID]);
   // UnlockLocation(DISK_LOCK[DiskID]);
+  if((long)dqe != -1){
+    disk_queue_depth[DiskID]--;
+  }
 
   return dqe;
 }
@@ -156,6 +170,261 @@ void osDiskReadRequest(long DiskID, long DiskSector, long DiskAddress){
   dispatcher();
 }
 
+/*
+Read Count consecutive sectors starting at FirstSector into consecutive
+16 byte buffers starting at DiskAddress. All the requests are put on the
+Disk Queue together so the disk works through them back to back. The
+process is only suspended once and is woken when the last sector has
+arrived since HandleDiskInterrupt doesn't wake a process that has
+another request next in the queue.
+*/
+void osDiskReadSectors(long DiskID, long FirstSector, long Count,
+		       long DiskAddress){
+
+  MEMORY_MAPPED_IO mmio;
+  PROCESS_CONTROL_BLOCK* curr_proc = GetCurrentPCB();
+  DQ_ELEMENT *dq;
+  long status;
+
+  if(Count <= 0){
+    return;
+  }
+
+  //The whole disk add operation needs to be atomic.
+  LockLocation(DISK_LOCK[DiskID]);
+
+  CheckDiskStatus(DiskID, &status);
+
+  //If the disk is free start on the first sector right away.
+  if(status == DEVICE_FREE && (long)CheckDiskQueue(DiskID) == -1){
+
+    mmio.Mode = Z502DiskRead;
+    mmio.Field1 = DiskID;
+    mmio.Field2 = FirstSector;
+    mmio.Field3 = DiskAddress;
+    MEM_WRITE(Z502Disk, &mmio);
+  }
+
+  for(long i=0; i<Count; i++){
+    dq = malloc(sizeof(DQ_ELEMENT));
+    dq->context = curr_proc->context;
+    dq->PID = curr_proc->idnum;
+    dq->PCB = curr_proc;
+    dq->disk_id = DiskID;
+    dq->disk_sector = FirstSector + i;
+    dq->disk_address = DiskAddress + i*PGSIZE;
+    dq->disk_action = READ_DISK;
+    AddToDiskQueue(DiskID, dq);
+  }
+
+  //done with atomic section
+  UnlockLocation(DISK_LOCK[DiskID]);
+
+  osPrintState("SUS DSK",curr_proc->idnum, curr_proc->idnum);
+  //set process state to DISK
+  ChangeProcessState(curr_proc->idnum, DISK);
+
+  dispatcher();
+}
+
+/*
+Returns TRUE for the disk actions no process waits for.
+*/
+INT32 IsAsyncDiskAction(INT32 Action){
+
+  if(Action == PREFETCH_DISK || Action == PAGE_OUT_DISK){
+    return TRUE;
+  }
+  return FALSE;
+}
+
+/*
+Start a read ahead of DiskSector into DiskAddress. Unlike the other
+requests the process carries on without waiting. When the read is done
+HandleDiskInterrupt marks the sector loaded in the disk cache.
+*/
+void osDiskPrefetchRequest(long DiskID, long DiskSector, long DiskAddress){
+
+  MEMORY_MAPPED_IO mmio;
+  PROCESS_CONTROL_BLOCK* curr_proc = GetCurrentPCB();
+  DQ_ELEMENT *dq;
+  long status;
+
+  dq = malloc(sizeof(DQ_ELEMENT));
+  dq->context = curr_proc->context;
+  dq->PID = curr_proc->idnum;
+  dq->PCB = curr_proc;
+  dq->disk_id = DiskID;
+  dq->disk_sector = DiskSector;
+  dq->disk_address = DiskAddress;
+  dq->disk_action = PREFETCH_DISK;
+
+  LockLocation(DISK_LOCK[DiskID]);
+
+  CheckDiskStatus(DiskID, &status);
+
+  if(status == DEVICE_FREE && (long)CheckDiskQueue(DiskID) == -1){
+
+    mmio.Mode = Z502DiskRead;
+    mmio.Field1 = DiskID;
+    mmio.Field2 = DiskSector;
+    mmio.Field3 = DiskAddress;
+    MEM_WRITE(Z502Disk, &mmio);
+  }
+  AddToDiskQueue(DiskID, dq);
+
+  UnlockLocation(DISK_LOCK[DiskID]);
+}
+
+/*
+Throw away the writes held for DiskSector on the write behind queue
+along with their buffers. The caller holds the disk lock.
+*/
+void DropWriteBehind(long DiskID, long DiskSector){
+
+  DQ_ELEMENT *dqe;
+  INT32 i = 0;
+
+  while(TRUE){
+    dqe = (DQ_ELEMENT *)QWalk(write_behind_queue[DiskID], i);
+    if((long)dqe == -1){
+      break;
+    }
+    if(dqe->disk_sector != DiskSector){
+      i++;
+      continue;
+    }
+    QRemoveItem(write_behind_queue[DiskID], (void *)dqe);
+    write_behind_count[DiskID]--;
+    free((void *)dqe->disk_address);
+    free(dqe);
+  }
+}
+
+/*
+Write the page held in the buffer at DiskAddress to DiskSector without
+waiting. The buffer must come from malloc. It is freed by
+HandleDiskInterrupt once the write is done. If the disk is busy the
+write is held on the write behind queue and only started when the disk
+has nothing else to do, so page outs don't hold up a process's reads.
+When too many writes are held the oldest one joins the Disk Queue.
+*/
+void osDiskPageOutRequest(long DiskID, long DiskSector, long DiskAddress){
+
+  MEMORY_MAPPED_IO mmio;
+  PROCESS_CONTROL_BLOCK* curr_proc = GetCurrentPCB();
+  DQ_ELEMENT *dq;
+  long status;
+
+  dq = malloc(sizeof(DQ_ELEMENT));
+  dq->context = curr_proc->context;
+  dq->PID = curr_proc->idnum;
+  dq->PCB = curr_proc;
+  dq->disk_id = DiskID;
+  dq->disk_sector = DiskSector;
+  dq->disk_address = DiskAddress;
+  dq->disk_action = PAGE_OUT_DISK;
+
+  LockLocation(DISK_LOCK[DiskID]);
+
+  //This write has the newest data for the sector. An older one still
+  //held would land after it.
+  DropWriteBehind(DiskID, DiskSector);
+
+  CheckDiskStatus(DiskID, &status);
+
+  if(status == DEVICE_FREE && (long)CheckDiskQueue(DiskID) == -1){
+
+    mmio.Mode = Z502DiskWrite;
+    mmio.Field1 = DiskID;
+    mmio.Field2 = DiskSector;
+    mmio.Field3 = DiskAddress;
+    MEM_WRITE(Z502Disk, &mmio);
+    AddToDiskQueue(DiskID, dq);
+  }
+  else{
+    if(write_behind_count[DiskID] >= MAX_WRITE_BEHIND){
+      AddToDiskQueue(DiskID, QRemoveHead(write_behind_queue[DiskID]));
+      write_behind_count[DiskID]--;
+    }
+    QInsertOnTail(write_behind_queue[DiskID], (void *) dq);
+    write_behind_count[DiskID]++;
+  }
+
+  UnlockLocation(DISK_LOCK[DiskID]);
+}
+
+/*
+Return the newest write held for DiskSector on the write behind queue,
+or NULL if there is none. The caller holds the disk lock.
+*/
+DQ_ELEMENT* FindWriteBehind(long DiskID, long DiskSector){
+
+  DQ_ELEMENT *dqe;
+  DQ_ELEMENT *Newest = NULL;
+
+  for(INT32 i=0; ; i++){
+    dqe = (DQ_ELEMENT *)QWalk(write_behind_queue[DiskID], i);
+    if((long)dqe == -1){
+      break;
+    }
+    if(dqe->disk_sector == DiskSector){
+      Newest = dqe;
+    }
+  }
+  return Newest;
+}
+
+/*
+Returns TRUE if a write to DiskSector is being held. Reading the sector
+from the disk would give old data.
+*/
+INT32 osDiskCheckWriteBehind(long DiskID, long DiskSector){
+
+  LockLocation(DISK_LOCK[DiskID]);
+  DQ_ELEMENT *Newest = FindWriteBehind(DiskID, DiskSector);
+  UnlockLocation(DISK_LOCK[DiskID]);
+
+  if(Newest == NULL){
+    return FALSE;
+  }
+  return TRUE;
+}
+
+/*
+Throw away any write to DiskSector still being held. Used when the
+sector is given back, so a stale page out can't land on it after it
+has been handed to someone else.
+*/
+void osDiskCancelWriteBehind(long DiskID, long DiskSector){
+
+  LockLocation(DISK_LOCK[DiskID]);
+  DropWriteBehind(DiskID, DiskSector);
+  UnlockLocation(DISK_LOCK[DiskID]);
+}
+
+/*
+Look for DiskSector among the writes held on the write behind queue. If
+it is there the newest data for the sector is copied to DiskAddress and
+TRUE is returned. Otherwise the sector has to be read from the disk.
+*/
+INT32 osDiskReadWriteBehind(long DiskID, long DiskSector, long DiskAddress){
+
+  LockLocation(DISK_LOCK[DiskID]);
+
+  DQ_ELEMENT *Newest = FindWriteBehind(DiskID, DiskSector);
+  if(Newest != NULL){
+    memcpy((void *)DiskAddress, (void *)Newest->disk_address, PGSIZE);
+  }
+
+  UnlockLocation(DISK_LOCK[DiskID]);
+
+  if(Newest == NULL){
+    return FALSE;
+  }
+  return TRUE;
+}
+
 /*
 This function handles the Write Disk Service Call. It creates a
 DQ_ELEMENT and adds it to the Disk Queue given by DiskID. If the disk
@@ -183,6 +452,10 @@ void osDiskWriteRequest(long DiskID, long DiskSector, long DiskAddress){
   //The whole disk add operation needs to be atomic.
   //We have to check to see if the disk is busy and then use it if so.
   LockLocation(DISK_LOCK[DiskID]);
+
+  //A page out still held for the sector has older data. It must not
+  //reach the disk after this write, or be read back instead of it.
+  DropWriteBehind(DiskID, DiskSector);
   
   CheckDiskStatus(DiskID, &status);
 
@@ -213,34 +486,38 @@ void osDiskWriteRequest(long DiskID, long DiskSector, long DiskAddress){
 /*
 This function uses the CheckDisk primitive to see the contents of a
 disk. Note that it does not seem to cause an interrupt. It just gets 
-the contents and returns.
+the contents and returns. If the disk is still busy, for example with
+page outs done in the background, we sleep until it is free.
 */
 void osCheckDiskRequest(long DiskID, long *ReturnError){
 
   long Status;
   MEMORY_MAPPED_IO mmio;
 
-  //start with atomic section
-  LockLocation(DISK_LOCK[DiskID]);
+  while(TRUE){
 
-  
-  CheckDiskStatus(DiskID, &Status);
+    //start with atomic section
+    LockLocation(DISK_LOCK[DiskID]);
+
+    CheckDiskStatus(DiskID, &Status);
 
-  //If disk is free proceed with the Check
-  if(Status == DEVICE_FREE && (long)CheckDiskQueue(DiskID) == -1){
+    //If disk is free proceed with the Check
+    if(Status == DEVICE_FREE && (long)CheckDiskQueue(DiskID) == -1 &&
+       write_behind_count[DiskID] == 0){
 	
-    mmio.Mode = Z502CheckDisk;
-    mmio.Field1 = DiskID;
-    mmio.Field2 = mmio.Field3 = mmio.Field4 = 0;
+      mmio.Mode = Z502CheckDisk;
+      mmio.Field1 = DiskID;
+      mmio.Field2 = mmio.Field3 = mmio.Field4 = 0;
 	
-    MEM_WRITE(Z502Disk, &mmio);
-     
-  }
-  else{
-    aprintf("\n\nERROR: Disk %ld is not free. Cannot Check Disk\n\n", DiskID);
+      MEM_WRITE(Z502Disk, &mmio);
+
+      //done with atomic section
+      UnlockLocation(DISK_LOCK[DiskID]);
+      break;
+    }
+    UnlockLocation(DISK_LOCK[DiskID]);
+    StartTimer(CHECK_DISK_WAIT);
   }
-  //done with atomic section
-  UnlockLocation(DISK_LOCK[DiskID]);
 
   (*ReturnError) = ERR_SUCCESS;
 }
@@ -256,8 +533,26 @@ void HandleDiskInterrupt(long DiskID){
   LockLocation(DISK_LOCK[DiskID]);
   
   DQ_ELEMENT* dqe = RemoveFromDiskQueueHead(DiskID);
-  
+
+  //A finished read ahead leaves its sector in the cache. Nobody is
+  //waiting for it.
+  if(dqe->disk_action == PREFETCH_DISK){
+    SetSectorLoaded(DiskID, dqe->disk_sector, SECTOR_LOADED);
+  }
+  //A page out owns its buffer
+  if(dqe->disk_action == PAGE_OUT_DISK){
+    free((void *)dqe->disk_address);
+  }
  
+  //If nothing else is waiting for the disk start on the held writes
+  if((long)CheckDiskQueue(DiskID) == -1){
+    DQ_ELEMENT *held = (DQ_ELEMENT *)QRemoveHead(write_behind_queue[DiskID]);
+    if((long)held != -1){
+      AddToDiskQueue(DiskID, held);
+      write_behind_count[DiskID]--;
+    }
+  }
+
   //We need to check for another element on the disk queue that needs
   //service.
   //Watch Out! I have seen the case where the item that was just placed
@@ -270,7 +565,8 @@ void HandleDiskInterrupt(long DiskID){
     //or it is another process. If it is the same there is no need to
     //put the PCB on the Ready Queue. In this case just restart the
     //Disk.
-    if(next_dqe->PID == dqe->PID){
+    if(next_dqe->PID == dqe->PID &&
+       IsAsyncDiskAction(next_dqe->disk_action) == FALSE){
       PutOnReadyQueue = FALSE;
 
     }
@@ -279,7 +575,8 @@ void HandleDiskInterrupt(long DiskID){
     }
     
     //Set read or write mode
-    if(next_dqe->disk_action == READ_DISK){  	
+    if(next_dqe->disk_action == READ_DISK ||
+       next_dqe->disk_action == PREFETCH_DISK){
       mmio.Mode = Z502DiskRead;
     }
     else{
@@ -295,6 +592,9 @@ void HandleDiskInterrupt(long DiskID){
   else{
     PutOnReadyQueue = TRUE;
   }
+  if(IsAsyncDiskAction(dqe->disk_action) == TRUE){
+    PutOnReadyQueue = FALSE;
+  }
   
   //Done with atomic section.
   UnlockLocation(DISK_LOCK[DiskID]);
@@ -323,9 +623,14 @@ void StartDiskWrite(long DiskID){
 
      if(Status == DEVICE_FREE){
 
-       //maybe in the future we will need to test to see if disk
-       //action is read or write.
-       mmio.Mode = Z502DiskWrite;
+       //The head may be a read ahead that was queued earlier
+       if(dqe->disk_action == READ_DISK ||
+	  dqe->disk_action == PREFETCH_DISK){
+	 mmio.Mode = Z502DiskRead;
+       }
+       else{
+	 mmio.Mode = Z502DiskWrite;
+       }
        mmio.Field1 = DiskID;
        mmio.Field2 = dqe->disk_sector;
        mmio.Field3 = dqe->disk_address;
@@ -12,6 +12,20 @@ void CheckDiskStatus(long disk_id, long* status);
 DQ_ELEMENT* RemoveFromDiskQueueHead(long DiskID);
 DQ_ELEMENT* CheckDiskQueue(long DiskID);
 void osDiskReadRequest(long DiskID, long DiskSector, long DiskAddress);
+void osDiskReadSectors(long DiskID, long FirstSector, long Count,
+		       long DiskAddress);
+void osDiskPrefetchRequest(long DiskID, long DiskSector, long DiskAddress);
+//Most writes held back on one disk. Past this the oldest is put on the
+//Disk Queue so held pages don't grow into a second memory.
+#define MAX_WRITE_BEHIND 8
+
+//Time to sleep between looks at a busy disk before checking it
+#define CHECK_DISK_WAIT 10
+
+void osDiskPageOutRequest(long DiskID, long DiskSector, long DiskAddress);
+INT32 osDiskReadWriteBehind(long DiskID, long DiskSector, long DiskAddress);
+INT32 osDiskCheckWriteBehind(long DiskID, long DiskSector);
+void osDiskCancelWriteBehind(long DiskID, long DiskSector);
 void osDiskWriteRequest(long DiskID, long DiskSector, long DiskAddress);
 void osCheckDiskRequest(long DiskID, long *ReturnError);
 void HandleDiskInterrupt(long DiskID);
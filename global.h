@@ -46,6 +46,8 @@ typedef         unsigned int                   UINT32;
 typedef         short                           INT16;
 typedef         unsigned short                  UINT16;
 typedef         int                             BOOL;
+typedef         long long                       INT64;
+typedef         unsigned long long              UINT64;
 
 /***************************************************************************
   Used internally in the Z502 and a few other places,
@@ -83,6 +85,16 @@ typedef         int                             BOOL;
 #define         PTBL_REFERENCED_BIT             0x2000
 #define         PTBL_PHYS_PG_NO                 0x0FFF
 
+/***************************************************************************
+     A context made with Z502InitializeSparseContext has a two level
+     page table.  The table handed to the hardware is a directory of
+     PTBL_DIRECTORY_ENTRIES pointers.  Each is NULL or the address of a
+     leaf holding PTBL_LEAF_ENTRIES page table entries.  A page whose
+     leaf is NULL is not valid and the hardware takes a fault on it.
+***************************************************************************/
+#define         PTBL_LEAF_ENTRIES               32
+#define         PTBL_DIRECTORY_ENTRIES          (NUMBER_VIRTUAL_PAGES / PTBL_LEAF_ENTRIES)
+
 //     These are the memory mapped IO Functions
 
 #define      Z502Halt                  Z502Idle+1
@@ -111,6 +123,47 @@ typedef         int                             BOOL;
 #define      Z502GetCurrentContext        12
 #define      Z502SetProcessorNumber       13
 #define      Z502GetProcessorNumber       14
+#define      Z502InitializeSparseContext  15
+#define      Z502SetInterruptBatching     16
+#define      Z502SetDeterministicMode     17
+#define      Z502SetTracing               18
+#define      Z502ExportStatistics         19
+
+// Field2 of Z502SetDeterministicMode says what to do with the event log
+
+#define      EVENT_LOG_OFF                 0
+#define      EVENT_LOG_RECORD              1
+#define      EVENT_LOG_REPLAY              2
+
+// Field3 of Z502SetDeterministicMode points at a string of at most
+// this many characters naming the options that change the timing.
+
+#define      EVENT_LOG_OPTIONS_LENGTH    256
+
+// The kinds of record in the binary trace.  The OS adds the dispatch
+// records with Z502TraceEvent(); the hardware writes the rest.
+
+#define      TRACE_DISPATCH                1    // Arg1 = PID switched from
+#define      TRACE_CONTEXT_SWITCH          2    // Arg1 = target PID, Arg2 = how
+#define      TRACE_SVC_ENTER               3    // Arg1 = system call number
+#define      TRACE_SVC_EXIT                4    // Arg1 = system call number
+#define      TRACE_FAULT                   5    // Arg1 = fault, Arg2 = argument
+#define      TRACE_DISK_READ               6    // Arg1 = disk, Arg2 = sector
+#define      TRACE_DISK_WRITE              7    // Arg1 = disk, Arg2 = sector
+#define      TRACE_DISK_DONE               8    // Arg1 = disk, Arg2 = error
+#define      TRACE_TIMER_ARM               9    // Arg1 = delay, Arg2 = deadline
+#define      TRACE_TIMER_FIRE             10    // Arg1 = time it was due
+
+// The statistics registry.  A statistic is a counter or a histogram of
+// samples.  Field1 of Z502ExportStatistics holds the STATS_ formats to
+// write and Field2 says whether to write them now or at halt.
+
+#define      STAT_COUNTER                  0
+#define      STAT_HISTOGRAM                1
+#define      STATS_JSON                    1
+#define      STATS_CSV                     2
+#define      STATS_EXPORT_NOW              0
+#define      STATS_EXPORT_AT_HALT          1
 
 // This is the memory Mapped IO Data Structure.  It is an integral
 // part of all Mapped IO.  It's required that this be filled in by
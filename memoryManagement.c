@@ -18,24 +18,184 @@ replacement, and related things.
 #include "osSchedulePrinter.h"
 
 /*
-The frame manager tracks which frames are in use. All the elements of the 
-frame manager are set to 0 to indicate none of the frames are in use when
-the OS is started.
+The frame table tracks which frames are in use and by whom. When the OS
+is started all the frames are free. Physical memory is not zeroed by the
+hardware, so no frame is marked FRAME_ZEROED until it has been zeroed.
+The frames are put on the free list so that the lowest frame is handed
+out first.
 */
 void InitializeFrameManager(){
 
-  for(INT16 i=0; i<NUMBER_PHYSICAL_PAGES; i++){
-    FrameManager[i] = 0;
+  FreeFrameList = -1;
+  FreeFrameCount = 0;
+  for(INT16 i=NUMBER_PHYSICAL_PAGES-1; i>=0; i--){
+    FrameTable[i].owner = NULL;
+    FrameTable[i].page = 0;
+    FrameTable[i].flags = 0;
+    FrameTable[i].pin_count = 0;
+    FrameTable[i].age = 0;
+    FrameTable[i].loaded_at = 0;
+    FrameTable[i].last_used = 0;
+    FrameTable[i].next_free = FreeFrameList;
+    FreeFrameList = i;
+    FreeFrameCount++;
+  }
+  UnzeroedFreeFrames = NUMBER_PHYSICAL_PAGES;
+}
+
+/*
+Take a frame off the free list. Returns -1 if there are no free frames.
+*/
+INT16 TakeFreeFrame(){
+
+  INT16 Frame = FreeFrameList;
+
+  if(Frame != -1){
+    FreeFrameList = FrameTable[Frame].next_free;
+    FrameTable[Frame].next_free = -1;
+    FreeFrameCount--;
+  }
+  return Frame;
+}
+
+/*
+Give a frame back to the free list.
+*/
+void ReleaseFrame(INT16 Frame){
+
+  if(FrameTable[Frame].owner != NULL){
+    FrameTable[Frame].owner->resident_pages--;
+  }
+  FrameTable[Frame].owner = NULL;
+  FrameTable[Frame].page = 0;
+  FrameTable[Frame].flags = 0;
+  FrameTable[Frame].pin_count = 0;
+  FrameTable[Frame].age = 0;
+  FrameTable[Frame].next_free = FreeFrameList;
+  FreeFrameList = Frame;
+  FreeFrameCount++;
+  UnzeroedFreeFrames++;
+}
+
+/*
+Zero the free frames that still hold the data of their last user. This
+is done by the dispatcher while it has nothing to run so that first
+touches of a page find a zeroed frame waiting. It is only done on a
+uniprocessor since with more processors a fault could be taking a frame
+off the free list at the same time.
+*/
+void ZeroFreeFrames(){
+
+  static char Zeros[PGSIZE];
+
+  if(UnzeroedFreeFrames == 0 || M == MULTI){
+    return;
+  }
+  for(INT16 Frame=FreeFrameList; Frame!=-1;
+      Frame=FrameTable[Frame].next_free){
+    if((FrameTable[Frame].flags & FRAME_ZEROED) == 0){
+      Z502WritePhysicalMemory(Frame, Zeros);
+      FrameTable[Frame].flags |= FRAME_ZEROED;
+    }
+  }
+  UnzeroedFreeFrames = 0;
+}
+
+/*
+A pinned frame is never picked for replacement. Frames are pinned while
+their contents are on the way in from the disk.
+*/
+void PinFrame(INT16 Frame){
+
+  FrameTable[Frame].pin_count++;
+}
+
+void UnpinFrame(INT16 Frame){
+
+  if(FrameTable[Frame].pin_count > 0){
+    FrameTable[Frame].pin_count--;
   }
 }
 
+/*
+Page tables and shadow page tables have two levels. A table is a
+directory of PTBL_DIRECTORY_ENTRIES pointers to leaves of
+PTBL_LEAF_ENTRIES entries, so a process that uses few pages only pays
+for the leaves that hold them. The hardware walks the page table the
+same way. A missing leaf reads as all zero entries.
+*/
+void* CreatePageTable(){
+
+  return calloc(PTBL_DIRECTORY_ENTRIES, sizeof(INT16 *));
+}
+
+/*
+Free a page table or shadow page table along with all its leaves.
+*/
+void DeletePageTable(void *Table){
+
+  INT16 **Directory = Table;
+
+  if(Directory == NULL){
+    return;
+  }
+  for(INT32 i=0; i<PTBL_DIRECTORY_ENTRIES; i++){
+    if(Directory[i] != NULL){
+      free(Directory[i]);
+      PageTableLeaves--;
+    }
+  }
+  free(Directory);
+}
+
+/*
+Return the address of the entry for Page in Table. If the leaf that
+holds it hasn't been made yet NULL is returned, unless Allocate is TRUE
+in which case the leaf is made.
+*/
+INT16* PageTableEntry(void *Table, INT16 Page, INT32 Allocate){
+
+  INT16 **Directory = Table;
+  INT16 *Leaf = Directory[Page / PTBL_LEAF_ENTRIES];
+
+  if(Leaf == NULL){
+    if(Allocate == FALSE){
+      return NULL;
+    }
+    Leaf = calloc(PTBL_LEAF_ENTRIES, sizeof(INT16));
+    if(Leaf == NULL){
+      aprintf("\n\nERROR: Unable to allocate Page Table\n\n");
+      return NULL;
+    }
+    Directory[Page / PTBL_LEAF_ENTRIES] = Leaf;
+    PageTableLeaves++;
+    if(PageTableLeaves > PageTableLeavesPeak){
+      PageTableLeavesPeak = PageTableLeaves;
+    }
+  }
+  return &Leaf[Page % PTBL_LEAF_ENTRIES];
+}
+
+/*
+Return the entry for Page in Table. An entry in a missing leaf is 0.
+*/
+INT16 ReadPageTableEntry(void *Table, INT16 Page){
+
+  INT16 *Entry = PageTableEntry(Table, Page, FALSE);
+
+  if(Entry == NULL){
+    return 0;
+  }
+  return *Entry;
+}
+
 /*
 Check the MSB in the Shadow Page Table. If set this indicates that the logical
 page is on disk.
 */
-INT32 CheckOnDisk(INT16 ShadowTableIndex, INT16 *ShadowPageTable){
+INT32 CheckOnDisk(INT16 ShadowTableIndex, void *ShadowPageTable){
 
-  if((ShadowPageTable[ShadowTableIndex] & 0x8000) == 0){
+  if((ReadPageTableEntry(ShadowPageTable, ShadowTableIndex) & 0x8000) == 0){
     return FALSE;
   }
   return TRUE;
@@ -47,15 +207,133 @@ at some previous point. This would be indicated by bit 15 being set to
 1 in the shadow page table.
 */
 INT32 CheckPreviouslyOnDisk(INT16 ShadowTableIndex,
-			    INT16 *ShadowPageTable){
+			    void *ShadowPageTable){
 
 
-  if((ShadowPageTable[ShadowTableIndex] & 0x4000) == 0){
+  if((ReadPageTableEntry(ShadowPageTable, ShadowTableIndex) & 0x4000) == 0){
     return FALSE;
   }
   return TRUE;
 }
 
+/*
+All the swap space is free when the OS is started.
+*/
+void InitializeSwapSpace(){
+
+  for(INT16 i=0; i<SWAP_SECTORS/8; i++){
+    SwapMap[i] = 0;
+  }
+  SwapSectorsInUse = 0;
+  SwapSectorsPeak = 0;
+}
+
+/*
+Check, set and clear the bit for swap sector Sector in the swap map.
+*/
+INT32 SwapSectorInUse(INT16 Sector){
+
+  INT16 Bit = Sector - SWAP_START;
+  return (SwapMap[Bit/8] >> (7 - Bit%8)) & 1;
+}
+
+void SetSwapSector(INT16 Sector){
+
+  INT16 Bit = Sector - SWAP_START;
+  SwapMap[Bit/8] |= (1 << (7 - Bit%8));
+  SwapSectorsInUse++;
+  if(SwapSectorsInUse > SwapSectorsPeak){
+    SwapSectorsPeak = SwapSectorsInUse;
+  }
+}
+
+void ClearSwapSector(INT16 Sector){
+
+  INT16 Bit = Sector - SWAP_START;
+  if(SwapSectorInUse(Sector) == TRUE){
+    SwapMap[Bit/8] &= ~(1 << (7 - Bit%8));
+    SwapSectorsInUse--;
+  }
+}
+
+/*
+Get a swap sector for a page of pcb. Sectors come from the process's
+current cluster. When that is used up a new cluster of SWAP_CLUSTER free
+sectors in a row is claimed. If there is no such run left any free
+sector will do. Returns -1 when the swap space is full.
+*/
+INT16 AllocateSwapSector(PROCESS_CONTROL_BLOCK *pcb){
+
+  INT16 Sector;
+  INT16 Run;
+
+  if(pcb->swap_cluster_left == 0){
+
+    //Look for a whole free cluster
+    for(Sector=SWAP_START; Sector<SWAP_START+SWAP_SECTORS;
+	Sector=Sector+SWAP_CLUSTER){
+      for(Run=0; Run<SWAP_CLUSTER; Run++){
+	if(SwapSectorInUse(Sector + Run) == TRUE){
+	  break;
+	}
+      }
+      if(Run == SWAP_CLUSTER){
+	break;
+      }
+    }
+
+    if(Sector < SWAP_START+SWAP_SECTORS){
+      for(Run=0; Run<SWAP_CLUSTER; Run++){
+	SetSwapSector(Sector + Run);
+      }
+      pcb->swap_cluster_next = Sector;
+      pcb->swap_cluster_left = SWAP_CLUSTER;
+    }
+    else{
+      //No whole cluster left so take any free sector
+      for(Sector=SWAP_START; Sector<SWAP_START+SWAP_SECTORS; Sector++){
+	if(SwapSectorInUse(Sector) == FALSE){
+	  SetSwapSector(Sector);
+	  return Sector;
+	}
+      }
+      return -1;
+    }
+  }
+
+  Sector = pcb->swap_cluster_next;
+  pcb->swap_cluster_next++;
+  pcb->swap_cluster_left--;
+  return Sector;
+}
+
+/*
+Give back all the swap sectors used by pcb, along with the part of its
+cluster it never got to. This is done when the process is deleted.
+Held page outs for the sectors are dropped first, or they could land
+on a sector after it has been given to another process.
+*/
+void ReleaseProcessSwap(PROCESS_CONTROL_BLOCK *pcb){
+
+  INT16 *ShadowEntry;
+
+  if(pcb->shadow_page_table != NULL){
+    for(INT32 i=0; i<NUMBER_VIRTUAL_PAGES; i++){
+      ShadowEntry = PageTableEntry(pcb->shadow_page_table, i, FALSE);
+      if(ShadowEntry != NULL && ((*ShadowEntry) & 0x4000) != 0){
+	osDiskCancelWriteBehind(SWAP_DISK, (*ShadowEntry) & 0x0FFF);
+	ClearSwapSector((*ShadowEntry) & 0x0FFF);
+	(*ShadowEntry) = 0;
+      }
+    }
+  }
+  for(INT16 i=0; i<pcb->swap_cluster_left; i++){
+    osDiskCancelWriteBehind(SWAP_DISK, pcb->swap_cluster_next + i);
+    ClearSwapSector(pcb->swap_cluster_next + i);
+  }
+  pcb->swap_cluster_left = 0;
+}
+
 /*
 Simply checks the referenced bit and returns true or false. If the bit is
 set then clear it.
@@ -87,127 +365,592 @@ void GetNextFrame(){
   }
 }
 
+char *ReplacementPolicyNames[NUMBER_REPLACEMENT_POLICIES] =
+  {"clock", "eclock", "wsclock", "aging", "fifo"};
+
 /*
-Use the LRU Approximation algorithm to find a page to replace.
-Look through Frame Manager to find a page that has not been referenced.
+Return the page table entry for the page held in a frame.
+*/
+INT16* GetFramePageEntry(FRAME_DESCRIPTOR *Descriptor){
+
+  return PageTableEntry(Descriptor->owner->page_table, Descriptor->page,
+			TRUE);
+}
 
-Remember: the frame manager is made up of INT32 elements.
-byte 7 is for the in use flag
-bytes 4-6 hold the PID that has the frame
-bytes 0-3 hold the page table index
+/*
+A frame can be replaced if it is in use and not pinned. While
+ProtectResidentMin is set the frames of a process down to ResidentMin
+frames are kept too, unless load control has suspended it.
 */
-void FindFrameToReplace(){
+INT32 CanReplaceFrame(FRAME_DESCRIPTOR *Descriptor){
 
-  INT16 *PageTable;
-  INT16 PageTableIndex;
-  INT16 *PageTableEntry;
-  long FramePID;
-  PROCESS_CONTROL_BLOCK *pcb;
-  INT32 PageReferenced = TRUE;
+  if(Descriptor->owner == NULL || Descriptor->pin_count > 0){
+    return FALSE;
+  }
+  if(ProtectResidentMin == TRUE &&
+     Descriptor->owner->resident_pages <= ResidentMin &&
+     Descriptor->owner->state != LOAD_SUSPENDED){
+    return FALSE;
+  }
+  return TRUE;
+}
+
+/*
+CLOCK. Use the LRU Approximation algorithm to find a page to replace.
+Look through the frame table to find a page that has not been referenced,
+clearing the referenced bits on the way. If a whole sweep finds every
+page referenced, the first one passed is taken since it is the one the
+hand would find unreferenced on the next sweep. Returns -1 if no frame
+can be replaced.
+*/
+INT16 ClockReplace(){
 
-  //We need to find out which process has the frame and then which
-  //entry in the page table it is.
-  //Then get the page table for that process and check the reference bit.
-  while(PageReferenced == TRUE){
+  INT32 PageReferenced;
+  INT16 Candidate = -1;
+
+  for(INT16 i=0; i<NUMBER_PHYSICAL_PAGES; i++){
 
     GetNextFrame();
-    FramePID = (FrameManager[NextFrame]>>16) & 0xFF;
-    PageTableIndex = FrameManager[NextFrame] & 0xFFFF;
-    pcb = GetPCB(FramePID);
-    PageTable = pcb->page_table;
-    PageTableEntry = &PageTable[PageTableIndex];
-
-    TestReferenceBit(PageTableEntry, &PageReferenced);
-  } 
- }
-  
+    if(CanReplaceFrame(&FrameTable[NextFrame]) == FALSE){
+      continue;
+    }
+    TestReferenceBit(GetFramePageEntry(&FrameTable[NextFrame]),
+		     &PageReferenced);
+    if(PageReferenced == FALSE){
+      return NextFrame;
+    }
+    if(Candidate == -1){
+      Candidate = NextFrame;
+    }
+  }
+  if(Candidate != -1){
+    NextFrame = Candidate;
+  }
+  return Candidate;
+}
+
 /*
-When all the frames are in use we need to put the contents of one onto disk
-and return the freed frame. The page table and the shadow page table of the
-process that had the frame need to be updated as well.
+Enhanced CLOCK. Pages fall into four classes by their referenced and
+modified bits. The hand first looks for a page that is neither
+referenced nor modified without touching any bits. If there is none it
+looks for one that is modified but not referenced, clearing referenced
+bits as it goes. If that fails too every page was referenced, so the
+first clean page the second sweep cleared is taken, or failing that the
+first dirty one. A clean page is taken before a dirty one that has to be
+written out. Returns -1 if no frame can be replaced.
 */
-INT16 FreeUsedFrame(PROCESS_CONTROL_BLOCK *pcb1){
+INT16 EnhancedClockReplace(){
 
-  //Use LRU Approximation to get a frame
-  FindFrameToReplace();
-  INT16 FrameToRemove = NextFrame;
-  
-  INT32 FrameContents = FrameManager[FrameToRemove];
+  INT16 *PageEntry;
+  INT16 Clean = -1;
+  INT16 Dirty = -1;
 
-  unsigned char FramePID = (FrameContents & 0x00FF0000) >> 16;
+  //Not referenced and not modified
+  for(INT16 i=0; i<NUMBER_PHYSICAL_PAGES; i++){
+    GetNextFrame();
+    if(CanReplaceFrame(&FrameTable[NextFrame]) == FALSE){
+      continue;
+    }
+    PageEntry = GetFramePageEntry(&FrameTable[NextFrame]);
+    if((*PageEntry & (PTBL_REFERENCED_BIT | PTBL_MODIFIED_BIT)) == 0){
+      return NextFrame;
+    }
+  }
 
-  PROCESS_CONTROL_BLOCK* pcb = GetPCB((long) FramePID);
+  //Not referenced but modified
+  for(INT16 i=0; i<NUMBER_PHYSICAL_PAGES; i++){
+    GetNextFrame();
+    if(CanReplaceFrame(&FrameTable[NextFrame]) == FALSE){
+      continue;
+    }
+    PageEntry = GetFramePageEntry(&FrameTable[NextFrame]);
+    if((*PageEntry & PTBL_REFERENCED_BIT) == 0){
+      return NextFrame;
+    }
+    (*PageEntry) &= (~PTBL_REFERENCED_BIT);
+    if((*PageEntry & PTBL_MODIFIED_BIT) == 0){
+      if(Clean == -1){
+	Clean = NextFrame;
+      }
+    }
+    else if(Dirty == -1){
+      Dirty = NextFrame;
+    }
+  }
 
-  
-  INT16 *ShadowPageTable = pcb->shadow_page_table;
-  INT16 *PageTable = pcb->page_table;
+  if(Clean != -1){
+    NextFrame = Clean;
+  }
+  else if(Dirty != -1){
+    NextFrame = Dirty;
+  }
+  else{
+    return -1;
+  }
+  return NextFrame;
+}
+
+/*
+WSClock. Each frame remembers when its page was last seen referenced,
+counted in page faults. The hand takes the first unreferenced clean page
+that has been out of the working set for longer than WS_CLOCK_TAU
+faults. If a whole sweep finds none, the oldest unreferenced page seen is
+taken, or failing that the one CLOCK picks. Returns -1 if no frame can
+be replaced.
+*/
+INT16 WSClockReplace(){
+
+  INT16 *PageEntry;
+  FRAME_DESCRIPTOR *Descriptor;
+  INT16 Oldest = -1;
+
+  for(INT16 i=0; i<NUMBER_PHYSICAL_PAGES; i++){
+    GetNextFrame();
+    Descriptor = &FrameTable[NextFrame];
+    if(CanReplaceFrame(Descriptor) == FALSE){
+      continue;
+    }
+    PageEntry = GetFramePageEntry(Descriptor);
+
+    if((*PageEntry & PTBL_REFERENCED_BIT) != 0){
+      (*PageEntry) &= (~PTBL_REFERENCED_BIT);
+      Descriptor->last_used = PageFaults;
+      continue;
+    }
+    if(PageFaults - Descriptor->last_used > WS_CLOCK_TAU &&
+       (*PageEntry & PTBL_MODIFIED_BIT) == 0){
+      return NextFrame;
+    }
+    if(Oldest == -1 ||
+       Descriptor->last_used < FrameTable[Oldest].last_used){
+      Oldest = NextFrame;
+    }
+  }
+
+  if(Oldest != -1){
+    NextFrame = Oldest;
+    return Oldest;
+  }
+  return ClockReplace();
+}
+
+/*
+Aging. On every replacement each frame's age is shifted right and the
+referenced bit is put into the top bit, then cleared. The frame with the
+smallest age has gone longest without being used. Returns -1 if no
+frame can be replaced.
+*/
+INT16 AgingReplace(){
+
+  INT16 *PageEntry;
+  FRAME_DESCRIPTOR *Descriptor;
+  INT16 Victim = -1;
+
+  for(INT16 i=0; i<NUMBER_PHYSICAL_PAGES; i++){
+    Descriptor = &FrameTable[i];
+    if(CanReplaceFrame(Descriptor) == FALSE){
+      continue;
+    }
+    PageEntry = GetFramePageEntry(Descriptor);
+
+    Descriptor->age = Descriptor->age >> 1;
+    if((*PageEntry & PTBL_REFERENCED_BIT) != 0){
+      Descriptor->age |= 0x80000000;
+      (*PageEntry) &= (~PTBL_REFERENCED_BIT);
+    }
+    if(Victim == -1 || Descriptor->age < FrameTable[Victim].age){
+      Victim = i;
+    }
+  }
+  return Victim;
+}
+
+/*
+FIFO. Replace the page that was brought in first. Returns -1 if no frame
+can be replaced.
+*/
+INT16 FIFOReplace(){
+
+  INT16 Victim = -1;
+
+  for(INT16 i=0; i<NUMBER_PHYSICAL_PAGES; i++){
+    if(CanReplaceFrame(&FrameTable[i]) == FALSE){
+      continue;
+    }
+    if(Victim == -1 || FrameTable[i].loaded_at < FrameTable[Victim].loaded_at){
+      Victim = i;
+    }
+  }
+  return Victim;
+}
 
-  INT16 PageNumber = FrameContents & 0x00000FFFF;
+/*
+A frame filled by fault around counts as a hit the first time its page
+is seen referenced or modified.
+*/
+void CheckFaultAroundHit(INT16 Frame){
+
+  FRAME_DESCRIPTOR *Descriptor = &FrameTable[Frame];
+
+  if((Descriptor->flags & FRAME_FAULT_AROUND) == 0){
+    return;
+  }
+  if((*GetFramePageEntry(Descriptor) &
+      (PTBL_REFERENCED_BIT | PTBL_MODIFIED_BIT)) != 0){
+    FaultAroundHits++;
+    Descriptor->flags &= (~FRAME_FAULT_AROUND);
+  }
+}
+
+/*
+Return all the frames used by pcb to the free list. This is done when
+the process is deleted. A frame in transit has already been taken from
+pcb and belongs to the process waiting for its swap write.
+*/
+void ReleaseProcessFrames(PROCESS_CONTROL_BLOCK *pcb){
+
+  for(INT16 i=0; i<NUMBER_PHYSICAL_PAGES; i++){
+    if((FrameTable[i].flags & FRAME_IN_TRANSIT) != 0){
+      continue;
+    }
+    if(FrameTable[i].owner == pcb){
+      CheckFaultAroundHit(i);
+      ReleaseFrame(i);
+    }
+  }
+}
+
+/*
+Pick the frame to replace using the policy chosen at startup. Every
+policy looks at each frame a bounded number of times. Returns -1 if no
+frame can be replaced: every frame in use is pinned or shared.
+*/
+INT16 FindFrameToReplace(){
+
+  //The policies clear referenced bits so look for fault around hits first
+  if(FaultAroundWindow > 0){
+    for(INT16 i=0; i<NUMBER_PHYSICAL_PAGES; i++){
+      if(FrameTable[i].owner != NULL){
+	CheckFaultAroundHit(i);
+      }
+    }
+  }
+
+  //Keep every process at ResidentMin frames if there is anything else
+  //that can be taken.
+  ProtectResidentMin = FALSE;
+  if(ResidentMin > 0){
+    ProtectResidentMin = TRUE;
+    INT16 i;
+    for(i=0; i<NUMBER_PHYSICAL_PAGES; i++){
+      if(CanReplaceFrame(&FrameTable[i]) == TRUE){
+	break;
+      }
+    }
+    if(i == NUMBER_PHYSICAL_PAGES){
+      ProtectResidentMin = FALSE;
+    }
+  }
+
+  switch(ReplacementPolicy){
+  case REPLACE_ENHANCED_CLOCK:
+    return EnhancedClockReplace();
+  case REPLACE_WS_CLOCK:
+    return WSClockReplace();
+  case REPLACE_AGING:
+    return AgingReplace();
+  case REPLACE_FIFO:
+    return FIFOReplace();
+  default:
+    return ClockReplace();
+  }
+}
+
+/*
+Print the paging statistics for the run. The paging lines are left out
+if there were no page faults.
+*/
+void PrintMemoryStats(){
+
+  if(SharedAreaMaps > 0){
+    aprintf("\nShared Areas Created: %d  Mapped: %d  "
+	    "Copy On Write Pages Copied: %d\n", SharedAreasCreated,
+	    SharedAreaMaps, SharedPageCopies);
+  }
+  if(PageFaults == 0){
+    return;
+  }
+  aprintf("\nReplacement Policy: %s  Page Faults: %d  Swap Reads: %d  "
+	  "Swap Writes: %d  Swap Writes Avoided: %d\n",
+	  ReplacementPolicyNames[ReplacementPolicy], PageFaults, SwapReads,
+	  SwapWrites, SwapWritesAvoided);
+  if(SwapSectorsPeak > 0){
+    aprintf("Swap Sectors In Use: %d of %d  Peak: %d\n", SwapSectorsInUse,
+	    SWAP_SECTORS, SwapSectorsPeak);
+  }
+  if(DemandZeroFaults > 0){
+    aprintf("Demand Zero Faults: %d  Zeroed While Idle: %d\n",
+	    DemandZeroFaults, DemandZeroPrezeroed);
+  }
+  if(FaultAroundPages > 0){
+    aprintf("Fault Around Reads: %d  Extra Pages: %d  Used: %d (%d%%)\n",
+	    FaultAroundReads, FaultAroundPages, FaultAroundHits,
+	    (FaultAroundHits*100)/FaultAroundPages);
+  }
+  if(WorkingSetSamples > 0){
+    aprintf("Working Set Samples: %d  Local Replacements: %d  "
+	    "Load Control Suspends: %d  Resumes: %d\n", WorkingSetSamples,
+	    LocalReplacements, LoadSuspends, LoadResumes);
+  }
+  if(PageTableLeavesPeak > 0){
+    aprintf("Page Table Leaves In Use: %d  Peak: %d (%d bytes each)\n",
+	    PageTableLeaves, PageTableLeavesPeak,
+	    (INT32)(PTBL_LEAF_ENTRIES*sizeof(INT16)));
+  }
+  if(PageOutRuns > 0){
+    aprintf("Page Out Daemon Runs: %d  Frames Freed: %d  "
+	    "Faults Served From Page Out Buffers: %d\n", PageOutRuns,
+	    PagesFreedByDaemon, PageOutReclaims);
+  }
+}
+
+/*
+Take the page out of Frame. The page table and the shadow page table of
+the process that had the frame are updated so its next touch of the page
+brings it back from the swap space. Returns the swap sector the page has
+to be written to, or -1 if the copy already there is still good.
+*/
+INT16 UnmapFrame(INT16 Frame){
+
+  PROCESS_CONTROL_BLOCK* pcb = FrameTable[Frame].owner;
+
+  INT16 PageNumber = FrameTable[Frame].page;
+
+  INT16 *ShadowEntry = PageTableEntry(pcb->shadow_page_table, PageNumber,
+				      TRUE);
+  INT16 *PageEntry = PageTableEntry(pcb->page_table, PageNumber, TRUE);
+
+  //A page that came in from the swap space and hasn't been written to
+  //since still matches its copy on the disk.
+  INT32 Clean = FALSE;
+  if(((*PageEntry) & PTBL_MODIFIED_BIT) == 0 &&
+     ((*ShadowEntry) & 0x4000) != 0){
+    Clean = TRUE;
+  }
 
   //Clear the valid bit
-  PageTable[PageNumber] &= (~PTBL_VALID_BIT);
+  (*PageEntry) &= (~PTBL_VALID_BIT);
  
   INT16 DiskLocation;
   //Check to see if the logical page has been in the swap space before.
   //If yes then put it back where it was before.
-  if(CheckPreviouslyOnDisk(PageNumber, ShadowPageTable) == FALSE){
+  if(((*ShadowEntry) & 0x4000) == 0){
     
-    DiskLocation = NextSwapLocation;
+    DiskLocation = AllocateSwapSector(pcb);
+    if(DiskLocation == -1){
+      aprintf("\n\nERROR: Swap Space Full. Page %d of Process %ld Lost\n\n",
+	      PageNumber, pcb->idnum);
+      return -1;
+    }
 
     //fill the shadow page table
-    ShadowPageTable[PageNumber] = 0x4000; //set the prev in use bit 
-    ShadowPageTable[PageNumber] = ShadowPageTable[PageNumber] + DiskLocation;
-    NextSwapLocation++;
+    (*ShadowEntry) = 0x4000; //set the prev in use bit 
+    (*ShadowEntry) = (*ShadowEntry) + DiskLocation;
 
   }
   else{
 
-    DiskLocation = ShadowPageTable[PageNumber] & 0x0FFF;
+    DiskLocation = (*ShadowEntry) & 0x0FFF;
+  }
+
+  (*ShadowEntry) |= 0x8000;  //set in use bit
+
+  //No need to write a clean page. The frame can be used right away.
+  if(Clean == TRUE){
+    SwapWritesAvoided++;
+    return -1;
   }
+  return DiskLocation;
+}
 
-  ShadowPageTable[PageNumber] |= 0x8000;  //set in use bit
+/*
+Pick one of pcb's own frames to replace. The referenced bits give its
+pages a second chance like CLOCK. Returns -1 if none can be replaced.
+*/
+INT16 FindOwnFrameToReplace(PROCESS_CONTROL_BLOCK *pcb){
+
+  INT16 Candidate = -1;
+  INT16 Frame;
+  INT16 *PageEntry;
+
+  for(INT16 i=0; i<2*NUMBER_PHYSICAL_PAGES; i++){
+    Frame = (NextFrame + 1 + i) % NUMBER_PHYSICAL_PAGES;
+    if(FrameTable[Frame].owner != pcb || FrameTable[Frame].pin_count > 0){
+      continue;
+    }
+    PageEntry = GetFramePageEntry(&FrameTable[Frame]);
+    if((*PageEntry & PTBL_REFERENCED_BIT) == 0){
+      return Frame;
+    }
+    (*PageEntry) &= (~PTBL_REFERENCED_BIT);
+    Candidate = Frame;
+  }
+  return Candidate;
+}
+
+/*
+When all the frames are in use, or pcb is at ResidentMax, we need to put
+the contents of one onto disk and return the freed frame. The faulting
+process waits for the write. The frame is taken from its owner before
+the wait, so the owner terminating meanwhile doesn't free it. Returns -1
+if no frame can be replaced.
+*/
+INT16 FreeUsedFrame(PROCESS_CONTROL_BLOCK *pcb){
+
+  INT16 FrameToRemove = -1;
+
+  //A process at its limit replaces one of its own pages
+  if(pcb != NULL && pcb->resident_pages >= ResidentMax){
+    FrameToRemove = FindOwnFrameToReplace(pcb);
+    if(FrameToRemove != -1){
+      LocalReplacements++;
+    }
+  }
+  //Otherwise use the replacement policy to get a frame
+  if(FrameToRemove == -1){
+    FrameToRemove = FindFrameToReplace();
+    if(FrameToRemove == -1){
+      return -1;
+    }
+  }
+
+  INT16 DiskLocation = UnmapFrame(FrameToRemove);
+
+  FrameTable[FrameToRemove].owner->resident_pages--;
+  FrameTable[FrameToRemove].owner = NULL;
+  if(DiskLocation == -1){
+    return FrameToRemove;
+  }
 
   //We have to get data from physical memory and put on the disk
   char DataBuffer[16];
   Z502ReadPhysicalMemory(FrameToRemove, DataBuffer);
- 
+
+  //Another process could fault while we wait for the disk. Don't let it
+  //take the same frame.
+  FrameTable[FrameToRemove].flags |= FRAME_IN_TRANSIT;
+  PinFrame(FrameToRemove);
   osDiskWriteRequest(SWAP_DISK, DiskLocation, (long)DataBuffer);
+  SwapWrites++;
+  UnpinFrame(FrameToRemove);
+  FrameTable[FrameToRemove].flags &= (~FRAME_IN_TRANSIT);
   
   return FrameToRemove;
 }
 
 /*
-Frame Manager is made up of 32 bit chunks.
-The upper 8 bits is set to 1 when in use. Otherwise set to 0.
-Bits 16 to 23 store the PID that is using the current frame.
-Bits 0 to 15 hold the Page Table Index that the frame is used for.
+The page out daemon. It is run when the number of free frames falls
+below PAGE_OUT_LOW_WATERMARK and frees frames until there are
+PAGE_OUT_HIGH_WATERMARK. Dirty pages are copied out of their frames so
+the frames are free at once. Their swap writes are then handed to the
+disk in sector order and done in the background when the swap disk is
+idle, so nobody waits for them.
 */
-void GetPhysicalFrame(INT16 *Frame, PROCESS_CONTROL_BLOCK *pcb, INT16 PageIndex){
+void PageOutDaemon(){
 
-  long PID = pcb->idnum;
-  INT16 FrameIndex = -1;
-  
-  for(int i=0; i<NUMBER_PHYSICAL_PAGES; i++){
+  INT16 Sectors[PAGE_OUT_HIGH_WATERMARK];
+  char *Buffers[PAGE_OUT_HIGH_WATERMARK];
+  INT16 Count = 0;
+  INT16 Frame;
+  INT16 DiskLocation;
+  INT16 j;
 
-    if((FrameManager[i] & 0xff000000) == 0){
-      FrameIndex = i;
+  PageOutRuns++;
+
+  while(FreeFrameCount < PAGE_OUT_HIGH_WATERMARK){
+
+    Frame = FindFrameToReplace();
+    if(Frame == -1){
       break;
-     }
+    }
+    DiskLocation = UnmapFrame(Frame);
+
+    if(DiskLocation != -1){
+      char *Buffer = malloc(PGSIZE);
+      if(Buffer == NULL){
+	aprintf("\n\nERROR: Unable to allocate Page Out Buffer\n\n");
+	return;
+      }
+      Z502ReadPhysicalMemory(Frame, Buffer);
+
+      //Keep the batch in sector order
+      for(j=Count; j>0 && Sectors[j-1] > DiskLocation; j--){
+	Sectors[j] = Sectors[j-1];
+	Buffers[j] = Buffers[j-1];
+      }
+      Sectors[j] = DiskLocation;
+      Buffers[j] = Buffer;
+      Count++;
+    }
+    ReleaseFrame(Frame);
+    PagesFreedByDaemon++;
+  }
+
+  for(j=0; j<Count; j++){
+    osDiskPageOutRequest(SWAP_DISK, Sectors[j], (long)Buffers[j]);
+    SwapWrites++;
+  }
+}
+
+/*
+Get a physical frame for page PageIndex of pcb. A free frame is used if
+there is one. Otherwise a frame in use is emptied onto the disk. Returns
+TRUE if the frame is known to hold only zeros and FALSE if it isn't.
+Returns -1, leaving Frame alone, if no frame can be had.
+*/
+INT32 GetPhysicalFrame(INT16 *Frame, PROCESS_CONTROL_BLOCK *pcb,
+		       INT16 PageIndex){
+
+  //Top up the free frames before they run out
+  if(PageOutEnabled == TRUE && FreeFrameCount < PAGE_OUT_LOW_WATERMARK){
+    PageOutDaemon();
   }
 
-  //If FrameIndex still = -1 then there are no more physical frames.
+  INT16 FrameIndex = -1;
+  INT32 Zeroed = FALSE;
+
+  //A process at ResidentMax doesn't get another free frame
+  if(pcb == NULL || pcb->resident_pages < ResidentMax){
+    FrameIndex = TakeFreeFrame();
+  }
+
+  //If FrameIndex = -1 then there are no more physical frames.
   if(FrameIndex == -1){
 
     FrameIndex = FreeUsedFrame(pcb);
+    if(FrameIndex == -1){
+      return -1;
+    }
+  }
+  else if((FrameTable[FrameIndex].flags & FRAME_ZEROED) != 0){
+    Zeroed = TRUE;
+  }
+  else{
+    UnzeroedFreeFrames--;
   }
 
-  FrameManager[FrameIndex] = 0x01000000; //signify in use
-  FrameManager[FrameIndex] = FrameManager[FrameIndex] + ((PID<<16) & 0x00ff0000);
-  FrameManager[FrameIndex] = FrameManager[FrameIndex] + PageIndex;
+  FrameTable[FrameIndex].owner = pcb;
+  if(pcb != NULL){
+    pcb->resident_pages++;
+  }
+  FrameTable[FrameIndex].page = PageIndex;
+  FrameTable[FrameIndex].flags = FRAME_IN_USE;
+  FrameTable[FrameIndex].age = 0;
+  FrameTable[FrameIndex].loaded_at = PageFaults;
+  FrameTable[FrameIndex].last_used = PageFaults;
 
   (*Frame) = FrameIndex;
-  return;
-  
+  return Zeroed;
 }
 
 
@@ -232,14 +975,170 @@ INT32 CheckValidBit(INT16 TableEntry){
 }
 
 /*
-Handle the shared area tests.
+There are no shared areas when the OS is started.
+*/
+void InitializeSharedAreas(){
+
+  for(INT32 i=0; i<MAX_SHARED_AREAS; i++){
+    SharedAreas[i].in_use = FALSE;
+    SharedAreas[i].ref_count = 0;
+  }
+  SharedFramesInUse = 0;
+}
+
+/*
+Find the shared area named Tag. Returns its index or -1 if there is no
+such area.
+*/
+INT32 FindSharedArea(char *Tag){
+
+  for(INT32 i=0; i<MAX_SHARED_AREAS; i++){
+    if(SharedAreas[i].in_use == TRUE &&
+       strncmp(SharedAreas[i].tag, Tag, MAX_AREA_TAG - 1) == 0){
+      return i;
+    }
+  }
+  return -1;
+}
+
+/*
+Make a shared area named Tag with Pages pages. Its frames are taken from
+the frame table and are not owned by any process. A frame that may
+still hold another process's data is zeroed first. Returns the index of
+the area or -1 if there is no room for another one.
+*/
+INT32 CreateSharedArea(char *Tag, INT16 Pages){
+
+  static char Zeros[PGSIZE];
+  INT32 Area;
+  INT32 Zeroed;
+  INT16 Frame;
+
+  for(Area=0; Area<MAX_SHARED_AREAS; Area++){
+    if(SharedAreas[Area].in_use == FALSE){
+      break;
+    }
+  }
+  if(Area == MAX_SHARED_AREAS){
+    return -1;
+  }
+
+  SHARED_AREA *Shared = &SharedAreas[Area];
+  Shared->in_use = TRUE;
+  strncpy(Shared->tag, Tag, MAX_AREA_TAG - 1);
+  Shared->tag[MAX_AREA_TAG - 1] = '\0';
+  Shared->pages = Pages;
+  Shared->ref_count = 0;
+  Shared->next_shared_id = 0;
+
+  for(INT16 i=0; i<Pages; i++){
+    Zeroed = GetPhysicalFrame(&Frame, NULL, i);
+    if(Zeroed == -1){
+      for(INT16 j=0; j<i; j++){
+	ReleaseFrame(Shared->frames[j]);
+      }
+      Shared->in_use = FALSE;
+      return -1;
+    }
+    if(Zeroed == FALSE){
+      Z502WritePhysicalMemory(Frame, Zeros);
+    }
+    FrameTable[Frame].flags = FRAME_IN_USE | FRAME_SHARED;
+    Shared->frames[i] = Frame;
+  }
+  SharedFramesInUse += Pages;
+  SharedAreasCreated++;
+  return Area;
+}
+
+/*
+Drop one reference to a shared area. The frames are unpinned and when
+nobody has the area mapped any more they are given back.
+*/
+void ReleaseSharedArea(INT32 Area){
+
+  SHARED_AREA *Shared = &SharedAreas[Area];
+
+  for(INT16 i=0; i<Shared->pages; i++){
+    UnpinFrame(Shared->frames[i]);
+  }
+  Shared->ref_count--;
+  if(Shared->ref_count > 0){
+    return;
+  }
+  for(INT16 i=0; i<Shared->pages; i++){
+    ReleaseFrame(Shared->frames[i]);
+  }
+  SharedFramesInUse -= Shared->pages;
+  Shared->in_use = FALSE;
+}
+
+/*
+Unmap all the shared areas of pcb. This is done when the process is
+deleted.
+*/
+void ReleaseProcessSharedAreas(PROCESS_CONTROL_BLOCK *pcb){
+
+  INT16 *PageEntry;
+  SHARED_MAPPING *Mapping;
+
+  for(INT32 i=0; i<MAX_SHARED_MAPPINGS; i++){
+    Mapping = &pcb->shared_mappings[i];
+    if(Mapping->area == -1){
+      continue;
+    }
+    //Pages of a copy on write mapping that were copied belong to the
+    //process and were given back with its other frames
+    if(Mapping->copy_on_write == FALSE && pcb->page_table != NULL){
+      for(INT16 j=0; j<Mapping->pages; j++){
+	PageEntry = PageTableEntry(pcb->page_table, Mapping->start_page + j,
+				   FALSE);
+	if(PageEntry != NULL){
+	  (*PageEntry) = 0;
+	}
+      }
+    }
+    ReleaseSharedArea(Mapping->area);
+    Mapping->area = -1;
+  }
+}
+
+/*
+Return the copy on write mapping of pcb that covers Page, or NULL if the
+page is not in one.
+*/
+SHARED_MAPPING* FindCopyOnWriteMapping(PROCESS_CONTROL_BLOCK *pcb,
+				       INT16 Page){
+
+  SHARED_MAPPING *Mapping;
+
+  for(INT32 i=0; i<MAX_SHARED_MAPPINGS; i++){
+    Mapping = &pcb->shared_mappings[i];
+    if(Mapping->area != -1 && Mapping->copy_on_write == TRUE &&
+       Page >= Mapping->start_page &&
+       Page < Mapping->start_page + Mapping->pages){
+      return Mapping;
+    }
+  }
+  return NULL;
+}
+
+/*
+Map the shared area named AreaTag into the current process at
+StartingAddress, making the area if this is the first process to ask for
+it. Each process that maps an area is given the next shared ID of that
+area. A shared mapping points the process's page table straight at the
+area's frames. A copy on write mapping leaves the pages invalid and the
+fault handler gives the process its own copy of a page the first time
+it is touched.
 */
 void InitializeSharedArea(long StartingAddress, long PagesInSharedArea,
 			   char *AreaTag, long *OurSharedID, long
 			  *ReturnError){
 
   PROCESS_CONTROL_BLOCK *pcb = GetCurrentPCB();
-  INT16 *PageTable = pcb->page_table;
+  INT32 CopyOnWrite = FALSE;
+  SHARED_MAPPING *Mapping = NULL;
 
   //Let's make sure the starting address is on a mod 16 boundary
   if(StartingAddress % PGSIZE != 0){
@@ -250,17 +1149,303 @@ void InitializeSharedArea(long StartingAddress, long PagesInSharedArea,
 
   INT16 StartPage = StartingAddress / PGSIZE;
 
-  //Get frames for all the share pages starting at SharedAreaStartFrame
-  for(INT32 i=0; i<PagesInSharedArea; i++){
+  if(PagesInSharedArea <= 0 || PagesInSharedArea > MAX_SHARED_PAGES ||
+     StartPage < 0 || StartPage + PagesInSharedArea > NUMBER_VIRTUAL_PAGES){
+    aprintf("\n\nERROR: Shared Area does not fit\n\n");
+    (*ReturnError) = ERR_BAD_PARAM;
+    return;
+  }
+
+  //The pages must not already be in use
+  for(INT16 i=0; i<PagesInSharedArea; i++){
+    if(ReadPageTableEntry(pcb->page_table, StartPage + i) != 0 ||
+       ReadPageTableEntry(pcb->shadow_page_table, StartPage + i) != 0 ||
+       FindCopyOnWriteMapping(pcb, StartPage + i) != NULL){
+      aprintf("\n\nERROR: Shared Area overlaps pages in use\n\n");
+      (*ReturnError) = ERR_BAD_PARAM;
+      return;
+    }
+  }
+
+  for(INT32 i=0; i<MAX_SHARED_MAPPINGS; i++){
+    if(pcb->shared_mappings[i].area == -1){
+      Mapping = &pcb->shared_mappings[i];
+      break;
+    }
+  }
+  if(Mapping == NULL){
+    aprintf("\n\nERROR: Process has too many Shared Areas\n\n");
+    (*ReturnError) = ERR_BAD_PARAM;
+    return;
+  }
 
-    PageTable[StartPage + i] = (SharedAreaStartFrame + i) + PTBL_VALID_BIT;
+  if(strncmp(AreaTag, PRIVATE_AREA_PREFIX,
+	     strlen(PRIVATE_AREA_PREFIX)) == 0){
+    CopyOnWrite = TRUE;
+    AreaTag = AreaTag + strlen(PRIVATE_AREA_PREFIX);
   }
 
-  (*OurSharedID) = SharedIDCount;
-  SharedIDCount++;
+  INT32 Area = FindSharedArea(AreaTag);
+  if(Area == -1){
+    if(SharedFramesInUse + PagesInSharedArea > MAX_SHARED_FRAMES){
+      aprintf("\n\nERROR: Shared Areas can't hold more than %d frames\n\n",
+	      MAX_SHARED_FRAMES);
+      (*ReturnError) = ERR_BAD_PARAM;
+      return;
+    }
+    Area = CreateSharedArea(AreaTag, PagesInSharedArea);
+    if(Area == -1){
+      aprintf("\n\nERROR: No room for another Shared Area\n\n");
+      (*ReturnError) = ERR_BAD_PARAM;
+      return;
+    }
+  }
+  else if(PagesInSharedArea > SharedAreas[Area].pages){
+    aprintf("\n\nERROR: Shared Area %s has only %d pages\n\n",
+	    SharedAreas[Area].tag, SharedAreas[Area].pages);
+    (*ReturnError) = ERR_BAD_PARAM;
+    return;
+  }
+
+  SHARED_AREA *Shared = &SharedAreas[Area];
+
+  //Pin the frames for as long as we have them mapped
+  for(INT16 i=0; i<Shared->pages; i++){
+    PinFrame(Shared->frames[i]);
+  }
+  Shared->ref_count++;
+
+  Mapping->area = Area;
+  Mapping->start_page = StartPage;
+  Mapping->pages = PagesInSharedArea;
+  Mapping->copy_on_write = CopyOnWrite;
+
+  if(CopyOnWrite == FALSE){
+    for(INT16 i=0; i<PagesInSharedArea; i++){
+      (*PageTableEntry(pcb->page_table, StartPage + i, TRUE)) =
+	Shared->frames[i] + PTBL_VALID_BIT;
+    }
+  }
+
+  SharedAreaMaps++;
+  (*OurSharedID) = Shared->next_shared_id;
+  Shared->next_shared_id++;
   (*ReturnError) = ERR_SUCCESS;
 }
 
+/*
+Can page Page of pcb be brought in by fault around from swap sector
+Sector? It has to be out on the disk in exactly that sector and the disk
+has to hold its newest copy.
+*/
+INT32 CanFaultAround(PROCESS_CONTROL_BLOCK *pcb, INT32 Page, INT16 Sector){
+
+  if(Page < 0 || Page >= NUMBER_VIRTUAL_PAGES){
+    return FALSE;
+  }
+  if(CheckValidBit(ReadPageTableEntry(pcb->page_table, Page)) == TRUE ||
+     CheckOnDisk(Page, pcb->shadow_page_table) == FALSE ||
+     (ReadPageTableEntry(pcb->shadow_page_table, Page) & 0x0FFF) != Sector){
+    return FALSE;
+  }
+  if(osDiskCheckWriteBehind(SWAP_DISK, Sector) == TRUE){
+    return FALSE;
+  }
+  return TRUE;
+}
+
+/*
+Bring in page Index of pcb, which is on the disk, together with the
+pages around it that sit in the swap sectors next to it. Up to
+FaultAroundWindow pages are taken on each side but only free frames are
+used for them, so nothing is thrown out for a guess. All the pages come
+in with one multi sector read. The extra pages are mapped valid but not
+referenced. The frame for page Index has already been found and pinned.
+*/
+void FaultAround(PROCESS_CONTROL_BLOCK *pcb, INT16 Index){
+
+  INT16 Sector = ReadPageTableEntry(pcb->shadow_page_table, Index) & 0x0FFF;
+  INT16 Room = FreeFrameCount;
+  if(Room > ResidentMax - pcb->resident_pages){
+    Room = ResidentMax - pcb->resident_pages;
+  }
+  INT16 First = Index;
+  INT16 Last = Index;
+  INT16 Page;
+  INT16 *PageEntry;
+
+  while(Last - Index < FaultAroundWindow && Room > 0 &&
+	CanFaultAround(pcb, Last + 1, Sector + (Last + 1 - Index)) == TRUE){
+    Last++;
+    Room--;
+  }
+  while(Index - First < FaultAroundWindow && Room > 0 &&
+	CanFaultAround(pcb, First - 1, Sector - (Index - First + 1)) == TRUE){
+    First--;
+    Room--;
+  }
+
+  //Frames for the extra pages
+  for(Page=First; Page<=Last; Page++){
+    if(Page != Index){
+      PageEntry = PageTableEntry(pcb->page_table, Page, TRUE);
+      GetPhysicalFrame(PageEntry, pcb, Page);
+      PinFrame((*PageEntry) & 0x0FFF);
+    }
+  }
+
+  char DataBuffer[(2*MAX_FAULT_AROUND + 1)*PGSIZE];
+  INT16 Count = Last - First + 1;
+
+  osDiskReadSectors(SWAP_DISK, Sector - (Index - First), Count,
+		    (long)DataBuffer);
+  SwapReads = SwapReads + Count;
+  if(Count > 1){
+    FaultAroundReads++;
+    FaultAroundPages = FaultAroundPages + Count - 1;
+  }
+
+  for(Page=First; Page<=Last; Page++){
+    PageEntry = PageTableEntry(pcb->page_table, Page, TRUE);
+    INT16 Frame = (*PageEntry) & 0x0FFF;
+
+    Z502WritePhysicalMemory(Frame, &DataBuffer[(Page - First)*PGSIZE]);
+    (*PageTableEntry(pcb->shadow_page_table, Page, TRUE)) &= 0x7FFF;
+    if(Page != Index){
+      FrameTable[Frame].flags |= FRAME_FAULT_AROUND;
+      SetValidBit(PageEntry);
+      UnpinFrame(Frame);
+    }
+  }
+}
+
+/*
+Estimate the working set of every process. A page seen referenced has
+its last_used time brought up to date. The bit is left alone for the
+replacement policy. A process's working set is the number of its pages
+used in the last WS_WINDOW page faults.
+*/
+void SampleWorkingSets(){
+
+  FRAME_DESCRIPTOR *Descriptor;
+
+  WorkingSetSamples++;
+  for(INT32 i=0; i<MAXPROCESSES; i++){
+    PCB[i].working_set = 0;
+  }
+  for(INT16 i=0; i<NUMBER_PHYSICAL_PAGES; i++){
+    Descriptor = &FrameTable[i];
+    if(Descriptor->owner == NULL){
+      continue;
+    }
+    if((*GetFramePageEntry(Descriptor) & PTBL_REFERENCED_BIT) != 0){
+      Descriptor->last_used = PageFaults;
+    }
+    if(PageFaults - Descriptor->last_used <= WS_WINDOW){
+      Descriptor->owner->working_set++;
+    }
+  }
+}
+
+/*
+Add up the working sets of the processes load control hasn't suspended.
+*/
+INT32 ActiveWorkingSet(){
+
+  INT32 Total = 0;
+
+  for(INT32 i=0; i<MAXPROCESSES; i++){
+    if(PCB[i].in_use == IN_USE && PCB[i].state != LOAD_SUSPENDED){
+      Total = Total + PCB[i].working_set;
+    }
+  }
+  return Total;
+}
+
+/*
+Let a process suspended by load control run again. The one with the
+smallest working set is taken if the working sets still fit in memory
+with it added. If Force is TRUE it is let in anyway. This is done when
+the CPU has nothing else to run.
+*/
+void ResumeLoadSuspended(INT32 Force){
+
+  PROCESS_CONTROL_BLOCK *pcb = NULL;
+
+  if(LoadSuspends == LoadResumes){
+    return;
+  }
+  for(INT32 i=0; i<MAXPROCESSES; i++){
+    if(PCB[i].in_use == IN_USE && PCB[i].state == LOAD_SUSPENDED &&
+       (pcb == NULL || PCB[i].working_set < pcb->working_set)){
+      pcb = &PCB[i];
+    }
+  }
+  if(pcb == NULL){
+    //Resumed or terminated some other way
+    LoadResumes = LoadSuspends;
+    return;
+  }
+  if(Force == FALSE &&
+     ActiveWorkingSet() + pcb->working_set > LOAD_CONTROL_FRAMES){
+    return;
+  }
+  LoadResumes++;
+  ChangeProcessState(pcb->idnum, READY);
+  AddToReadyQueue(pcb->context, pcb->idnum, pcb, FALSE);
+  osPrintState("LoadRes", pcb->idnum, GetCurrentPID());
+}
+
+/*
+Sample the working sets every WS_SAMPLE_INTERVAL faults. If the working
+sets of the runnable processes no longer fit in memory the faulting
+process is suspended so the rest can run without thrashing. It is only
+done when some other process is left to run.
+*/
+void LoadControl(PROCESS_CONTROL_BLOCK *pcb){
+
+  INT32 Others = 0;
+
+  if(PageFaults % WS_SAMPLE_INTERVAL != 0){
+    return;
+  }
+  SampleWorkingSets();
+  if(LoadControlEnabled == FALSE){
+    return;
+  }
+
+  if(ActiveWorkingSet() <= LOAD_CONTROL_FRAMES){
+    ResumeLoadSuspended(FALSE);
+    return;
+  }
+  for(INT32 i=0; i<MAXPROCESSES; i++){
+    if(PCB[i].in_use == IN_USE && &PCB[i] != pcb &&
+       PCB[i].state != LOAD_SUSPENDED){
+      Others++;
+    }
+  }
+  if(Others == 0){
+    return;
+  }
+
+  LoadSuspends++;
+  ChangeProcessState(pcb->idnum, LOAD_SUSPENDED);
+  osPrintState("LoadSus", pcb->idnum, pcb->idnum);
+  dispatcher();
+}
+
+/*
+Every frame is pinned or shared so the fault can't be served. The
+faulting process is terminated.
+*/
+void NoFrameForFault(INT16 Index){
+
+  aprintf("\n\nERROR: No Frame For Page %d. Terminate Program\n\n",
+	  Index);
+  long ReturnError;
+  osTerminateProcess(-1, &ReturnError);
+}
+
 /*
 Handle the Interrupt Handler. Usually this is finding a frame to back the
 requested memory page. If the request does not align on a mod 4 boundary
@@ -272,14 +1457,14 @@ void HandleFaultHandler(INT32 DeviceID, INT32 Status){
   //get the current page table
   PROCESS_CONTROL_BLOCK *CurrentPCB = GetCurrentPCB();
 
-  INT16 *PageTable = (INT16 *)CurrentPCB->page_table;
-  INT16 *ShadowPageTable = (INT16 *)CurrentPCB->shadow_page_table;
+  void *ShadowPageTable = CurrentPCB->shadow_page_table;
   INT16 Index = (INT16) Status;
+  INT16 *PageEntry = PageTableEntry(CurrentPCB->page_table, Index, TRUE);
 
   //If Valid bit is set and we are here then the user program has
   //asked for an address that is not on a mod 4 boundary.
   //Just terminate the program.
-  if(CheckValidBit(PageTable[Index]) == TRUE){
+  if(CheckValidBit(*PageEntry) == TRUE){
 
     aprintf("\n\nERROR: Bad Address. Terminate Program\n\n");
     long ReturnError;
@@ -289,28 +1474,85 @@ void HandleFaultHandler(INT32 DeviceID, INT32 Status){
   //There are two possibilities. The valid bit is not set because the
   //logical page has never been used or because the page is backed by data
   //in the swap space.
+  PageFaults++;
+
   INT32 OnDisk = CheckOnDisk(Index, ShadowPageTable);
+  INT32 Zeroed = GetPhysicalFrame(PageEntry, CurrentPCB, Index);
+
+  if(Zeroed == -1){
+    NoFrameForFault(Index);
+    return;
+  }
+
+  SetValidBit(PageEntry);
+
+  //The first touch of a page in a copy on write mapping. Give the
+  //process its own copy of the shared page.
+  INT32 FirstTouch = FALSE;
+  SHARED_MAPPING *Mapping = NULL;
+  if(OnDisk == FALSE &&
+     CheckPreviouslyOnDisk(Index, ShadowPageTable) == FALSE){
+    FirstTouch = TRUE;
+    Mapping = FindCopyOnWriteMapping(CurrentPCB, Index);
+  }
+  if(Mapping != NULL){
+
+    char DataBuffer[16];
+    SHARED_AREA *Shared = &SharedAreas[Mapping->area];
 
-  GetPhysicalFrame(&PageTable[Index], CurrentPCB, Index);
+    Z502ReadPhysicalMemory(Shared->frames[Index - Mapping->start_page],
+			   DataBuffer);
+    Z502WritePhysicalMemory((*PageEntry) & 0x0FFF, DataBuffer);
+    SharedPageCopies++;
+  }
+
+  //The first touch of any other page. The frame may still hold the data
+  //of its last user, so it is zeroed unless that was done while the
+  //dispatcher was idle.
+  else if(FirstTouch == TRUE){
+
+    static char Zeros[PGSIZE];
 
-  SetValidBit(&PageTable[Index]);
+    DemandZeroFaults++;
+    if(Zeroed == TRUE){
+      DemandZeroPrezeroed++;
+    }
+    else{
+      Z502WritePhysicalMemory((*PageEntry) & 0x0FFF, Zeros);
+    }
+  }
 
   //If the data was on the disk we need to get the disk sector from the
   //shadow page table.
   if(OnDisk == TRUE){
 
-    INT16 DiskSector = ShadowPageTable[Index] & 0x0FFF;
+    INT16 *ShadowEntry = PageTableEntry(ShadowPageTable, Index, TRUE);
+    INT16 DiskSector = (*ShadowEntry) & 0x0FFF;
 
     char DataBuffer[16];
-
-    osDiskReadRequest(SWAP_DISK, DiskSector, (long)DataBuffer);
-
-    //Put data from disk into proper memory address
-    INT16 Frame = (PageTable[Index] & 0x0FFF);
-    Z502WritePhysicalMemory(Frame, DataBuffer);
+    INT16 Frame = ((*PageEntry) & 0x0FFF);
+
+    //Keep the frame from being taken while we wait for the disk
+    PinFrame(Frame);
+    if(osDiskReadWriteBehind(SWAP_DISK, DiskSector, (long)DataBuffer) == TRUE){
+      PageOutReclaims++;
+      Z502WritePhysicalMemory(Frame, DataBuffer);
+    }
+    else if(FaultAroundWindow > 0){
+      FaultAround(CurrentPCB, Index);
+    }
+    else{
+      osDiskReadRequest(SWAP_DISK, DiskSector, (long)DataBuffer);
+      SwapReads++;
+
+      //Put data from disk into proper memory address
+      Z502WritePhysicalMemory(Frame, DataBuffer);
+    }
+    UnpinFrame(Frame);
 
     //Indicate data can be found in memory rather than on disk
-    ShadowPageTable[Index] &= 0x7FFF;
+    (*ShadowEntry) &= 0x7FFF;
    }
   osPrintMemoryState();
+  LoadControl(CurrentPCB);
 }
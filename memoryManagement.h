@@ -10,24 +10,147 @@ management. It also includes functions for handling the Fault Handler.
 
 //The tests expect the swap disk to be 1
 #define SWAP_DISK 1
-INT16 NextSwapLocation;
 
-//This can be anywhere
-#define SharedAreaStartFrame 0x20
+//The swap space is sectors 0x600 to 0x7FF of the swap disk. A bitmap
+//keeps track of the sectors in use. Each process is given
+//SWAP_CLUSTER sectors in a row at a time so its pages sit together.
+#define SWAP_START 0x600
+#define SWAP_SECTORS 0x200
+#define SWAP_CLUSTER 8
 
-long SharedIDCount;
+unsigned char SwapMap[SWAP_SECTORS/8];
+INT32 SwapSectorsInUse;
+INT32 SwapSectorsPeak;
 
+/*
+Shared areas are named by the AreaTag given to DEFINE_SHARED_AREA. The
+first process to ask for a tag gets frames for it from the frame table.
+The frames are pinned while any process has the area mapped and go back
+to the free list when the last of them is gone. A tag starting with
+PRIVATE_AREA_PREFIX maps the area named by the rest of the tag copy on
+write.
+*/
+#define MAX_SHARED_AREAS 4
+#define MAX_SHARED_PAGES 16
+//Frames all the shared areas together may hold. The rest of physical
+//memory is kept for paging, so the areas can't take every frame.
+#define MAX_SHARED_FRAMES (NUMBER_PHYSICAL_PAGES/2)
+#define MAX_AREA_TAG 32
+#define PRIVATE_AREA_PREFIX "private:"
+
+typedef struct{
+  INT32 in_use;
+  char tag[MAX_AREA_TAG];
+  INT16 pages;
+  INT16 frames[MAX_SHARED_PAGES];
+  INT32 ref_count;           //processes that have the area mapped
+  long next_shared_id;       //ID handed to the next process to map it
+}SHARED_AREA;
+
+SHARED_AREA SharedAreas[MAX_SHARED_AREAS];
+INT32 SharedFramesInUse;
+
+//Page replacement policies. The policy is picked at startup with the
+//replace=name option and CLOCK is used if none is given.
+#define REPLACE_CLOCK 0
+#define REPLACE_ENHANCED_CLOCK 1
+#define REPLACE_WS_CLOCK 2
+#define REPLACE_AGING 3
+#define REPLACE_FIFO 4
+#define NUMBER_REPLACEMENT_POLICIES 5
+
+INT32 ReplacementPolicy;
+
+//Names used by the replace= option, indexed by policy
+char *ReplacementPolicyNames[NUMBER_REPLACEMENT_POLICIES];
+
+//Page faults a page may go unreferenced before WSClock treats it as
+//outside the working set
+#define WS_CLOCK_TAU 32
+
+//The page out daemon runs when fewer than PAGE_OUT_LOW_WATERMARK frames
+//are free and frees frames until PAGE_OUT_HIGH_WATERMARK are. It is on
+//unless the pageout=off option is given.
+#define PAGE_OUT_LOW_WATERMARK 4
+#define PAGE_OUT_HIGH_WATERMARK 8
+
+INT32 PageOutEnabled;
+
+//Fault around reads up to FaultAroundWindow pages on each side of a
+//faulting page when they sit in the swap sectors next to it. It is off
+//(0) unless the faultaround=N option is given.
+#define MAX_FAULT_AROUND 8
+
+INT32 FaultAroundWindow;
+
+//Every WS_SAMPLE_INTERVAL page faults the referenced bits are sampled to
+//estimate the working set of each process, the pages it has used in the
+//last WS_WINDOW faults. Each process is kept between ResidentMin and
+//ResidentMax frames, set with the rsmin=N and rsmax=N options. A process
+//at ResidentMax replaces its own pages. Global replacement doesn't take
+//a process below ResidentMin unless there is nothing else to take.
+#define WS_SAMPLE_INTERVAL 8
+#define WS_WINDOW WS_CLOCK_TAU
+
+INT32 ResidentMin;
+INT32 ResidentMax;
+INT32 ProtectResidentMin;   //TRUE while replacement honours ResidentMin
+
+//With load control on, a process that faults while the working sets of
+//the runnable processes don't fit in LOAD_CONTROL_FRAMES is suspended.
+//It is let back in when they fit again or the CPU has nothing else to
+//run. It is on unless the loadcontrol=off option is given.
+#define LOAD_CONTROL_FRAMES (NUMBER_PHYSICAL_PAGES - PAGE_OUT_HIGH_WATERMARK)
+
+INT32 LoadControlEnabled;
+
+//Paging statistics
+INT32 PageFaults;
+INT32 SwapReads;
+INT32 SwapWrites;
+INT32 SwapWritesAvoided;    //clean pages dropped without a write
+INT32 PageOutRuns;
+INT32 PagesFreedByDaemon;
+INT32 PageOutReclaims;      //faults served from a page out not yet written
+INT32 FaultAroundReads;
+INT32 FaultAroundPages;     //pages brought in besides the faulting one
+INT32 FaultAroundHits;      //of those, pages that were used
+INT32 SharedAreasCreated;
+INT32 SharedAreaMaps;
+INT32 SharedPageCopies;     //pages copied for copy on write mappings
+INT32 DemandZeroFaults;     //first touches of a page
+INT32 DemandZeroPrezeroed;  //of those, served with a frame zeroed when idle
+INT16 UnzeroedFreeFrames;   //free frames that still hold old data
+INT32 WorkingSetSamples;
+INT32 LocalReplacements;    //pages replaced by their own process at ResidentMax
+INT32 LoadSuspends;
+INT32 LoadResumes;
+INT32 PageTableLeaves;      //page table leaves in use
+INT32 PageTableLeavesPeak;
+
+void* CreatePageTable();
+void DeletePageTable(void *Table);
+INT16* PageTableEntry(void *Table, INT16 Page, INT32 Allocate);
+INT16 ReadPageTableEntry(void *Table, INT16 Page);
 void InitializeFrameManager();
-void GetPhysicalFrame(INT16 *Frame, PROCESS_CONTROL_BLOCK *pcb,
-		      INT16 PageIndex);
+void ReleaseProcessFrames(PROCESS_CONTROL_BLOCK *pcb);
+void InitializeSwapSpace();
+void ReleaseProcessSwap(PROCESS_CONTROL_BLOCK *pcb);
+INT32 GetPhysicalFrame(INT16 *Frame, PROCESS_CONTROL_BLOCK *pcb,
+		       INT16 PageIndex);
+void ZeroFreeFrames();
+void ResumeLoadSuspended(INT32 Force);
 void SetValidBit(INT16 *PageEntry);
 INT32 CheckValidBit(INT16 TableEntry);
 void NoFrames(PROCESS_CONTROL_BLOCK *CurrentPCB, INT16 Index);
-INT32 CheckOnDisk(INT16 ShadowTableIndex, INT16 *ShadowPageTable);
+INT32 CheckOnDisk(INT16 ShadowTableIndex, void *ShadowPageTable);
+void InitializeSharedAreas();
+void ReleaseProcessSharedAreas(PROCESS_CONTROL_BLOCK *pcb);
 void InitializeSharedArea(long StartingAddress, long PagesInSharedArea,
 			   char *AreaTag, long *OurSharedID, long
 			  *ReturnError);
 void HandleFaultHandler(INT32 DeviceID, INT32 Status);
+void PrintMemoryStats();
 
 
 #endif //MEM_MANAGEMENT_H
@@ -0,0 +1,125 @@
+/*
+openFileTable.c
+
+This file holds the functions for the open file table of each process
+and for the in core inodes they point to. A file that is open in several
+places shares one in core inode which counts how many open file entries
+refer to it.
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include "protos.h"
+#include "osGlobals.h"
+#include "diskManagement.h"
+#include "openFileTable.h"
+
+/*
+Return the in core inode for the file with the given Header, setting it
+up if the file isn't open anywhere yet. The reference count is raised
+by one.
+*/
+IN_CORE_INODE* GetInCoreInode(DISK_BLOCK *Header, long DiskID){
+
+  unsigned int Inode = Header->Byte[0];
+
+  if(Inode >= MAX_NUMBER_INODES){
+    aprintf("\n\nERROR: Inode %d out of range\n\n", Inode);
+    return NULL;
+  }
+
+  IN_CORE_INODE *InCore = &InCoreInodes[Inode];
+
+  if(InCore->ref_count == 0){
+    InCore->inode = Inode;
+    InCore->disk_id = DiskID;
+    InCore->header = Header;
+    GetHeaderIndexSector(Header, &InCore->index_sector);
+    InCore->first_level_block = -1;
+    InCore->first_level_sector = 0;
+  }
+  InCore->ref_count++;
+  return InCore;
+}
+
+/*
+Drop one reference to an in core inode. When the last one goes the
+inode is no longer in core.
+*/
+void ReleaseInCoreInode(IN_CORE_INODE *InCore){
+
+  if(InCore->ref_count <= 0){
+    aprintf("\n\nERROR: Releasing Inode %d that is not in core\n\n",
+	    InCore->inode);
+    return;
+  }
+  InCore->ref_count--;
+  if(InCore->ref_count == 0){
+    InCore->header = NULL;
+    InCore->first_level_sector = 0;
+  }
+}
+
+/*
+Empty the open file table of a new process.
+*/
+void ClearOpenFiles(PROCESS_CONTROL_BLOCK *pcb){
+
+  for(INT16 i=0; i<MAX_OPEN_FILES; i++){
+    pcb->open_files[i].in_core = NULL;
+  }
+}
+
+/*
+Put the file in the first free slot of the process's open file table.
+Returns FALSE if the table is full.
+*/
+INT32 AddOpenFile(PROCESS_CONTROL_BLOCK *pcb, IN_CORE_INODE *InCore){
+
+  for(INT16 i=0; i<MAX_OPEN_FILES; i++){
+    if(pcb->open_files[i].in_core == NULL){
+      pcb->open_files[i].in_core = InCore;
+      pcb->open_files[i].last_block_read = -1;
+      pcb->open_files[i].read_ahead_window = 0;
+      pcb->open_files[i].read_ahead_next = 0;
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+/*
+Find the open file with the given Inode in the process's open file
+table. Returns NULL if the process doesn't have it open.
+*/
+OPEN_FILE* FindOpenFile(PROCESS_CONTROL_BLOCK *pcb, long Inode){
+
+  for(INT16 i=0; i<MAX_OPEN_FILES; i++){
+    if(pcb->open_files[i].in_core != NULL &&
+       pcb->open_files[i].in_core->inode == Inode){
+      return &pcb->open_files[i];
+    }
+  }
+  return NULL;
+}
+
+/*
+Remove an entry from an open file table and let go of its inode.
+*/
+void CloseOpenFile(OPEN_FILE *OpenFile){
+
+  ReleaseInCoreInode(OpenFile->in_core);
+  OpenFile->in_core = NULL;
+}
+
+/*
+Close everything a process still has open. Used when it terminates.
+*/
+void CloseAllOpenFiles(PROCESS_CONTROL_BLOCK *pcb){
+
+  for(INT16 i=0; i<MAX_OPEN_FILES; i++){
+    if(pcb->open_files[i].in_core != NULL){
+      CloseOpenFile(&pcb->open_files[i]);
+    }
+  }
+}
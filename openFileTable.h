@@ -0,0 +1,26 @@
+/*
+openFileTable.h
+
+This file is the include file for the per process open file tables and
+the system wide table of in core inodes behind them.
+
+*/
+
+#ifndef OPEN_FILE_TABLE_H
+#define OPEN_FILE_TABLE_H
+
+#include "global.h"
+#include "osGlobals.h"
+
+//In core inodes by inode number
+IN_CORE_INODE InCoreInodes[MAX_NUMBER_INODES];
+
+IN_CORE_INODE* GetInCoreInode(DISK_BLOCK *Header, long DiskID);
+void ReleaseInCoreInode(IN_CORE_INODE *InCore);
+void ClearOpenFiles(PROCESS_CONTROL_BLOCK *pcb);
+INT32 AddOpenFile(PROCESS_CONTROL_BLOCK *pcb, IN_CORE_INODE *InCore);
+OPEN_FILE* FindOpenFile(PROCESS_CONTROL_BLOCK *pcb, long Inode);
+void CloseOpenFile(OPEN_FILE *OpenFile);
+void CloseAllOpenFiles(PROCESS_CONTROL_BLOCK *pcb);
+
+#endif //OPEN_FILE_TABLE_H
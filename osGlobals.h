@@ -23,6 +23,8 @@ This include file has all the OS wide structs and defines.
 #define WAITING_TO_SUSPEND_TIMER 5
 #define WAITING_TO_SUSPEND_DISK 6
 #define SUSPENDED_WAITING_FOR_MESSAGE 7
+//Held back by load control until there is memory for it
+#define LOAD_SUSPENDED 8
 
 //Define whether a PCB is in use or not
 #define FREE 0
@@ -35,10 +37,59 @@ struct{
 struct{
   DISK_BLOCK Block[2048];
   unsigned char Modified[2048];
+  //Loaded[Disk][Sector] is SECTOR_LOADED when the sector was brought in
+  //from that disk by a multi sector read or by read ahead and the copy
+  //here can be handed to a reader without going to the disk.
+  //SECTOR_LOADING while a read ahead is on its way.
+  unsigned char Loaded[MAX_NUMBER_OF_DISKS][2048];
 } typedef DISK_CACHE;
 
 DISK_CACHE *Cache;
 
+//Number of files a single process can have open at once
+#define MAX_OPEN_FILES 8
+
+/*
+The in core inode of a file. There is one for every file that is open
+by any process, found by inode number. It holds what has already been
+worked out about the file so it doesn't have to be looked up again.
+*/
+typedef struct{
+  INT32 ref_count;
+  unsigned int inode;
+  long disk_id;
+  DISK_BLOCK *header;
+  INT16 index_sector;        //top level index or extent table
+  INT16 first_level_block;   //Block/8 covered by first_level_sector
+  INT16 first_level_sector;  //last first level index used. 0 if none
+}IN_CORE_INODE;
+
+/*
+An entry in a process's table of open files. It also keeps track of how
+the process has been reading the file so read ahead can follow it.
+*/
+typedef struct{
+  IN_CORE_INODE *in_core;
+  INT16 last_block_read;     //-1 before the first read
+  INT16 read_ahead_window;   //blocks to read ahead. 0 when not sequential
+  INT16 read_ahead_next;     //first block not yet asked for
+}OPEN_FILE;
+
+//Number of shared areas a single process can have mapped at once
+#define MAX_SHARED_MAPPINGS 2
+
+/*
+A shared area mapped into a process. A copy on write mapping starts out
+seeing the area's pages but gets a page of its own the first time it
+touches one.
+*/
+typedef struct{
+  INT16 area;                //index in SharedAreas. -1 if unused
+  INT16 start_page;
+  INT16 pages;
+  INT16 copy_on_write;
+}SHARED_MAPPING;
+
 //The struct that holds all the information about a process
 typedef struct{
   INT32 in_use;
@@ -53,10 +104,15 @@ typedef struct{
   void* queue_ptr;
   long current_disk;
   DISK_BLOCK *current_directory;
-  unsigned int open_file_inode;
-  DISK_BLOCK *open_file;
+  OPEN_FILE open_files[MAX_OPEN_FILES];
   void* page_table;
   void* shadow_page_table;
+  INT16 swap_cluster_next;   //next swap sector in the process's cluster
+  INT16 swap_cluster_left;   //sectors left in the cluster
+  SHARED_MAPPING shared_mappings[MAX_SHARED_MAPPINGS];
+  INT16 resident_pages;      //frames the process holds
+  INT16 working_set;         //pages used lately, from the last sample
+  void* timer;               //TQ_ELEMENT while on the Timer Queue
   
 } PROCESS_CONTROL_BLOCK;
 
@@ -72,6 +128,7 @@ typedef struct{
   long context;
   long PID;
   void* PCB;
+  UINT32 ready_time;  //simulated time it was put on the Ready Queue
 }RQ_ELEMENT;
 
 /*
@@ -83,6 +140,7 @@ typedef struct{
   long context;
   long PID;
   void* PCB;
+  INT32 heap_index;          //position in TimerHeap
 }TQ_ELEMENT;
 
 /*
@@ -117,12 +175,60 @@ typedef struct{
 //be performed
 #define READ_DISK 0
 #define WRITE_DISK 1
+//A read nobody waits for. It fills the disk cache and wakes no process.
+#define PREFETCH_DISK 2
+//A swap write done in the background by the page out daemon
+#define PAGE_OUT_DISK 3
+
+//Values for the Loaded flags of the disk cache
+#define SECTOR_NOT_LOADED 0
+#define SECTOR_LOADED 1
+#define SECTOR_LOADING 2
 
 //Here are the IDs for the Queues and Buffers that use the Queue Manager.
 INT32 ready_queue_id;
-INT32 timer_queue_id;
 INT32 message_buffer_id;
 INT32 disk_queue[MAX_NUMBER_OF_DISKS];
+//Writes held back until their disk has nothing else to do
+INT32 write_behind_queue[MAX_NUMBER_OF_DISKS];
+INT32 write_behind_count[MAX_NUMBER_OF_DISKS];
+
+//With batched interrupts the hardware hands over every device event that
+//is due in one call of InterruptHandler. It is on unless the
+//interrupts=single option is given.
+INT32 BatchInterrupts;
+
+//A deterministic run lets the interrupt thread run only while the
+//processor waits for it, so the same seed gives the same timeline. It is
+//asked for with seed=N or eventlog=record|replay. RunSeed of 0 lets the
+//hardware pick the seed.
+INT32 DeterministicRun;
+long RunSeed;
+INT32 EventLogging;
+
+//With trace=on the hardware keeps a binary trace of scheduling, system
+//call, fault, disk and timer events and writes it out at halt.
+INT32 RecordTrace;
+
+//With print=async aprintf hands its lines to a writer thread instead of
+//writing them itself.
+INT32 AsyncPrinting;
+
+//The OS adds its own statistics to the hardware's registry: the latency
+//of each system call, the depth of a disk queue when a request joins it
+//and how long a process waits on the Ready Queue. stats=json|csv|both has
+//the registry written out at halt.
+//A system call's latency is kept in simulated ticks and in host
+//nanoseconds, along with the total ticks it spent waiting in the
+//dispatcher.
+#define NUMBER_OF_SYSTEM_CALLS 28
+INT32 StatisticsExport;
+INT32 svc_ticks_stat[NUMBER_OF_SYSTEM_CALLS];
+INT32 svc_ns_stat[NUMBER_OF_SYSTEM_CALLS];
+INT32 svc_wait_stat[NUMBER_OF_SYSTEM_CALLS];
+INT32 disk_queue_depth[MAX_NUMBER_OF_DISKS];
+INT32 disk_depth_stat;
+INT32 ready_wait_stat;
 
 //Here are the locks for the different Queues, Buffers and shared memory.
 #define READY_LOCK MEMORY_INTERLOCK_BASE
@@ -142,9 +248,34 @@ INT32 DISK_LOCK[MAX_NUMBER_OF_DISKS];
 INT32 M;
 
 /*
-Global Frame Manager
+The frame table has one descriptor for each physical frame. Free frames
+are chained together through next_free so one can be taken without a
+search.
 */
-INT32 FrameManager[NUMBER_PHYSICAL_PAGES];
+#define FRAME_IN_USE 0x01
+//Brought in by fault around and not yet seen used
+#define FRAME_FAULT_AROUND 0x02
+//Belongs to a shared area rather than to a process. owner is NULL
+#define FRAME_SHARED 0x04
+//Free and known to hold nothing but zeros
+#define FRAME_ZEROED 0x08
+//Taken from its owner and being written to the swap disk. owner is NULL
+#define FRAME_IN_TRANSIT 0x10
+
+typedef struct{
+  PROCESS_CONTROL_BLOCK *owner;  //process using the frame. NULL if free
+  INT16 page;                    //page table index in the owner
+  INT16 flags;
+  INT16 pin_count;               //pinned frames are never replaced
+  UINT32 age;                    //aging counter for page replacement
+  INT32 loaded_at;               //page fault count when the page came in
+  INT32 last_used;               //page fault count when last seen referenced
+  INT16 next_free;               //next frame on the free list. -1 at end
+}FRAME_DESCRIPTOR;
+
+FRAME_DESCRIPTOR FrameTable[NUMBER_PHYSICAL_PAGES];
+INT16 FreeFrameList;
+INT16 FreeFrameCount;
 INT32 NextFrame;
 
 #define MAX_INT ((UINT32)~0 >> 1)
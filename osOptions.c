@@ -0,0 +1,197 @@
+/*
+osOptions.c
+
+This file reads the options given on the command line after the test
+name. An option looks like name=value, for example
+
+  os test25 layout=extent
+  os test30 dirindex=off
+  os test25 M layout=extent
+  os test45 replace=wsclock
+  os test44 faultaround=4
+  os test45 rsmin=4 rsmax=24 loadcontrol=off
+  os test51 rsmax=8
+  os test48 timerslack=0 interrupts=single
+  os test45 seed=7 eventlog=record
+  os test45 M trace=on print=async
+  os test44 stats=both
+
+Options set OS wide flags before the first process is created.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "protos.h"
+#include "osGlobals.h"
+#include "diskManagement.h"
+#include "directoryIndex.h"
+#include "memoryManagement.h"
+#include "timerQueue.h"
+#include "osOptions.h"
+
+/*
+Set the flag for a single option. Unknown options are reported and
+otherwise ignored.
+*/
+void SetOsOption(char *Option){
+
+  if(strcmp(Option, "layout=index") == 0){
+    FileLayout = FILE_LAYOUT_INDEX;
+    return;
+  }
+  if(strcmp(Option, "layout=extent") == 0){
+    FileLayout = FILE_LAYOUT_EXTENT;
+    return;
+  }
+  if(strcmp(Option, "dirindex=on") == 0){
+    DirectoryIndexEnabled = TRUE;
+    return;
+  }
+  if(strcmp(Option, "dirindex=off") == 0){
+    DirectoryIndexEnabled = FALSE;
+    return;
+  }
+  if(strcmp(Option, "pageout=on") == 0){
+    PageOutEnabled = TRUE;
+    return;
+  }
+  if(strcmp(Option, "pageout=off") == 0){
+    PageOutEnabled = FALSE;
+    return;
+  }
+  if(strcmp(Option, "interrupts=batch") == 0){
+    BatchInterrupts = TRUE;
+    return;
+  }
+  if(strcmp(Option, "interrupts=single") == 0){
+    BatchInterrupts = FALSE;
+    return;
+  }
+  if(strcmp(Option, "eventlog=record") == 0){
+    EventLogging = EVENT_LOG_RECORD;
+    DeterministicRun = TRUE;
+    return;
+  }
+  if(strcmp(Option, "eventlog=replay") == 0){
+    EventLogging = EVENT_LOG_REPLAY;
+    DeterministicRun = TRUE;
+    return;
+  }
+  if(strcmp(Option, "trace=on") == 0){
+    RecordTrace = TRUE;
+    return;
+  }
+  if(strcmp(Option, "trace=off") == 0){
+    RecordTrace = FALSE;
+    return;
+  }
+  if(strcmp(Option, "print=async") == 0){
+    AsyncPrinting = TRUE;
+    return;
+  }
+  if(strcmp(Option, "print=sync") == 0){
+    AsyncPrinting = FALSE;
+    return;
+  }
+  if(strcmp(Option, "stats=json") == 0){
+    StatisticsExport = STATS_JSON;
+    return;
+  }
+  if(strcmp(Option, "stats=csv") == 0){
+    StatisticsExport = STATS_CSV;
+    return;
+  }
+  if(strcmp(Option, "stats=both") == 0){
+    StatisticsExport = STATS_JSON | STATS_CSV;
+    return;
+  }
+  if(strcmp(Option, "loadcontrol=on") == 0){
+    LoadControlEnabled = TRUE;
+    return;
+  }
+  if(strcmp(Option, "loadcontrol=off") == 0){
+    LoadControlEnabled = FALSE;
+    return;
+  }
+  if(strncmp(Option, "rsmin=", 6) == 0){
+    INT32 Frames = atoi(Option + 6);
+    if(Frames >= 0 && Frames <= NUMBER_PHYSICAL_PAGES){
+      ResidentMin = Frames;
+      return;
+    }
+  }
+  if(strncmp(Option, "rsmax=", 6) == 0){
+    INT32 Frames = atoi(Option + 6);
+    if(Frames >= 1 && Frames <= NUMBER_PHYSICAL_PAGES){
+      ResidentMax = Frames;
+      return;
+    }
+  }
+  if(strncmp(Option, "faultaround=", 12) == 0){
+    INT32 Window = atoi(Option + 12);
+    if(Window >= 0 && Window <= MAX_FAULT_AROUND){
+      FaultAroundWindow = Window;
+      return;
+    }
+  }
+  if(strncmp(Option, "timerslack=", 11) == 0){
+    INT32 Slack = atoi(Option + 11);
+    if(Slack >= 0 && Slack <= MAX_TIMER_SLACK){
+      TimerSlack = Slack;
+      return;
+    }
+  }
+  if(strncmp(Option, "seed=", 5) == 0){
+    long Seed = atol(Option + 5);
+    if(Seed > 0){
+      RunSeed = Seed;
+      DeterministicRun = TRUE;
+      return;
+    }
+  }
+  if(strncmp(Option, "replace=", 8) == 0){
+    for(INT32 i=0; i<NUMBER_REPLACEMENT_POLICIES; i++){
+      if(strcmp(Option + 8, ReplacementPolicyNames[i]) == 0){
+	ReplacementPolicy = i;
+	return;
+      }
+    }
+  }
+  aprintf("\n\nERROR: Option %s Not Recognized\n\n", Option);
+}
+
+/*
+Write into Description the test and every option that changes the timing
+of a run, the way they would be given on the command line. The event log
+keeps it so a replay can tell it is not run the same way. Description
+must hold EVENT_LOG_OPTIONS_LENGTH characters.
+*/
+void DescribeTimingOptions(char *TestName, char *Description){
+
+  snprintf(Description, EVENT_LOG_OPTIONS_LENGTH,
+	   "%s%s layout=%s dirindex=%s pageout=%s interrupts=%s "
+	   "loadcontrol=%s rsmin=%d rsmax=%d faultaround=%d timerslack=%d "
+	   "replace=%s", TestName, (M == MULTI ? " M" : ""),
+	   (FileLayout == FILE_LAYOUT_EXTENT ? "extent" : "index"),
+	   (DirectoryIndexEnabled == TRUE ? "on" : "off"),
+	   (PageOutEnabled == TRUE ? "on" : "off"),
+	   (BatchInterrupts == TRUE ? "batch" : "single"),
+	   (LoadControlEnabled == TRUE ? "on" : "off"),
+	   ResidentMin, ResidentMax, FaultAroundWindow, TimerSlack,
+	   ReplacementPolicyNames[ReplacementPolicy]);
+}
+
+/*
+Go through the command line. The test name is argv[1] and the 'M' that
+asks for a multiprocessor is skipped. Everything else is an option.
+*/
+void SetOsOptions(int argc, char *argv[]){
+
+  for(int i=2; i<argc; i++){
+    if(strcmp(argv[i], "M") == 0 || strcmp(argv[i], "m") == 0){
+      continue;
+    }
+    SetOsOption(argv[i]);
+  }
+}
@@ -0,0 +1,15 @@
+/*
+osOptions.h
+
+This file is the include file for the options that can be given on the
+command line after the test name. Options look like name=value.
+
+*/
+
+#ifndef OS_OPTIONS_H
+#define OS_OPTIONS_H
+
+void SetOsOptions(int argc, char *argv[]);
+void DescribeTimingOptions(char *TestName, char *Description);
+
+#endif //OS_OPTIONS_H
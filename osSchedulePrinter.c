@@ -15,6 +15,7 @@ when enabled.
 #include "process.h"
 #include "timerQueue.h"
 #include "osSchedulePrinter.h"
+#include "memoryManagement.h"
 
 /*
 This function fills the Ready Queue part of the Scheduler Printer.
@@ -45,27 +46,33 @@ void FillReady(SP_INPUT_DATA *SPInput){
 /*
 This function fills the Timer Queue part of the Scheduler Printer.
 It walks the Timer Queue and transfers the PIDs to the SP_INPUT struct.
+The heap is only partly ordered, so the PIDs are sorted by wakeup time
+as they go in, soonest first.
 */
 void FillTimer(SP_INPUT_DATA *SPInput){
 
-  INT16 TimerCount = 0;
-  int Index = 0;
-  TQ_ELEMENT *tqe;
+  long WakeupTimes[TIMER_HEAP_SIZE];
+  INT16 Count = 0;
+  INT16 Spot;
 
   LockLocation(TIMER_LOCK);
-  
-  tqe = QWalk(timer_queue_id, Index);
 
-  //Walk the Timer Queue until can't find anymore items
-  while((long)tqe != -1){
-    SPInput->TimerSuspendedProcessPIDs[Index] = (INT16)(tqe->PID);
-    Index++;
-    TimerCount++;
-    tqe = QWalk(timer_queue_id, Index);
+  for(int Index=0; Index<TimerCount; Index++){
+    Spot = Count;
+    while(Spot > 0 && WakeupTimes[Spot-1] > TimerHeap[Index]->wakeup_time){
+      WakeupTimes[Spot] = WakeupTimes[Spot-1];
+      SPInput->TimerSuspendedProcessPIDs[Spot] =
+	SPInput->TimerSuspendedProcessPIDs[Spot-1];
+      Spot--;
+    }
+    WakeupTimes[Spot] = TimerHeap[Index]->wakeup_time;
+    SPInput->TimerSuspendedProcessPIDs[Spot] =
+      (INT16)(TimerHeap[Index]->PID);
+    Count++;
   }
 
   UnlockLocation(TIMER_LOCK);
-  SPInput->NumberOfTimerSuspendedProcesses = TimerCount;
+  SPInput->NumberOfTimerSuspendedProcesses = Count;
 }
 
 /*
@@ -124,7 +131,7 @@ void FillProcessSuspended(SP_INPUT_DATA* SPInput){
   for(int i=0; i<MAXPROCESSES; i++){
     pcb = &PCB[i];
     if(pcb->in_use == 1){
-      if(pcb->state == SUSPENDED){
+      if(pcb->state == SUSPENDED || pcb->state == LOAD_SUSPENDED){
 	SuspendedCount++;
 	SPInput->ProcSuspendedProcessPIDs[Index] = (INT16)(pcb->idnum);
 	Index++;
@@ -202,49 +209,59 @@ void osPrintMemoryState(){
   if(MemoryPrints <= 0) return;
   
   MP_INPUT_DATA MPInput;
-  INT32 FrameData;
+  FRAME_DESCRIPTOR *Descriptor;
   MP_FRAME_DATA *Data;
-  INT16 PID;
   INT16 LogicalPage;
-  PROCESS_CONTROL_BLOCK *pcb;
-  INT16 *PageTable;
+  INT16 PageEntry;
   
   INT16 State;
   
   for(INT32 i=0; i<NUMBER_PHYSICAL_PAGES; i++){
-    FrameData = FrameManager[i];
+    Descriptor = &FrameTable[i];
     Data = &MPInput.frames[i];
+    State = 0;
+
+    //Frames of a shared area have no owner. Show them as valid pages
+    //of the area.
+    if((Descriptor->flags & FRAME_SHARED) != 0){
+      Data->InUse = TRUE;
+      Data->Pid = 0;
+      Data->LogicalPage = Descriptor->page;
+      Data->State = FRAME_VALID;
+      continue;
+    }
 
     //test to see if frame is in use.
-    if((FrameData & 0xFF000000) == 0){
+    if(Descriptor->owner == NULL){
       Data->InUse = FALSE;
+      Data->Pid = 0;
+      Data->LogicalPage = 0;
+      Data->State = State;
+      continue;
     }
-    else{
-      Data->InUse = TRUE;
-    }
+    Data->InUse = TRUE;
 
-    //Get PID of process using the Frame
-    PID = (FrameData>>16) & 0x00FF;
-    Data->Pid = PID;
+    //PID of process using the Frame
+    Data->Pid = Descriptor->owner->idnum;
 
     //Get Logical Page
-    LogicalPage = (FrameData & 0x0000FFFF);
+    LogicalPage = Descriptor->page;
     Data->LogicalPage = LogicalPage;
 
     //Get the state of the Page.
-    pcb = GetPCB(PID);
-    PageTable = pcb->page_table;
+    PageEntry = ReadPageTableEntry(Descriptor->owner->page_table,
+				   LogicalPage);
 
     //check valid bit
-    if((PageTable[LogicalPage] & PTBL_VALID_BIT) != 0){
+    if((PageEntry & PTBL_VALID_BIT) != 0){
       State = FRAME_VALID;
     }
     //Check Modified Bit
-    if((PageTable[LogicalPage] & PTBL_MODIFIED_BIT) != 0){
+    if((PageEntry & PTBL_MODIFIED_BIT) != 0){
       State = State + FRAME_MODIFIED;
     }
      //Check Referenced Bit
-    if((PageTable[LogicalPage] & PTBL_REFERENCED_BIT) != 0){
+    if((PageEntry & PTBL_REFERENCED_BIT) != 0){
       State = State + FRAME_REFERENCED;
     }
     
@@ -499,6 +516,9 @@ void SetTestNumber(char TestName[]){
   if(strcmp("test28", TestName) == 0){
     TestRunning = 28;
   }
+  if(strcmp("test30", TestName) == 0){
+    TestRunning = 30;
+  }
   if(strcmp("test29", TestName) == 0){
     TestRunning = 29;
   }
@@ -526,6 +546,15 @@ void SetTestNumber(char TestName[]){
   if(strcmp("test48", TestName) == 0){
     TestRunning = 48;
   }
+  if(strcmp("test49", TestName) == 0){
+    TestRunning = 49;
+  }
+  if(strcmp("test50", TestName) == 0){
+    TestRunning = 50;
+  }
+  if(strcmp("test51", TestName) == 0){
+    TestRunning = 51;
+  }
   
 }
 
@@ -618,6 +647,15 @@ void SetPrintOptions(INT32 TestRunning) {
     SchedulerPrints = 100;
     MemoryPrints = 0;
     break;
+  case 30: //Benchmarks run without output
+  case 49:
+  case 50:
+    SVCPrints = 0;
+    InterruptHandlerPrints = 0;
+    FaultHandlerPrints = 0;
+    SchedulerPrints = 0;
+    MemoryPrints = 0;
+    break;
   case 41:
   case 42:
     SVCPrints = MAX_INT;
@@ -638,6 +676,7 @@ void SetPrintOptions(INT32 TestRunning) {
   case 46:
   case 47:
   case 48:
+  case 51:
     SVCPrints = 10;
     InterruptHandlerPrints = 10;
     FaultHandlerPrints = 10;
@@ -730,6 +769,9 @@ long GetTestName(char* test_name){
   if(strcmp("test29", test_name) == 0){
     return (long)(test29);
   }
+  if(strcmp("test30", test_name) == 0){
+    return (long)(test30);
+  }
   if(strcmp("test41", test_name) == 0){
     return (long)(test41);
   }
@@ -754,6 +796,15 @@ long GetTestName(char* test_name){
   if(strcmp("test48", test_name) == 0){
     return (long)(test48);
   }
+  if(strcmp("test49", test_name) == 0){
+    return (long)(test49);
+  }
+  if(strcmp("test50", test_name) == 0){
+    return (long)(test50);
+  }
+  if(strcmp("test51", test_name) == 0){
+    return (long)(test51);
+  }
    
   return 0;
 }
@@ -13,6 +13,9 @@
 #include "protos.h"
 #include "osGlobals.h"
 #include "osSchedulePrinter.h"
+#include "openFileTable.h"
+#include "diskManagement.h"
+#include "memoryManagement.h"
 
 /*
   This function is called in OsInit. It sets the use flag to FREE and creates a LOCK that is associated with each PCB
@@ -66,6 +69,15 @@ long FillPCB(char* Name, long Context, INT32 Parent, long Priority, void* PageTa
     new_pcb->state = RUNNING;
     new_pcb->page_table = PageTable;
     new_pcb->shadow_page_table = ShadowPageTable;
+    new_pcb->swap_cluster_next = 0;
+    new_pcb->swap_cluster_left = 0;
+    for(int i=0; i<MAX_SHARED_MAPPINGS; i++){
+	new_pcb->shared_mappings[i].area = -1;
+    }
+    new_pcb->resident_pages = 0;
+    new_pcb->working_set = 0;
+    new_pcb->timer = NULL;
+    ClearOpenFiles(new_pcb);
   
     return new_pcb->idnum;
 }
@@ -379,6 +391,9 @@ void DeletePCB(long PID){
 	return;
     }
 
+    //Give back any files the process left open
+    CloseAllOpenFiles(pcb);
+
     //Cleanup PCB for reuse
     pcb->idnum = -1;
     pcb->in_use = FREE;
@@ -386,11 +401,25 @@ void DeletePCB(long PID){
     strcpy(pcb->name, "");
 
     //Remove frames that the process was using and return to the general pool
-    for(INT32 i=0; i<NUMBER_PHYSICAL_PAGES; i++){
-      if(((FrameManager[i] & 0x00FF0000)>>16) == PID){
-	FrameManager[i] = 0;
-      }
-    }
+    ReleaseProcessFrames(pcb);
+
+    //The same for the swap space it was using
+    ReleaseProcessSwap(pcb);
+
+    //and let go of any shared areas
+    ReleaseProcessSharedAreas(pcb);
+
+    //A process terminated while asleep must not be woken up
+    CancelTimer(pcb);
+
+    //Nothing refers to the page tables any more
+    DeletePageTable(pcb->page_table);
+    DeletePageTable(pcb->shadow_page_table);
+    pcb->page_table = NULL;
+    pcb->shadow_page_table = NULL;
+
+    //There may be room now for a process held back by load control
+    ResumeLoadSuspended(FALSE);
 }
 
 /*
@@ -410,13 +439,14 @@ void TerminateChildren(long ParentPID){
 
 /*
   Creates a new context with the given StartAddress and PageTable.
+  The page table is a two level one made by CreatePageTable.
   The newly created Context is returned.
 */
 long GetNewContext(long StartAddress, void *PageTable){
 
     long Context;
     MEMORY_MAPPED_IO mmio;
-    mmio.Mode = Z502InitializeContext;
+    mmio.Mode = Z502InitializeSparseContext;
     mmio.Field1 = 0;
     mmio.Field2 = StartAddress;
     mmio.Field3 = (long) PageTable;
@@ -441,14 +471,6 @@ void osCreateProcess(char Name[], long StartAddress, long Priority, long *PID, l
 
     long context;
 
-    // Every process will have a page table.  This will be used in
-    // the second half of the project.  
-    void *PageTable = (void *) calloc(2, NUMBER_VIRTUAL_PAGES);
-
-    //Also create a shadow page table. This maintains where the pages
-    //are stored in the Disk Swap Space if necessary
-    void *ShadowPageTable = (void *) calloc(2, NUMBER_VIRTUAL_PAGES);
-
     if(CheckProcessCount() == FALSE){
 	//aprintf("\n\nError: Reached Max number of Processes\n\n");
 	(*ReturnError) = ERR_BAD_PARAM;  //set error message
@@ -469,6 +491,14 @@ void osCreateProcess(char Name[], long StartAddress, long Priority, long *PID, l
 	return;
     }
 
+    // Every process will have a page table.  This will be used in
+    // the second half of the project.  
+    void *PageTable = CreatePageTable();
+
+    //Also create a shadow page table. This maintains where the pages
+    //are stored in the Disk Swap Space if necessary
+    void *ShadowPageTable = CreatePageTable();
+
     //Ask Hardware for new Context
     context = GetNewContext(StartAddress, PageTable);
 
@@ -613,6 +643,10 @@ void osTerminateProcess(long TargetPID, long *ReturnError){
 
 	//If there are no more active processes end the simulation
 	if(CheckActiveProcess() == FALSE){
+	    PrintReadAheadStats();
+	    PrintMemoryStats();
+	    PrintTimerStats();
+	    PrintSystemCallStats();
 	    mmio.Mode = Z502Action;
 	    mmio.Field1 = mmio.Field2 = mmio.Field3 = 0;
 	    MEM_WRITE(Z502Halt, &mmio);
@@ -25,6 +25,7 @@ void   InterruptHandler( void );
 void   FaultHandler( void );
 void   svc( SYSTEM_CALL_DATA * );
 void   osInit (int argc, char *argv[] );
+void   PrintSystemCallStats( void );
 
 //                     ENTRIES in sample.c
 
@@ -35,6 +36,8 @@ void   SampleCode(void );
 int     GetNumberOfSchedulePrints();
 int     GetNumberOfMemoryPrints();
 void    aprintf(const char *format, ...);
+void    StartAsyncPrinting( void );
+void    FlushPrinting( void );
 short   SPPrintLine( SP_INPUT_DATA * );
 short   MPPrintLine( MP_INPUT_DATA * );
 
@@ -81,6 +84,7 @@ void   test26( void );
 void   test27( void );
 void   test28( void );
 void   test29( void );
+void   test30( void );
 
 void   test40( void );
 void   test41( void );
@@ -91,6 +95,9 @@ void   test45( void );
 void   test46( void );
 void   test47( void );
 void   test48( void );
+void   test49( void );
+void   test50( void );
+void   test51( void );
 
 void   GetSkewedRandomNumber( long*, long, long );   // Used by sample.c
 
@@ -110,5 +117,13 @@ void   Z502ReadPhysicalMemory( INT32, char *);
 void   Z502WritePhysicalMemory( INT32, char *);
 void   *Z502PrepareProcessForExecution( void );
 void   Z502MemoryReadModify( INT32, INT32, INT32, INT32 * );
+UINT32 Z502RandomSeed( void );
+void   Z502TraceEvent( INT16, INT32, INT32, INT32 );
+INT32  Z502RegisterStatistic( char *, INT32 );
+void   Z502AddToStatistic( INT32, INT64 );
+UINT32 Z502StatisticsClock( void );
+UINT64 Z502HostNanoseconds( void );
+UINT32 Z502ContextWaitTime( UINT32 );
+void   Z502ReadStatistic( INT32, INT32, INT64 *, INT64 *, INT64 *, INT64 * );
 
 #endif // PROTOS_H_
@@ -14,6 +14,7 @@ includes the dispatcher.
 #include "timerQueue.h" 
 #include "osGlobals.h"
 #include "osSchedulePrinter.h"
+#include "memoryManagement.h"
 
 /*
 This function creates the Ready Queue using the functions found in the
@@ -40,6 +41,7 @@ void AddToReadyQueue(long Context, long PID, void* PCB, INT32 PrintFlag){
   rqe->context = Context;
   rqe->PID = PID;
   rqe->PCB = pcb;
+  rqe->ready_time = Z502StatisticsClock();
   pcb->queue_ptr = (void *)rqe;
   
   long Priority = pcb->priority;
@@ -157,9 +159,25 @@ the dispatcher grabs it and starts the context.
 void dispatcher(){
 
   MEMORY_MAPPED_IO mmio;
+  //The time the caller waits here counts against its system call
+  UINT32 WaitStart = Z502StatisticsClock();
 
   while(CheckReadyQueue() == -1){
     CALL(WasteTime());
+    //Use the time to get free frames ready for first touches
+    ZeroFreeFrames();
+    //Nothing else can run so let in a process held back by load control
+    ResumeLoadSuspended(TRUE);
+    //In a deterministic run interrupts are only taken while we wait in
+    //the hardware, so idle until the next event instead of spinning.
+    if(DeterministicRun == TRUE){
+      if(CheckReadyQueue() == -1){
+	mmio.Mode = Z502Action;
+	mmio.Field1 = mmio.Field2 = mmio.Field3 = mmio.Field4 = 0;
+	MEM_WRITE(Z502Idle, &mmio);
+      }
+      continue;
+    }
     //We need a sleep so other thread can get LOCK
     //Otherwise the Interrupt Handler can't get in to add a process
     //from the Timer or Disk Queues.
@@ -171,9 +189,12 @@ void dispatcher(){
 
   RQ_ELEMENT* rqe = RemoveFromReadyQueueHead();
   long Context = rqe->context;
+  Z502AddToStatistic(ready_wait_stat,
+		     (INT32)(Z502StatisticsClock() - rqe->ready_time));
 
 
   osPrintState("Dispatch", rqe->PID, CurrentPID);
+  Z502TraceEvent(TRACE_DISPATCH, rqe->PID, CurrentPID, 0);
   
   ChangeProcessState(rqe->PID, RUNNING);
 
@@ -189,6 +210,9 @@ void dispatcher(){
     aprintf("\n\nError: in starting context in dispatcher\n\n");
   }
 
+  //We are running again
+  Z502ContextWaitTime(Z502StatisticsClock() - WaitStart);
+
 }
 
 
@@ -26,6 +26,8 @@
  .                       printing.  That means even with multiple threads,
  .			 the output will come out cleanly. 
  4.60    March 2019      Lots of little cleanup.
+ .                       aprintf formats the whole line before it is
+ .                       written and can hand it to a writer thread.
  ****************************************************************************/
 
 #include                 "syscalls.h"
@@ -34,9 +36,11 @@
 #include                 "global.h"
 #include                 "stdio.h"
 #include                 "string.h"
+#include                 "stdlib.h"
 #include                 <stdarg.h>
 #if defined LINUX || defined MAC
 #include                 <unistd.h>
+#include                 <pthread.h>
 #endif
 
 //
@@ -45,23 +49,39 @@
 #define         SP_HEADER_STRING        \
 " Time Target   Action Run   State    Populations \n"
 
-// Note this lock is at the top end of the allowed range of user locks
-// So even thought this is a user level lock, it hopefully won't collide
-// with a lock generated by a student.ZZ
-#define         SP_USER_LOCK                0xF0
-// Used to do locking and unlocking
-#define         DO_LOCK                     1
-#define         DO_UNLOCK                   0
-#define         SUSPEND_UNTIL_LOCKED        TRUE
-#define         DO_NOT_SUSPEND              FALSE
-
 // Counters for the number of times these routines are called.
 int NumberOfSPPrintLineCalls = 0;
 int NumberOfMPPrintLineCalls = 0;
 
+// Most lines fit in a buffer on the caller's stack.  Longer ones are
+// formatted again into one from malloc.
+#define         PRINT_LINE_SIZE             2048
+
+// A finished line waiting for the writer thread.
+typedef struct PRINT_LINE {
+    struct PRINT_LINE  *Next;
+    int                 Length;
+    char                Text[1];
+} PRINT_LINE;
+
+// Lines are pushed on PendingLines without a lock, newest first.  The
+// writer takes the whole list at once and puts it back in order.
+PRINT_LINE * volatile PendingLines = NULL;
+int AsyncPrintingStarted = FALSE;
+#if defined LINUX || defined MAC
+pthread_t       PrintWriterThread;
+pthread_mutex_t PrintWriterMutex = PTHREAD_MUTEX_INITIALIZER;
+// The writer sleeps on PrintWakeup until a line lands on an empty list.
+pthread_mutex_t PrintWakeupMutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t  PrintWakeup = PTHREAD_COND_INITIALIZER;
+#endif
+
 // Prototypes for support routines
 short SPDoOutput(char *text);
-void  SPLineSetup(char *, char *, INT16, INT16 *);
+int   SPLineSetup(char *, int, char *, INT16, INT16 *);
+void  WriteLine(const char *, int);
+void  QueueLine(const char *, int);
+void  WritePendingLines(void);
 
 /****************************************************************************
  GetNumberOfSchedulePrints()
@@ -84,25 +104,153 @@ int   GetNumberOfMemoryPrints(){
  This code depends on a C construct that allows a function to accept an
  arbitrary number of variables.  That happens in this case because it's 
  unknown how many arguments the printf might have.
+
+ The text is formatted into a buffer of the caller's own first, so no
+ lock is held while formatting.  It is then either written with a single
+ fwrite, which the C library keeps whole, or, once StartAsyncPrinting()
+ has been called, queued for the writer thread so the caller doesn't
+ wait on the terminal at all.
 ****************************************************************************/
 void aprintf(const char *format, ...)   {
     va_list args;
+    char Line[PRINT_LINE_SIZE];
+    char *Text = Line;
+    int Length;
+
     va_start(args, format);
-    INT32 LockResult;
-
-    // Note we are using an OS level lock here - the same type as a student
-    // might use in an OS.  This is because the statePrinter is being executed
-    // at the OS level, not within the hardware.
-    READ_MODIFY(MEMORY_INTERLOCK_BASE + SP_USER_LOCK, DO_LOCK, SUSPEND_UNTIL_LOCKED,
-				&LockResult);
- 
-    vprintf(format, args);
-
-    READ_MODIFY(MEMORY_INTERLOCK_BASE + SP_USER_LOCK, DO_UNLOCK, SUSPEND_UNTIL_LOCKED,
-			&LockResult);
+    Length = vsnprintf(Line, sizeof(Line), format, args);
     va_end(args);
+    if (Length < 0)
+        return;
+    if (Length >= (int) sizeof(Line)) {
+        Text = (char *) malloc(Length + 1);
+        if (Text == NULL)
+            return;
+        va_start(args, format);
+        vsnprintf(Text, Length + 1, format, args);
+        va_end(args);
+    }
+    if (AsyncPrintingStarted == TRUE)
+        QueueLine(Text, Length);
+    else
+        WriteLine(Text, Length);
+    if (Text != Line)
+        free(Text);
 }   // End of aprint
 
+/****************************************************************************
+ WriteLine
+ Write one formatted line in a single call so it can't be split.
+****************************************************************************/
+void WriteLine(const char *Text, int Length) {
+    fwrite(Text, 1, Length, stdout);
+}   // End of WriteLine
+
+/****************************************************************************
+ QueueLine
+ Copy a formatted line and push it on PendingLines with compare and swap.
+ Lines are written in the order they were pushed.  Only one processor
+ runs a context at a time, so that is also the order of simulated time.
+ Only the line that makes the list non-empty wakes the writer; until it
+ has taken the list, later lines just join it.
+****************************************************************************/
+void QueueLine(const char *Text, int Length) {
+    PRINT_LINE *Entry;
+
+    Entry = (PRINT_LINE *) malloc(sizeof(PRINT_LINE) + Length);
+    if (Entry == NULL) {
+        WriteLine(Text, Length);
+        return;
+    }
+    memcpy(Entry->Text, Text, Length);
+    Entry->Length = Length;
+#if defined LINUX || defined MAC
+    do {
+        Entry->Next = PendingLines;
+    } while (!__sync_bool_compare_and_swap(&PendingLines, Entry->Next, Entry));
+    if (Entry->Next == NULL) {
+        pthread_mutex_lock(&PrintWakeupMutex);
+        pthread_cond_signal(&PrintWakeup);
+        pthread_mutex_unlock(&PrintWakeupMutex);
+    }
+#endif
+}   // End of QueueLine
+
+/****************************************************************************
+ WritePendingLines
+ Take every queued line, oldest first, and write it out.  The writer
+ thread and FlushPrinting both come here, one at a time.
+****************************************************************************/
+void WritePendingLines(void) {
+#if defined LINUX || defined MAC
+    PRINT_LINE *Newest, *Oldest = NULL, *Entry;
+
+    pthread_mutex_lock(&PrintWriterMutex);
+    Newest = __sync_lock_test_and_set(&PendingLines, NULL);
+    while (Newest != NULL) {       // Reverse into the order they came in
+        Entry = Newest;
+        Newest = Newest->Next;
+        Entry->Next = Oldest;
+        Oldest = Entry;
+    }
+    while (Oldest != NULL) {
+        Entry = Oldest;
+        Oldest = Oldest->Next;
+        WriteLine(Entry->Text, Entry->Length);
+        free(Entry);
+    }
+    fflush(stdout);
+    pthread_mutex_unlock(&PrintWriterMutex);
+#endif
+}   // End of WritePendingLines
+
+/****************************************************************************
+ PrintWriter
+ The writer thread.  It waits until QueueLine says there is something
+ to write; the list is checked under PrintWakeupMutex so a wakeup sent
+ between the check and the wait is not lost.
+****************************************************************************/
+#if defined LINUX || defined MAC
+void *PrintWriter(void *Unused) {
+    while (TRUE) {
+        pthread_mutex_lock(&PrintWakeupMutex);
+        while (PendingLines == NULL)
+            pthread_cond_wait(&PrintWakeup, &PrintWakeupMutex);
+        pthread_mutex_unlock(&PrintWakeupMutex);
+        WritePendingLines();
+    }
+    return NULL;
+}   // End of PrintWriter
+#endif
+
+/****************************************************************************
+ FlushPrinting
+ Write out whatever is still queued.  It runs when the program exits so
+ no line is lost.
+****************************************************************************/
+void FlushPrinting(void) {
+    if (AsyncPrintingStarted == TRUE)
+        WritePendingLines();
+}   // End of FlushPrinting
+
+/****************************************************************************
+ StartAsyncPrinting
+ From now on aprintf queues its lines for a writer thread.  On Windows
+ output stays synchronous.
+****************************************************************************/
+void StartAsyncPrinting(void) {
+#if defined LINUX || defined MAC
+    if (AsyncPrintingStarted == TRUE)
+        return;
+    if (pthread_create(&PrintWriterThread, NULL, PrintWriter, NULL) != 0) {
+        aprintf("Unable to start the print writer - printing synchronously\n");
+        return;
+    }
+    atexit(FlushPrinting);
+    AsyncPrintingStarted = TRUE;
+#endif
+}   // End of StartAsyncPrinting
+
 /****************************************************************************
  SPPrintLine
 
@@ -116,53 +264,62 @@ void aprintf(const char *format, ...)   {
  found in sample.
  So what we do here is set up a long string containing ALL the informatio
  for the output, and then send it to aprintf for an atomic output.
+ Length keeps track of where the string ends so each piece is added
+ on the end rather than searched for with strcat.
  ****************************************************************************/
 
+#define         SP_LINE_SIZE                900
+
 short SPPrintLine(SP_INPUT_DATA *Input) {
-    char OutputLine[900];
-    char temp[60];
+    char OutputLine[SP_LINE_SIZE];
+    int Length;
 
     // Used to get the current_time;
     MEMORY_MAPPED_IO mmio;
 
     // print out the header
-    sprintf(OutputLine, "%s", SP_HEADER_STRING);
+    Length = snprintf(OutputLine, SP_LINE_SIZE, "%s", SP_HEADER_STRING);
 
     //  Get the current time and place it in the output string
     mmio.Mode = Z502ReturnValue;
     mmio.Field1 = mmio.Field2 = mmio.Field3 = 0;
     MEM_READ(Z502Clock, &mmio);
-    sprintf(temp, "%5d", (int) mmio.Field1 % 100000);
-    strcat(OutputLine, temp);
+    Length += snprintf(OutputLine + Length, SP_LINE_SIZE - Length, "%5d",
+            (int) mmio.Field1 % 100000);
 
     // If user defines the target PID, place it here
     if (Input->TargetPID >= 0)
-    	sprintf(temp, "%5d  ", Input->TargetPID);
+    	Length += snprintf(OutputLine + Length, SP_LINE_SIZE - Length,
+    	        "%5d  ", Input->TargetPID);
     else
-    	sprintf(temp, "%s", "       ");
-    (void) strcat(OutputLine, temp);
-    
-    sprintf(temp, " %8s", Input->TargetAction); /* Action       */
-    (void) strcat(OutputLine, temp);
-    
-    sprintf(temp, " %3d   ", Input->CurrentlyRunningPID);
-    (void) strcat(OutputLine, temp);
-
-    SPLineSetup(OutputLine, "RUNNING:", Input->NumberOfRunningProcesses,
-    		Input->RunningProcessPIDs);
-    SPLineSetup(OutputLine, "READY  :", Input->NumberOfReadyProcesses,
-    		Input->ReadyProcessPIDs);
-    SPLineSetup(OutputLine, "SUS-PRC:", Input->NumberOfProcSuspendedProcesses,
-    		Input->ProcSuspendedProcessPIDs);
-    SPLineSetup(OutputLine, "SUS-TMR:", Input->NumberOfTimerSuspendedProcesses,
-    		Input->TimerSuspendedProcessPIDs);
-    SPLineSetup(OutputLine, "SUS-MSG:",
-    		Input->NumberOfMessageSuspendedProcesses,
-    		Input->MessageSuspendedProcessPIDs);
-    SPLineSetup(OutputLine, "SUS-DSK:", Input->NumberOfDiskSuspendedProcesses,
-    		Input->DiskSuspendedProcessPIDs);
-    SPLineSetup(OutputLine, "TERM'S :", Input->NumberOfTerminatedProcesses,
-    		Input->TerminatedProcessPIDs);
+    	Length += snprintf(OutputLine + Length, SP_LINE_SIZE - Length,
+    	        "%s", "       ");
+
+    Length += snprintf(OutputLine + Length, SP_LINE_SIZE - Length,
+            " %8s", Input->TargetAction); /* Action       */
+
+    Length += snprintf(OutputLine + Length, SP_LINE_SIZE - Length,
+            " %3d   ", Input->CurrentlyRunningPID);
+
+    Length = SPLineSetup(OutputLine, Length, "RUNNING:",
+            Input->NumberOfRunningProcesses, Input->RunningProcessPIDs);
+    Length = SPLineSetup(OutputLine, Length, "READY  :",
+            Input->NumberOfReadyProcesses, Input->ReadyProcessPIDs);
+    Length = SPLineSetup(OutputLine, Length, "SUS-PRC:",
+            Input->NumberOfProcSuspendedProcesses,
+            Input->ProcSuspendedProcessPIDs);
+    Length = SPLineSetup(OutputLine, Length, "SUS-TMR:",
+            Input->NumberOfTimerSuspendedProcesses,
+            Input->TimerSuspendedProcessPIDs);
+    Length = SPLineSetup(OutputLine, Length, "SUS-MSG:",
+            Input->NumberOfMessageSuspendedProcesses,
+            Input->MessageSuspendedProcessPIDs);
+    Length = SPLineSetup(OutputLine, Length, "SUS-DSK:",
+            Input->NumberOfDiskSuspendedProcesses,
+            Input->DiskSuspendedProcessPIDs);
+    Length = SPLineSetup(OutputLine, Length, "TERM'S :",
+            Input->NumberOfTerminatedProcesses,
+            Input->TerminatedProcessPIDs);
     
     NumberOfSPPrintLineCalls++;
     SPDoOutput(OutputLine);    // We've accumulated the whole line - print it.
@@ -175,21 +332,28 @@ short SPPrintLine(SP_INPUT_DATA *Input) {
 
  Takes input from the user and packages it in a pretty fashion
  char OutputText -   the accumulated string onto which all text is appended
+ int Length -        where the accumulated string ends now
  char *mode -        character string describing the kind of pids we're working with
  INT16 Number -      how many processes are there in this category
  INT16 ArrayOfPids - the process IDs in this category
+ Returns where the accumulated string ends afterwards.
  ****************************************************************************/
-void SPLineSetup(char *OutputText, char *mode, INT16 Number, INT16 ArrayOfPids[]) {
-    char Temp[64];
+int SPLineSetup(char *OutputText, int Length, char *mode, INT16 Number,
+        INT16 ArrayOfPids[]) {
     int index;
     if (Number > 0) {    // There are pids to deal with
-        strcat(OutputText, mode);
-        for (index = 0; index < Number; index++) {
-            sprintf(Temp, " %d", ArrayOfPids[index]);
-            (void) strcat(OutputText, Temp);
-        }
-        strcat(OutputText, "\n                            ");
+        Length += snprintf(OutputText + Length, SP_LINE_SIZE - Length,
+                "%s", mode);
+        for (index = 0; index < Number && Length < SP_LINE_SIZE; index++)
+            Length += snprintf(OutputText + Length, SP_LINE_SIZE - Length,
+                    " %d", ArrayOfPids[index]);
+        if (Length < SP_LINE_SIZE)
+            Length += snprintf(OutputText + Length, SP_LINE_SIZE - Length,
+                    "\n                            ");
     }
+    if (Length >= SP_LINE_SIZE)     // Truncated - stay at the end
+        Length = SP_LINE_SIZE - 1;
+    return Length;
 } // End of SPLineSetup
 /****************************************************************************
  SPDoOutput
@@ -65,6 +65,9 @@
 void testD(void);
 void testE(void);
 void testS(void);
+void testC(void);
+void testF(void);
+void testG(void);
 void testX(void);
 void testZ(void);
 
@@ -567,7 +570,7 @@ void test8(void)  {
 	CHANGE_PRIORITY(Ourself, MOST_FAVORABLE_PRIORITY, &ErrorReturned);
 
 	// Make legal targets
-	printf( "TEST 8: Processes started with priority %d\n", NORMAL_PRIORITY);
+	aprintf( "TEST 8: Processes started with priority %d\n", NORMAL_PRIORITY);
 	CREATE_PROCESS("test8_a", testX, NORMAL_PRIORITY, &ProcessID1,
 			&ErrorReturned);
 	CREATE_PROCESS("test8_b", testX, NORMAL_PRIORITY, &ProcessID2,
@@ -682,14 +685,14 @@ void test9(void) {
 
     td = (TEST9_DATA *) calloc(1, sizeof(TEST9_DATA));
     if (td == 0) {
-        printf("Something screwed up allocating space in test9\n");
+        aprintf("Something screwed up allocating space in test9\n");
     }
 
     td->loop_count = 0;
 
     // Get OUR PID
     GET_PROCESS_ID("", &OurProcessID, &ErrorReturned);
-    printf("Release %s:Test 9: Pid %ld\n", CURRENT_REL, OurProcessID);
+    aprintf("Release %s:Test 9: Pid %ld\n", CURRENT_REL, OurProcessID);
 
     // Make our priority high 
     CHANGE_PRIORITY(-1, MOST_FAVORABLE_PRIORITY, &ErrorReturned);
@@ -751,7 +754,7 @@ void test9(void) {
         td->loop_count++;
     }  // End of while
 
-    printf("A total of %ld messages were enqueued.\n", td->loop_count - 1);
+    aprintf("A total of %ld messages were enqueued.\n", td->loop_count - 1);
 
     GET_TIME_OF_DAY(&CurrentTime);
     aprintf("TEST 9:   Ends at Time %ld\n", CurrentTime);
@@ -823,14 +826,14 @@ void test10(void) {
 
     td = (TEST10_DATA *) calloc(1, sizeof(TEST10_DATA));
     if (td == 0) {
-        printf("Something screwed up allocating space in test1j\n");
+        aprintf("Something screwed up allocating space in test1j\n");
     }
     td->send_loop_count = 0;
     td->receive_loop_count = 0;
 
     // Get OUR PID and print it
     GET_PROCESS_ID("", &OurProcessID, &ErrorReturned);
-    printf("Release %s:Test 10: Pid %ld\n", CURRENT_REL, OurProcessID);
+    aprintf("Release %s:Test 10: Pid %ld\n", CURRENT_REL, OurProcessID);
 
     // Make our priority high
     CHANGE_PRIORITY(-1, MOST_FAVORABLE_PRIORITY, &ErrorReturned);
@@ -873,13 +876,13 @@ void test10(void) {
         SuccessExpected(ErrorReturned, "RECEIVE_MESSAGE");
 
         if (strcmp(td->msg_buffer, td->msg_sent) != 0)
-            printf("ERROR - msg sent != msg received.\n");
+            aprintf("ERROR - msg sent != msg received.\n");
 
         if (td->actual_source_pid != td->target_pid )
-            printf("ERROR - source PID not correct.\n");
+            aprintf("ERROR - source PID not correct.\n");
 
         if (td->actual_send_length != td->send_length)
-            printf("ERROR - send length not sent correctly.\n");
+            aprintf("ERROR - send length not sent correctly.\n");
     }    // End of for loop
 
     //      Keep sending legal messages until the architectural (OS)
@@ -895,7 +898,7 @@ void test10(void) {
         td->send_loop_count++;
     }
     td->send_loop_count--;
-    printf("A total of %ld messages were enqueued.\n", td->send_loop_count);
+    aprintf("A total of %ld messages were enqueued.\n", td->send_loop_count);
 
     //  Now receive back from the other processes the same number of messages we've just sent.
     while (td->receive_loop_count < td->send_loop_count) {
@@ -905,12 +908,12 @@ void test10(void) {
                 &(td->actual_send_length), &(td->actual_source_pid),
                 &ErrorReturned);
         SuccessExpected(ErrorReturned, "RECEIVE_MESSAGE");
-        printf("Receive from PID = %ld: length = %ld: msg = %s:\n",
+        aprintf("Receive from PID = %ld: length = %ld: msg = %s:\n",
                 td->actual_source_pid, td->actual_send_length, td->msg_buffer);
         td->receive_loop_count++;
     }
 
-    printf("A total of %ld messages were received.\n",
+    aprintf("A total of %ld messages were received.\n",
             td->receive_loop_count);
 
     GET_TIME_OF_DAY(&CurrentTime);
@@ -1593,6 +1596,81 @@ void test29(void) {
 	TERMINATE_PROCESS(-1, &ErrorReturned)
 }   // End test29
 
+/**************************************************************************
+ Test30 - Directory lookup benchmark
+ Performs the following operations:
+ 1.  Format a disk.
+ 2.  OPEN_DIR of the directory "root" which causes that
+ to become the Current Directory.
+ 3.  Fill root with files.  A directory index holds 8 entries.
+ 4.  OPEN_FILE and CLOSE_FILE those files over and over.  Every open
+ has to find the file by name in the directory.
+ 5.  Report the simulated time and the host time used per open.
+ Run it again with the option dirindex=off to compare against searching
+ the directory without its name index.
+ **************************************************************************/
+
+#define         NUMBER_TEST30_FILES               8
+#define         NUMBER_TEST30_OPENS            4000
+
+void test30(void) {
+	long StartTime, EndTime;
+	long OurProcessID;
+	long DiskID = 3;
+	long ErrorReturned;
+	long Inode;
+	long Iteration;
+	char FileName[16];
+	clock_t HostStart, HostEnd;
+
+	GET_PROCESS_ID("", &OurProcessID, &ErrorReturned);
+	aprintf("Release %s: test30: Pid %ld\n", TEST_VERSION, OurProcessID);
+
+	FORMAT(DiskID, &ErrorReturned);
+	SuccessExpected(ErrorReturned, "FORMAT");
+
+	OPEN_DIR(DiskID, "root", &ErrorReturned);
+	SuccessExpected(ErrorReturned, "OPEN_DIR of root");
+
+	for (Iteration = 0; Iteration < NUMBER_TEST30_FILES; Iteration++) {
+		sprintf(FileName, "Bench%ld", Iteration);
+		CREATE_FILE(FileName, &ErrorReturned);
+		SuccessExpected(ErrorReturned, "CREATE_FILE");
+	}
+
+	GET_TIME_OF_DAY(&StartTime);
+	HostStart = clock();
+	for (Iteration = 0; Iteration < NUMBER_TEST30_OPENS; Iteration++) {
+		// Open the files from the back of the directory first.
+		sprintf(FileName, "Bench%ld", NUMBER_TEST30_FILES - 1
+				- (Iteration % NUMBER_TEST30_FILES));
+		OPEN_FILE(FileName, &Inode, &ErrorReturned);
+		if (ErrorReturned != ERR_SUCCESS) {
+			aprintf("Test30 - OPEN_FILE of %s failed\n", FileName);
+			break;
+		}
+		CLOSE_FILE(Inode, &ErrorReturned);
+	}
+	HostEnd = clock();
+	GET_TIME_OF_DAY(&EndTime);
+
+	aprintf("Test30 - %d opens of %d files in one directory\n",
+			NUMBER_TEST30_OPENS, NUMBER_TEST30_FILES);
+	aprintf("Test30 - Simulated time: %ld total, %ld per open\n",
+			EndTime - StartTime, (EndTime - StartTime) / NUMBER_TEST30_OPENS);
+	aprintf("Test30 - Host time: %ld microseconds total, %ld ns per open\n",
+			(long) ((HostEnd - HostStart) * 1000000 / CLOCKS_PER_SEC),
+			(long) ((HostEnd - HostStart) * 1000000000.0 / CLOCKS_PER_SEC
+					/ NUMBER_TEST30_OPENS));
+
+	CHECK_DISK(DiskID, &ErrorReturned);
+	SuccessExpected(ErrorReturned, "CHECK_DISK");
+
+	GET_TIME_OF_DAY(&EndTime);
+	aprintf("TEST 30:   Ends at Time %ld\n", EndTime);
+	TERMINATE_PROCESS(-1, &ErrorReturned);
+}                                                     // End test30
+
 /**************************************************************************
  testD
  Test causes usage of disks.  The test is designed to give
@@ -1953,12 +2031,12 @@ void testE(void) {
 
     td = (TESTE_DATA *) calloc(1, sizeof(TESTE_DATA));
     if (td == 0) {
-        printf("Something screwed up allocating space in testE\n");
+        aprintf("Something screwed up allocating space in testE\n");
     }
 
     GET_PROCESS_ID("", &OurProcessID, &ErrorReturned);
     SuccessExpected(ErrorReturned, "GET_PROCESS_ID");
-    printf("Release %s:Test 1j_echo: Pid %ld\n", CURRENT_REL, OurProcessID);
+    aprintf("Release %s:Test 1j_echo: Pid %ld\n", CURRENT_REL, OurProcessID);
 
     while (1) {       // Loop forever.
         td->source_pid = -1;
@@ -1968,7 +2046,7 @@ void testE(void) {
                 &ErrorReturned);
         SuccessExpected(ErrorReturned, "RECEIVE_MESSAGE");
 
-        printf("Receive from PID = %ld: length = %ld: msg = %s:\n",
+        aprintf("Receive from PID = %ld: length = %ld: msg = %s:\n",
                 td->actual_source_pid, td->actual_senders_length,
                 td->msg_buffer);
 
@@ -2402,6 +2480,316 @@ void test48(void) {
 
 }                                  // End of test48
 
+/**************************************************************************
+ Test49 - Copy on write mapping of a shared area
+ Performs the following operations:
+ 1.  Map a two page shared area and fill it with known data.
+ 2.  Create a process (testC) that maps the same area copy on write by
+ giving DEFINE_SHARED_AREA the tag "private:" followed by the area's tag.
+ 3.  testC checks it sees our data, then writes its own data over it
+ and checks it reads its own data back.
+ 4.  When testC is done, check the shared area still holds our data.
+ **************************************************************************/
+
+#define           TEST49_AREA_TAG             "Test49Area"
+#define           TEST49_PAGES                2
+#define           TEST49_WORDS                (TEST49_PAGES * PGSIZE / 4)
+
+void test49(void) {
+	long OurProcessID;
+	long ErrorReturned;
+	long ProcessID;
+	long ReturnedPID;
+	long OurSharedID;
+	long CurrentTime;
+	long ChildPriority = 10;
+	INT32 ReadWriteData;
+	INT32 Errors = 0;
+	int Index;
+
+	GET_PROCESS_ID("", &OurProcessID, &ErrorReturned);
+	aprintf("Release %s: test49: Pid %ld\n", TEST_VERSION, OurProcessID);
+
+	DEFINE_SHARED_AREA(0L, (long)TEST49_PAGES, (long)TEST49_AREA_TAG,
+			&OurSharedID, &ErrorReturned);
+	SuccessExpected(ErrorReturned, "DEFINE_SHARED_AREA");
+
+	for (Index = 0; Index < TEST49_WORDS; Index++) {
+		ReadWriteData = 4900 + Index;
+		MEM_WRITE(Index * 4, &ReadWriteData);
+	}
+
+	CREATE_PROCESS("Test49_C", testC, ChildPriority, &ProcessID,
+			&ErrorReturned);
+	SuccessExpected(ErrorReturned, "CREATE_PROCESS");
+
+	ErrorReturned = ERR_SUCCESS;
+	while (ErrorReturned == ERR_SUCCESS) {
+		SLEEP(100);
+		GET_PROCESS_ID("Test49_C", &ReturnedPID, &ErrorReturned);
+	}
+
+	for (Index = 0; Index < TEST49_WORDS; Index++) {
+		MEM_READ(Index * 4, &ReadWriteData);
+		if (ReadWriteData != 4900 + Index) {
+			aprintf("Test49 - Shared word %d is %d, expected %d\n", Index,
+					ReadWriteData, 4900 + Index);
+			Errors++;
+		}
+	}
+	aprintf("Test49 - Shared area %s after the copy on write process\n",
+			(Errors == 0) ? "unchanged" : "CHANGED");
+
+	GET_TIME_OF_DAY(&CurrentTime);
+	aprintf("TEST 49:   Ends at Time %ld\n", CurrentTime);
+	TERMINATE_PROCESS(-2, &ErrorReturned);
+}                                                     // End test49
+
+/**************************************************************************
+ testC - the copy on write half of test49.
+ **************************************************************************/
+
+void testC(void) {
+	long ErrorReturned;
+	long OurSharedID;
+	long Start = 5 * PGSIZE;    // A different address than test49 uses
+	INT32 ReadWriteData;
+	INT32 Errors = 0;
+	int Index;
+
+	DEFINE_SHARED_AREA(Start, (long)TEST49_PAGES,
+			(long)("private:" TEST49_AREA_TAG), &OurSharedID,
+			&ErrorReturned);
+	SuccessExpected(ErrorReturned, "DEFINE_SHARED_AREA copy on write");
+
+	for (Index = 0; Index < TEST49_WORDS; Index++) {
+		MEM_READ(Start + Index * 4, &ReadWriteData);
+		if (ReadWriteData != 4900 + Index) {
+			aprintf("TestC - Word %d is %d, expected %d\n", Index,
+					ReadWriteData, 4900 + Index);
+			Errors++;
+		}
+		ReadWriteData = -Index;
+		MEM_WRITE(Start + Index * 4, &ReadWriteData);
+	}
+	for (Index = 0; Index < TEST49_WORDS; Index++) {
+		MEM_READ(Start + Index * 4, &ReadWriteData);
+		if (ReadWriteData != -Index) {
+			aprintf("TestC - Word %d is %d after our write, expected %d\n",
+					Index, ReadWriteData, -Index);
+			Errors++;
+		}
+	}
+	aprintf("TestC - Copy on write mapping %s\n",
+			(Errors == 0) ? "correct" : "INCORRECT");
+	TERMINATE_PROCESS(-1, &ErrorReturned);
+}                                                     // End testC
+
+/**************************************************************************
+ Test50 - Page fault benchmark
+ Performs the following operations:
+ 1.  Map a one page shared area where the children leave their results.
+ 2.  One after the other, run children (testF) that each touch pages
+ they have never used before.  Every touch is a first touch page fault.
+ Each child times its own faults.
+ 3.  Report the simulated time and the host time used per fault.
+ Only one child runs at a time and it touches fewer pages than there are
+ frames, so no page is ever replaced and only first touches are timed.
+ Between children we sleep for TEST50_IDLE so the OS has idle time to
+ tidy up the frames the last child gave back.
+ **************************************************************************/
+
+#define           TEST50_AREA_TAG             "Test50Area"
+#define           NUMBER_TEST50_CHILDREN      10
+#define           NUMBER_TEST50_PAGES         40
+#define           TEST50_IDLE                 100
+
+void test50(void) {
+	long OurProcessID;
+	long ErrorReturned;
+	long ProcessID;
+	long ReturnedPID;
+	long OurSharedID;
+	long CurrentTime;
+	long ChildPriority = 10;
+	long SimulatedTime = 0;
+	long HostTime = 0;
+	INT32 ReadWriteData;
+	char ProcessName[16];
+	int Child;
+	int Faults = NUMBER_TEST50_CHILDREN * NUMBER_TEST50_PAGES;
+
+	GET_PROCESS_ID("", &OurProcessID, &ErrorReturned);
+	aprintf("Release %s: test50: Pid %ld\n", TEST_VERSION, OurProcessID);
+
+	DEFINE_SHARED_AREA(0L, 1L, (long)TEST50_AREA_TAG, &OurSharedID,
+			&ErrorReturned);
+	SuccessExpected(ErrorReturned, "DEFINE_SHARED_AREA");
+
+	for (Child = 0; Child < NUMBER_TEST50_CHILDREN; Child++) {
+		sprintf(ProcessName, "Test50_%d", Child);
+		CREATE_PROCESS(ProcessName, testF, ChildPriority, &ProcessID,
+				&ErrorReturned);
+		if (ErrorReturned != ERR_SUCCESS) {
+			aprintf("Test50 - CREATE_PROCESS of %s failed\n", ProcessName);
+			break;
+		}
+		ErrorReturned = ERR_SUCCESS;
+		while (ErrorReturned == ERR_SUCCESS) {
+			SLEEP(10);
+			GET_PROCESS_ID(ProcessName, &ReturnedPID, &ErrorReturned);
+		}
+		// The child left its times in the first two words
+		MEM_READ(0, &ReadWriteData);
+		SimulatedTime += ReadWriteData;
+		MEM_READ(4, &ReadWriteData);
+		HostTime += ReadWriteData;
+		SLEEP(TEST50_IDLE);
+	}
+
+	aprintf("Test50 - %d first touch page faults in %d processes\n", Faults,
+			NUMBER_TEST50_CHILDREN);
+	aprintf("Test50 - Simulated time: %ld total, %ld per fault\n",
+			SimulatedTime, SimulatedTime / Faults);
+	aprintf("Test50 - Host time: %ld microseconds total, %ld ns per fault\n",
+			HostTime, HostTime * 1000 / Faults);
+
+	GET_TIME_OF_DAY(&CurrentTime);
+	aprintf("TEST 50:   Ends at Time %ld\n", CurrentTime);
+	TERMINATE_PROCESS(-2, &ErrorReturned);
+}                                                     // End test50
+
+/**************************************************************************
+ testF - one child of test50.  Touch NUMBER_TEST50_PAGES new pages and
+ leave the simulated and host time taken in the shared area.
+ **************************************************************************/
+
+void testF(void) {
+	long ErrorReturned;
+	long OurSharedID;
+	long StartTime, EndTime;
+	clock_t HostStart, HostEnd;
+	INT32 ReadWriteData;
+	int Page;
+
+	DEFINE_SHARED_AREA(0L, 1L, (long)TEST50_AREA_TAG, &OurSharedID,
+			&ErrorReturned);
+	if (ErrorReturned != ERR_SUCCESS) {
+		aprintf("TestF - DEFINE_SHARED_AREA failed\n");
+		TERMINATE_PROCESS(-1, &ErrorReturned);
+	}
+
+	GET_TIME_OF_DAY(&StartTime);
+	HostStart = clock();
+	for (Page = 1; Page <= NUMBER_TEST50_PAGES; Page++) {
+		MEM_READ(Page * PGSIZE, &ReadWriteData);
+	}
+	HostEnd = clock();
+	GET_TIME_OF_DAY(&EndTime);
+
+	ReadWriteData = EndTime - StartTime;
+	MEM_WRITE(0, &ReadWriteData);
+	ReadWriteData = (INT32) ((HostEnd - HostStart) * 1000000 / CLOCKS_PER_SEC);
+	MEM_WRITE(4, &ReadWriteData);
+	TERMINATE_PROCESS(-1, &ErrorReturned);
+}                                                     // End testF
+
+/**************************************************************************
+ Test51 - Page out daemon and direct replacement on the same pages
+ Performs the following operations:
+ 1.  Format the swap disk.
+ 2.  Start children (testG) that each use one page more than they may
+ keep.  Run it as
+     os test51 rsmax=8
+ so a child at its limit replaces its own pages and waits for the write,
+ while the children together fill memory and the page out daemon writes
+ their pages in the background.  The same page is written both ways.
+ 3.  On every pass a child checks that each page still holds what it wrote
+ on the last pass and writes a new value.  Any page that comes back with
+ old data is reported.  On the first pass every page must read as zero.
+ **************************************************************************/
+
+#define           NUMBER_TEST51_CHILDREN       8
+#define           NUMBER_TEST51_PAGES          9
+#define           NUMBER_TEST51_PASSES        60
+
+void test51(void) {
+	long OurProcessID;
+	long ErrorReturned;
+	long ProcessID;
+	long ReturnedPID;
+	long CurrentTime;
+	long ChildPriority = 10;
+	char ProcessName[16];
+	int Child;
+
+	GET_PROCESS_ID("", &OurProcessID, &ErrorReturned);
+	aprintf("Release %s: test51: Pid %ld\n", TEST_VERSION, OurProcessID);
+
+	FORMAT(1, &ErrorReturned);
+	SuccessExpected(ErrorReturned, "FORMAT");
+
+	for (Child = 0; Child < NUMBER_TEST51_CHILDREN; Child++) {
+		sprintf(ProcessName, "Test51_%d", Child);
+		CREATE_PROCESS(ProcessName, testG, ChildPriority, &ProcessID,
+				&ErrorReturned);
+		SuccessExpected(ErrorReturned, "CREATE_PROCESS");
+	}
+
+	for (Child = 0; Child < NUMBER_TEST51_CHILDREN; Child++) {
+		sprintf(ProcessName, "Test51_%d", Child);
+		ErrorReturned = ERR_SUCCESS;
+		while (ErrorReturned == ERR_SUCCESS) {
+			SLEEP(100);
+			GET_PROCESS_ID(ProcessName, &ReturnedPID, &ErrorReturned);
+		}
+	}
+
+	GET_TIME_OF_DAY(&CurrentTime);
+	aprintf("TEST 51:   Ends at Time %ld\n", CurrentTime);
+	TERMINATE_PROCESS(-2, &ErrorReturned);
+}                                                     // End test51
+
+/**************************************************************************
+ testG - one child of test51.  Rewrite NUMBER_TEST51_PAGES pages
+ NUMBER_TEST51_PASSES times, checking each page before it is rewritten.
+ **************************************************************************/
+
+void testG(void) {
+	long OurProcessID;
+	long ErrorReturned;
+	INT32 ReadWriteData;
+	INT32 Expected;
+	int Pass;
+	int Page;
+	int Errors = 0;
+
+	GET_PROCESS_ID("", &OurProcessID, &ErrorReturned);
+
+	// The last pass only checks
+	for (Pass = 0; Pass <= NUMBER_TEST51_PASSES; Pass++) {
+		for (Page = 0; Page < NUMBER_TEST51_PAGES; Page++) {
+			MEM_READ(Page * PGSIZE, &ReadWriteData);
+			Expected = (OurProcessID << 16) + ((Pass - 1) << 8) + Page;
+			if (Pass == 0)
+				Expected = 0;
+			if (ReadWriteData != Expected) {
+				aprintf("Test51 - ERROR: Pid %ld page %d pass %d read %X "
+						"expected %X\n", OurProcessID, Page, Pass,
+						ReadWriteData, Expected);
+				Errors++;
+			}
+			if (Pass == NUMBER_TEST51_PASSES)
+				continue;
+			ReadWriteData = (OurProcessID << 16) + (Pass << 8) + Page;
+			MEM_WRITE(Page * PGSIZE, &ReadWriteData);
+		}
+	}
+	aprintf("Test51 - Pid %ld: %d passes over %d pages, %d errors\n",
+			OurProcessID, NUMBER_TEST51_PASSES, NUMBER_TEST51_PAGES, Errors);
+	TERMINATE_PROCESS(-1, &ErrorReturned);
+}                                                     // End testG
+
 /**************************************************************************
  TestS - test shared memory usage.
  This test runs as multiple instances of processes; there are several
@@ -2777,18 +3165,30 @@ void Test44_Statistics(long Pid, long PageNumber, int Mode) {
  in fault rates when using LRU as compared to random replacement.
 
  This code was rewritten in Release 4.31
+ Each process draws from its own stream, started from the hardware's
+ seed and the Pid, so the numbers a process sees don't depend on how
+ the processes are interleaved, and the same seed repeats a run.
  **************************************************************************/
 #define                 SKEWING_FACTOR          0.33
 #define                 MY_RAND_MAX             32767
+#define                 RANDOM_STREAMS          64
 void GetSkewedRandomNumber(long *ReturnedValue, long Pid, long range) {
-	static int FirstTime = TRUE;
+	static UINT32 StreamState[RANDOM_STREAMS];
+	static BOOL   StreamStarted[RANDOM_STREAMS];
+	UINT32 *State = &StreamState[Pid % RANDOM_STREAMS];
 	int RandomNumber;
 	double Multiplier = range / pow( range, SKEWING_FACTOR );
-	if (FirstTime) {
-		srand(time(NULL));
-		FirstTime = FALSE;
+	if (StreamStarted[Pid % RANDOM_STREAMS] == FALSE) {
+		*State = Z502RandomSeed() ^ ((UINT32) (Pid + 1) * 2654435761u);
+		if (*State == 0)
+			*State = 1;
+		StreamStarted[Pid % RANDOM_STREAMS] = TRUE;
 	}
-	RandomNumber = (range * (rand() % 32767)) / 32767;
+	// xorshift32 step
+	*State ^= *State << 13;
+	*State ^= *State >> 17;
+	*State ^= *State << 5;
+	RandomNumber = (range * ((*State >> 8) % MY_RAND_MAX)) / MY_RAND_MAX;
 	RandomNumber = (int) (Multiplier * pow(RandomNumber, SKEWING_FACTOR));
 
 	*ReturnedValue = RandomNumber;
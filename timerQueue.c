@@ -78,35 +78,116 @@ void GetTimeOfDay(long *TimeOfDay){
 }
 
 /*
-Looks at the Timer Queue and returns the wakeup time of the next item on
-the queue. If there is nothing else on the Timer Queue NextWakeUp is set
-to -1. This function can be used to test for the existance of any items 
-on the Timer Queue.
+Swap the elements at positions i and j of the Timer Queue heap, keeping
+their heap_index fields up to date.
 */
-void GetNextWakeUpTime(long* NextWakeUp){
-  
-  LockLocation(TIMER_LOCK);
+void SwapTimers(INT32 i, INT32 j){
+
+  TQ_ELEMENT *Temp = TimerHeap[i];
+
+  TimerHeap[i] = TimerHeap[j];
+  TimerHeap[j] = Temp;
+  TimerHeap[i]->heap_index = i;
+  TimerHeap[j]->heap_index = j;
+}
+
+/*
+Move the element at Index toward the top of the heap until its parent
+wakes up no later than it does.
+*/
+void SiftTimerUp(INT32 Index){
+
+  INT32 Parent;
+
+  while(Index > 0){
+    Parent = (Index - 1) / 2;
+    if(TimerHeap[Parent]->wakeup_time <= TimerHeap[Index]->wakeup_time){
+      break;
+    }
+    SwapTimers(Parent, Index);
+    Index = Parent;
+  }
+}
+
+/*
+Move the element at Index toward the bottom of the heap until both its
+children wake up no earlier than it does.
+*/
+void SiftTimerDown(INT32 Index){
+
+  INT32 Child;
+
+  while(2*Index + 1 < TimerCount){
+    Child = 2*Index + 1;
+    if(Child + 1 < TimerCount &&
+       TimerHeap[Child + 1]->wakeup_time < TimerHeap[Child]->wakeup_time){
+      Child++;
+    }
+    if(TimerHeap[Index]->wakeup_time <= TimerHeap[Child]->wakeup_time){
+      break;
+    }
+    SwapTimers(Index, Child);
+    Index = Child;
+  }
+}
 
-  //Look for something on Timer Queue
-  TQ_ELEMENT* tqe = QNextItemInfo(timer_queue_id);
+/*
+Take the element at Index out of the heap and return it. The PCB no
+longer points at it. TIMER_LOCK must be held.
+*/
+TQ_ELEMENT* RemoveTimerAt(INT32 Index){
+
+  TQ_ELEMENT *tqe = TimerHeap[Index];
 
-  if((long)tqe != -1){ //There is another element on the Timer Queue
-      (*NextWakeUp) = tqe->wakeup_time;
+  TimerCount--;
+  if(Index != TimerCount){
+    TimerHeap[Index] = TimerHeap[TimerCount];
+    TimerHeap[Index]->heap_index = Index;
+    SiftTimerDown(Index);
+    SiftTimerUp(Index);
   }
-  else{   //Nothing on Timer Queue
-    (*NextWakeUp) = -1;
+  TimerHeap[TimerCount] = NULL;
+  ((PROCESS_CONTROL_BLOCK *)tqe->PCB)->timer = NULL;
+
+  return tqe;
+}
+
+/*
+Make sure the hardware timer goes off by Deadline. If it is already set
+to go off no later than that it is left alone. Restarting it makes the
+hardware take its event off the event list and put it back. TIMER_LOCK
+must be held.
+*/
+void ArmTimer(long Deadline, long CurrentTime){
+
+  MEMORY_MAPPED_IO mmio;
+
+  if(ArmedDeadline != -1 && ArmedDeadline <= Deadline){
+    TimerArmsAvoided++;
+    return;
   }
+  ArmedDeadline = Deadline;
+  TimerArms++;
 
-  UnlockLocation(TIMER_LOCK);
- 
+  mmio.Mode = Z502Start;
+  mmio.Field1 = Deadline - CurrentTime;
+  mmio.Field2 = mmio.Field3 = mmio.Field4 = 0;
+  MEM_WRITE(Z502Timer, &mmio);
+
+  //check return of start timer
+  if(mmio.Field4 != ERR_SUCCESS){
+    aprintf("\n\nError: Starting the timer\n\n");
+  }
 }
 
 /*
 Create a TQ_ELEMENT (Timer Queue Element) with given context and wakeup 
-time and add to the timer queue. Note that Timer Queue is organized by 
-wakeup time. The earliest times are on the head of the queue.
+time and add it to the timer queue. The earliest wakeup time is always
+at the top of the heap. The PCB keeps the element as the handle used
+to cancel the timer.
 */
-void AddTimerToQueue(long Context, long WakeupTime, void* PCB){
+void AddTimerToQueue(long Context, long WakeupTime, long CurrentTime,
+		     void* PCB){
 
   TQ_ELEMENT* tqe = malloc(sizeof(TQ_ELEMENT));
   tqe->context = Context;
@@ -115,24 +196,41 @@ void AddTimerToQueue(long Context, long WakeupTime, void* PCB){
   tqe->PCB = PCB;
 
   LockLocation(TIMER_LOCK);
-  //Enque by wakeup time. This ensures that the soonest element comes
-  //off the queue first.
-  QInsert(timer_queue_id, (unsigned int)WakeupTime, (void*)tqe);
+  if(TimerCount == TIMER_HEAP_SIZE){
+    UnlockLocation(TIMER_LOCK);
+    aprintf("\n\nERROR: Timer Queue is full\n\n");
+    free(tqe);
+    return;
+  }
+  tqe->heap_index = TimerCount;
+  TimerHeap[TimerCount] = tqe;
+  TimerCount++;
+  ((PROCESS_CONTROL_BLOCK *)PCB)->timer = tqe;
+  SiftTimerUp(tqe->heap_index);
+
+  //This has to happen after the timer is on the heap or a short sleep
+  //can end before there is anything to wake. The hardware is only
+  //restarted if this timer is due before it would go off.
+  ArmTimer(WakeupTime, CurrentTime);
   UnlockLocation(TIMER_LOCK);
 }
 
-
 /*
-Remove a TQ_ELEMENT (Timer Queue Element) from the head of the Timer
- Queue. Return a pointer to this element.
+Take the timer of pcb off the Timer Queue if it has one. The hardware
+timer is left alone. If it goes off early the interrupt just finds
+nothing due and restarts it.
 */
-TQ_ELEMENT* RemoveTimerFromQueue(){
-  
+void CancelTimer(PROCESS_CONTROL_BLOCK *pcb){
+
+  TQ_ELEMENT *tqe = NULL;
+
   LockLocation(TIMER_LOCK);
-  TQ_ELEMENT* tqe = (TQ_ELEMENT *)QRemoveHead(timer_queue_id);
+  if(pcb->timer != NULL){
+    tqe = RemoveTimerAt(((TQ_ELEMENT *)pcb->timer)->heap_index);
+  }
   UnlockLocation(TIMER_LOCK);
 
-  return tqe;
+  free(tqe);
 }
   
 /*
@@ -143,7 +241,6 @@ are enqueued based on their wakeup times.
 void StartTimer(long SleepTime){
 
   long CurrentTime;
-  MEMORY_MAPPED_IO mmio; 
 
   long context = osGetCurrentContext();
   GetTimeOfDay(&CurrentTime);
@@ -151,35 +248,9 @@ void StartTimer(long SleepTime){
   //set the wakeup time
   long wakeup_time = CurrentTime + SleepTime;
 
-  //Check to see if Timer is busy
-  long NextWakeUp;
-  GetNextWakeUpTime(&NextWakeUp);
-
-  //No more items on Timer Queue.
-  if(NextWakeUp == -1){
-     // Start the timer 
-    mmio.Mode = Z502Start;
-    mmio.Field1 = SleepTime;   
-    mmio.Field2 = mmio.Field3 =mmio.Field4 = 0;
-    MEM_WRITE(Z502Timer, &mmio);
-  }
-  else{
-    if(NextWakeUp > wakeup_time){
-      // Start the timer 
-      mmio.Mode = Z502Start;
-      mmio.Field1 = SleepTime;   
-      mmio.Field2 = mmio.Field3 =mmio.Field4 = 0;
-      MEM_WRITE(Z502Timer, &mmio);
-
-      //check return of start timer
-      if(mmio.Field4 != ERR_SUCCESS){
-	printf("\n\nError: Starting the timer\n\n");
-      }
-    }
-  }//don't need to restart if new wakeup time is after NextWakeUp
-
-  //add tqe to the timer queue
-  AddTimerToQueue(context, wakeup_time, GetCurrentPCB());
+  //add tqe to the timer queue, restarting the timer if it is now the
+  //soonest
+  AddTimerToQueue(context, wakeup_time, CurrentTime, GetCurrentPCB());
 
   long PID = GetCurrentPID();
   //set process state to TIMER
@@ -191,18 +262,37 @@ void StartTimer(long SleepTime){
 }
 
 /*
-Remove the first element of the Timer Queue. Check to see if the Timer needs to be reset. If there is another process with only a brief amount of time until its wake up time it is also put on the Ready Queue.
+Take every timer due within TimerSlack off the Timer Queue in one pass
+and restart the hardware timer once for the next one left. The
+processes are then put on the Ready Queue, or SUSPENDED if they were
+suspended while asleep.
 */
 void HandleTimerInterrupt(){
 
-  MEMORY_MAPPED_IO mmio;
-  INT32 RemoveAgain;
+  TQ_ELEMENT *Expired[TIMER_HEAP_SIZE];
+  INT32 ExpiredCount = 0;
   long CurrentTime;
-  long WakeTime;
-    
-  do{
 
-    TQ_ELEMENT* tq = RemoveTimerFromQueue();
+  GetTimeOfDay(&CurrentTime);
+
+  LockLocation(TIMER_LOCK);
+  //The timer has gone off so it is no longer running
+  ArmedDeadline = -1;
+  TimerInterrupts++;
+  while(TimerCount > 0 &&
+	TimerHeap[0]->wakeup_time - CurrentTime <= TimerSlack){
+    Expired[ExpiredCount] = RemoveTimerAt(0);
+    ExpiredCount++;
+  }
+  TimersExpired = TimersExpired + ExpiredCount;
+  if(TimerCount > 0){
+    ArmTimer(TimerHeap[0]->wakeup_time, CurrentTime);
+  }
+  UnlockLocation(TIMER_LOCK);
+
+  for(INT32 i=0; i<ExpiredCount; i++){
+
+    TQ_ELEMENT* tq = Expired[i];
     PROCESS_CONTROL_BLOCK *RemovedProcess = tq->PCB;
 
     /*
@@ -218,52 +308,31 @@ void HandleTimerInterrupt(){
     else{
 	AddToReadyQueue(tq->context, tq->PID, tq->PCB, TRUE);
     }
- 
-    //Check for another timer on the Queue
-    TQ_ELEMENT* next_timer = (TQ_ELEMENT*) QNextItemInfo(timer_queue_id);
-
-    //no more processes on the Timer Queue
-    if((long)next_timer == -1){
-      RemoveAgain = FALSE;
-    }
-    //There is another process of Timer Queue
-    else{
-      GetTimeOfDay(&CurrentTime);
-
-      WakeTime = next_timer->wakeup_time;
-
-      if(WakeTime - CurrentTime > 10){
-	//reset timer 
-	mmio.Mode = Z502Start;
-	mmio.Field1 = WakeTime - CurrentTime;   
-	mmio.Field2 = mmio.Field3 = 0;
-	MEM_WRITE(Z502Timer, &mmio);
-
-	//check return of start timer
-	if(mmio.Field4 != ERR_SUCCESS){
-	  printf("Error starting the timer\n\n");
-	}
-	RemoveAgain = FALSE;
-      }
-      else{ //WakeTime - Current <= 10
-	RemoveAgain = TRUE;
-      }
-    }
-  }while(RemoveAgain == TRUE);
-  
-  
+    free(tq);
+  }
 }
 
 /*
-This function uses the Queue Manager functions to create a queue for the
-processes that are waiting on the timer.
+Start with an empty Timer Queue.
 */ 
 void CreateTimerQueue(){
-  timer_queue_id = QCreate("TQueue");
-  if(timer_queue_id == -1){
-    aprintf("\n\nError: Unable to create Timer Queue!\n\n");
+
+  TimerCount = 0;
+  ArmedDeadline = -1;
+  for(INT32 i=0; i<TIMER_HEAP_SIZE; i++){
+    TimerHeap[i] = NULL;
   }
 }
 
+/*
+Print the timer statistics for the run if the timer was used.
+*/
+void PrintTimerStats(){
 
-
+  if(TimerArms == 0){
+    return;
+  }
+  aprintf("\nTimer Interrupts: %d  Timers Expired: %d  Timer Starts: %d  "
+	  "Starts Avoided: %d\n", TimerInterrupts, TimersExpired, TimerArms,
+	  TimerArmsAvoided);
+}
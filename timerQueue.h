@@ -10,12 +10,40 @@ This file is the include file for everything to do with the timer queue.
 #include "global.h"
 #include "osGlobals.h"
 
+/*
+The Timer Queue is a binary min-heap of TQ_ELEMENTs ordered by wakeup
+time. A process is on it at most once, so it never holds more than
+MAXPROCESSES elements. Each element remembers where it sits in the heap
+and the PCB points at its element, so a timer can be cancelled without
+searching for it. On a timer interrupt every timer due within TimerSlack
+is expired together. TimerSlack is set with the timerslack=N option.
+*/
+#define TIMER_HEAP_SIZE MAXPROCESSES
+#define DEFAULT_TIMER_SLACK 10
+#define MAX_TIMER_SLACK 1000
+
+TQ_ELEMENT* TimerHeap[TIMER_HEAP_SIZE];
+INT32 TimerCount;
+INT32 TimerSlack;
+
+//The OS remembers the time the hardware timer is set to go off at, or
+//-1 if it isn't running. The hardware is only restarted when a timer
+//is due before that. A later timer waits for the interrupt to come.
+long ArmedDeadline;
+
+//Timer statistics
+INT32 TimerInterrupts;
+INT32 TimersExpired;
+INT32 TimerArms;            //times the hardware timer was started
+INT32 TimerArmsAvoided;     //restarts skipped as the timer was set sooner
 
 void LockLocation(INT32 lock);
 void UnlockLocation(INT32 lock);
 void GetTimeOfDay(long *TimeOfDay);
 void StartTimer(long SleepTime);
 void HandleTimerInterrupt();
+void CancelTimer(PROCESS_CONTROL_BLOCK *pcb);
+void PrintTimerStats();
 void CreateTimerQueue();
 
 #endif //TIMER_QUEUE_H
@@ -0,0 +1,157 @@
+#!/usr/bin/env python3
+#
+# traceToJson.py
+#
+# Convert the binary trace the Z502 writes at halt (run the os with
+# trace=on) into Chrome trace / Perfetto JSON. Open the result in
+# chrome://tracing or https://ui.perfetto.dev.
+#
+#   ./traceToJson.py [TraceData] [trace.json]
+#
+# One simulated time unit is shown as one microsecond. Every hardware
+# thread gets a track; thread 1 is the interrupt thread. System calls
+# are spans on the thread that made them, disk requests are spans on a
+# track per disk and everything else is an instant event.
+
+import argparse
+import json
+import os
+import re
+import struct
+import sys
+
+HEADER = struct.Struct("=8sIII")
+RECORD = struct.Struct("=Ihhiii")
+
+TRACE_DISPATCH = 1
+TRACE_CONTEXT_SWITCH = 2
+TRACE_SVC_ENTER = 3
+TRACE_SVC_EXIT = 4
+TRACE_FAULT = 5
+TRACE_DISK_READ = 6
+TRACE_DISK_WRITE = 7
+TRACE_DISK_DONE = 8
+TRACE_TIMER_ARM = 9
+TRACE_TIMER_FIRE = 10
+
+FAULT_NAMES = {2: "Invalid Memory", 3: "Invalid Physical Memory",
+               4: "Privileged Instruction"}
+SWITCH_NAMES = {0: "suspend", 1: "start", 2: "start and suspend"}
+
+
+def system_call_names():
+    """Read the SYSNUM_ names from syscalls.h next to this script."""
+    names = {}
+    path = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                        "syscalls.h")
+    try:
+        with open(path) as header:
+            for line in header:
+                match = re.match(r"\s*#define\s+SYSNUM_(\w+)\s+(\d+)", line)
+                if match:
+                    names[int(match.group(2))] = match.group(1)
+    except OSError:
+        pass
+    return names
+
+
+def read_trace(path):
+    try:
+        with open(path, "rb") as trace:
+            data = trace.read()
+    except OSError as error:
+        sys.exit("Can't read %s: %s" % (path, error.strerror))
+    if len(data) < HEADER.size:
+        sys.exit("%s is not a Z502 trace" % path)
+    magic, version, record_size, count = HEADER.unpack_from(data, 0)
+    if magic.rstrip(b"\0") != b"Z502TRC" or version != 1:
+        sys.exit("%s is not a Z502 trace" % path)
+    if record_size != RECORD.size:
+        sys.exit("%s has %d byte records, expected %d"
+                 % (path, record_size, RECORD.size))
+    records = []
+    for i in range(count):
+        records.append(RECORD.unpack_from(data,
+                                          HEADER.size + i * RECORD.size))
+    return records
+
+
+def convert(records):
+    syscalls = system_call_names()
+    events = []
+    threads = set()
+    disks = {}
+
+    # Records come ring by ring; the time order matters for the spans
+    records.sort(key=lambda r: r[0])
+    for time, thread, kind, pid, arg1, arg2 in records:
+        threads.add(thread)
+        event = {"pid": 0, "tid": thread, "ts": time,
+                 "args": {"pid": pid}}
+        if kind == TRACE_SVC_ENTER or kind == TRACE_SVC_EXIT:
+            event["ph"] = "B" if kind == TRACE_SVC_ENTER else "E"
+            event["name"] = syscalls.get(arg1, "SVC %d" % arg1)
+            event["cat"] = "svc"
+        elif kind == TRACE_DISK_READ or kind == TRACE_DISK_WRITE:
+            name = "read" if kind == TRACE_DISK_READ else "write"
+            disks[arg1] = name
+            event.update(ph="b", cat="disk", id=arg1,
+                         name="Disk %d %s" % (arg1, name))
+            event["args"]["sector"] = arg2
+        elif kind == TRACE_DISK_DONE:
+            if arg1 not in disks:
+                continue
+            event.update(ph="e", cat="disk", id=arg1,
+                         name="Disk %d %s" % (arg1, disks.pop(arg1)))
+            event["args"]["error"] = arg2
+        else:
+            event.update(ph="i", s="t")
+            if kind == TRACE_DISPATCH:
+                event.update(cat="sched", name="Dispatch %d" % pid)
+                event["args"]["from"] = arg1
+            elif kind == TRACE_CONTEXT_SWITCH:
+                event.update(cat="sched", name="Switch to %d" % arg1)
+                event["args"]["how"] = SWITCH_NAMES.get(arg2, arg2)
+            elif kind == TRACE_FAULT:
+                event.update(cat="fault",
+                             name=FAULT_NAMES.get(arg1, "Fault %d" % arg1))
+                event["args"]["argument"] = arg2
+            elif kind == TRACE_TIMER_ARM:
+                event.update(cat="timer", name="Timer arm")
+                event["args"].update(delay=arg1, deadline=arg2)
+            elif kind == TRACE_TIMER_FIRE:
+                event.update(cat="timer", name="Timer fire")
+                event["args"]["due"] = arg1
+            else:
+                event.update(cat="unknown", name="Kind %d" % kind)
+        events.append(event)
+
+    events.append({"ph": "M", "pid": 0, "name": "process_name",
+                   "args": {"name": "Z502"}})
+    for thread in sorted(threads):
+        name = "Interrupt" if thread == 1 else "Thread %d" % thread
+        events.append({"ph": "M", "pid": 0, "tid": thread,
+                       "name": "thread_name", "args": {"name": name}})
+    return {"traceEvents": events, "displayTimeUnit": "ms"}
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Convert a Z502 binary trace (written at halt when the "
+                    "os is run with trace=on) into Chrome trace / Perfetto "
+                    "JSON.")
+    parser.add_argument("source", nargs="?", default="TraceData",
+                        help="binary trace to read (default: TraceData)")
+    parser.add_argument("target", nargs="?", default="trace.json",
+                        help="JSON file to write (default: trace.json)")
+    args = parser.parse_args()
+
+    records = read_trace(args.source)
+    with open(args.target, "w") as output:
+        json.dump(convert(records), output)
+    print("%d records from %s written to %s"
+          % (len(records), args.source, args.target))
+
+
+if __name__ == "__main__":
+    main()
@@ -68,6 +68,7 @@
 #include                 <stdlib.h>
 #include                 <memory.h>
 #include                 <math.h>
+#include                 <time.h>
 #ifdef WINDOWS
 #include                 <windows.h>
 #include                 <winbase.h>
@@ -105,6 +106,13 @@
 void AddEventToInterruptQueue(INT32, INT16, INT16, EVENT **);
 void AssociateContextWithProcess(Z502CONTEXT *Context);
 void ChargeTimeAndCheckEvents(INT32);
+int RunningClockIndex(void);
+void AdvanceGlobalClock(UINT32 NewTime);
+void SynchronizeGlobalClock(void);
+UINT32 ProcessorTime(void);
+void AdvanceProcessorClock(UINT32 NewTime);
+void StartProcessorClock(int Index);
+void StopProcessorClock(int Index);
 int CreateAThread(void *ThreadStartAddress, INT32 *data);
 void CreateLock(INT32 *, char *CallingRoutine);
 void CreateCondition(UINT32 *);
@@ -118,6 +126,7 @@ int GetLock(UINT32 RequestedMutex, char *CallingRoutine);
 INT16 GetMode(char *CallerLocation);
 void GetNextEventTime(INT32 *);
 UINT16 *GetPageTableAddress();
+UINT16 *GetPageTableEntry(INT16 VirtualPageNumber);
 int GetProcessorID();
 void GetProcessTimeUsage( unsigned long long *,
 		          unsigned long long *,
@@ -136,14 +145,40 @@ void HardwareReadDisk(INT16, INT16, char *);
 void HardwareWriteDisk(INT16, INT16, char *);
 void HardwareCheckDisk(int DiskID);
 void HardwareInterrupt(void);
+void SignalDueEvents(char *CallingRoutine);
+void PostDueEvents(char *CallingRoutine);
+void RunDueInterrupts(void);
+void WaitForDueEvent(void);
+void LogDeviceEvent(INT32, INT16, INT16);
+void SetDeterministicMode(UINT32, INT32, char *);
+void CloseEventLog(void);
+int ThreadTableIndex(void);
+void TraceEvent(INT16, INT32, INT32, INT32);
+void TraceContextSwitch(Z502CONTEXT *, BOOL);
+INT32 CurrentTracePid(void);
+void DumpTrace(void);
+void AtomicAdd64(volatile INT64 *, INT64);
+void AtomicExtreme64(volatile INT64 *, INT64, BOOL);
+int HistogramBucket(INT64);
+INT64 HistogramLimit(int);
+INT64 HistogramPercentile(STATISTIC *, INT32);
+void SetStatistic(char *, INT64);
+void PublishHardwareStats(void);
+void WriteStatisticsJson(FILE *);
+void WriteStatisticsCsv(FILE *);
+void ExportStatistics(INT32);
+void CompleteDeviceEvent(INT32 time_of_event, INT16 event_type,
+        INT16 event_error);
+void PostDeviceEvent(INT16 event_type, INT16 event_error);
 void HardwareFault(INT16, INT16);
 void HardwareInternalPanic(INT32);
 void IdleSimulation();
 void MakeContext(long *ReturningContextPointer, long starting_address,
-		UINT16* PageTable, BOOL user_or_kernel);
+		UINT16* PageTable, BOOL user_or_kernel, BOOL sparse);
 void MemoryCommon(INT32, char *, BOOL);
 void PhysicalMemoryCommon(INT32, char *, BOOL);
 void MemoryMappedIO(INT32, MEMORY_MAPPED_IO *, BOOL);
+BOOL IsConfigurationWrite(INT32, MEMORY_MAPPED_IO *, BOOL);
 void PrintRingBuffer(void);
 void PrintHardwareStats(void);
 void PrintEventQueue();
@@ -197,7 +232,7 @@ INT16 Z502_CURRENT_NUMBER_OF_PROCESSORS = 1;
 
  *****************************************************************/
 INT16 Z502Initialized = FALSE;
-UINT32 CurrentSimulationTime = 0;
+volatile UINT32 CurrentSimulationTime = 0;
 unsigned long long StartUserMicrosecs, 
 	               StartSystemMicrosecs,
 		           StartWallClockMicrosecs;
@@ -214,6 +249,31 @@ SECTOR sector_queue[MAX_NUMBER_OF_DISKS ];
 DISK_STATE DiskState[MAX_NUMBER_OF_DISKS ];
 TIMER_STATE timer_state;
 HARDWARE_STATS HardwareStats;
+BOOL InterruptBatching = FALSE;
+COMPLETION_RING CompletionRing[LARGEST_STAT_VECTOR_INDEX + 1];
+
+// In deterministic mode the interrupt thread only runs while the
+// processor waits for it.  RandomSeed feeds the random numbers the
+// test programs use.
+BOOL DeterministicMode = FALSE;
+UINT32 RandomSeed = 0;
+INT32 EventLogMode = EVENT_LOG_OFF;
+FILE *EventLogFile = NULL;
+
+// The binary trace.  Ring i belongs to the thread in ThreadTable[i].
+BOOL TracingEnabled = FALSE;
+TRACE_RING TraceRing[MAX_THREAD_TABLE_SIZE];
+
+// The statistics registry.  StatisticsAtHalt holds the STATS_ formats
+// to write when the simulation halts and StatisticsExported the ones
+// that have been written.
+STATISTIC Statistics[MAX_STATISTICS];
+volatile INT32 NumberOfStatistics = 0;
+INT32 StatisticsLock = -1;
+INT32 StatisticsAtHalt = 0;
+INT32 StatisticsExported = 0;
+INT32 FaultServiceStat = -1;
+INT32 InterruptLatencyStat = -1;
 
 RING_EVENT EventRingBuffer[EVENT_RING_BUFFER_SIZE];
 INT32 InterlockRecord[MEMORY_INTERLOCK_SIZE];
@@ -242,6 +302,16 @@ pthread_mutex_t LocalMutex[300];
 //pthread_cond_t LocalCondition[100];
 sem_t          *Semaphore[100];
 int            NextMutexToAllocate = 0;
+// The interrupt thread sleeps on InterruptDueCondition until
+// InterruptWakeupsPending is nonzero.  Each event adds one to it the
+// first time it is found due.
+pthread_mutex_t InterruptDueMutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t  InterruptDueCondition = PTHREAD_COND_INITIALIZER;
+INT32          InterruptWakeupsPending = 0;
+// In deterministic mode a processor waits on InterruptIdleCondition
+// until the interrupt thread has nothing left to do.
+pthread_cond_t  InterruptIdleCondition = PTHREAD_COND_INITIALIZER;
+BOOL           InterruptThreadIdle = TRUE;
 #endif
 
 /*****************************************************************
@@ -272,6 +342,11 @@ void MemoryCommon(INT32 VirtualAddress, char *data_ptr, BOOL read_or_write) {
     char Debug_Text[32];
 
     strcpy(Debug_Text, "MemoryCommon");
+    // A user program holds no locks, so this is a safe place to let
+    // due interrupts run in a deterministic simulation.
+    if (VirtualAddress < Z502MEM_MAPPED_MIN
+            && GetMode("MemoryCommon") == USER_MODE)
+        RunDueInterrupts();
     GetLock(HardwareLock, "MemoryCommon#1");
     // Addresses above a certain value are assumed to be accessing
     // hardware and so we then go to MemoryMappedIO to handle them.
@@ -310,8 +385,9 @@ void MemoryCommon(INT32 VirtualAddress, char *data_ptr, BOOL read_or_write) {
         if ( (PageOffset % 4 ) != 0 )
             Invalidity = 4;
         if ((Invalidity == 0)
-                && (GetPageTableAddress()[(UINT16) VirtualPageNumber]
-                        & PTBL_VALID_BIT) == 0)
+                && (GetPageTableEntry(VirtualPageNumber) == NULL
+                 || (*GetPageTableEntry(VirtualPageNumber)
+                        & PTBL_VALID_BIT) == 0))
             Invalidity = 5;
 
         DoMemoryDebug(Invalidity, VirtualPageNumber);
@@ -334,7 +410,7 @@ void MemoryCommon(INT32 VirtualAddress, char *data_ptr, BOOL read_or_write) {
              PageIsValid = TRUE;
     } /* END of while         */
 
-    PhysicalFrameNumber = GetPageTableAddress()[VirtualPageNumber] & PTBL_PHYS_PG_NO;
+    PhysicalFrameNumber = *GetPageTableEntry(VirtualPageNumber) & PTBL_PHYS_PG_NO;
     PhysicalAddress[0] = (INT16) (PhysicalFrameNumber * (INT32) PGSIZE + PageOffset);
     PhysicalAddress[1] = PhysicalAddress[0] + 1; /* first guess */
     PhysicalAddress[2] = PhysicalAddress[0] + 2; /* first guess */
@@ -405,9 +481,9 @@ void MemoryCommon(INT32 VirtualAddress, char *data_ptr, BOOL read_or_write) {
         PageTableBits = PTBL_REFERENCED_BIT | PTBL_MODIFIED_BIT;
     }
 
-    GetPageTableAddress()[VirtualPageNumber] |= PageTableBits;
+    *GetPageTableEntry(VirtualPageNumber) |= PageTableBits;
     if (PageOffset > PGSIZE - 4)
-        GetPageTableAddress()[VirtualPageNumber + 1] |= PageTableBits;
+        *GetPageTableEntry(VirtualPageNumber + 1) |= PageTableBits;
 
     ChargeTimeAndCheckEvents(COST_OF_MEMORY_ACCESS);
 
@@ -521,6 +597,28 @@ void Z502MemoryReadModify(INT32 VirtualAddress, INT32 NewLockValue,
 
 }             // End  Z502MemoryReadModify
 
+/*************************************************************************
+ IsConfigurationWrite()
+
+ A write that only sets up how the hardware runs, rather than asking a
+ device to do something.  These charge no time, so a run is the same
+ with or without the options that make them.
+ *************************************************************************/
+
+BOOL IsConfigurationWrite(INT32 address, MEMORY_MAPPED_IO *mmio,
+        BOOL ReadOrWrite) {
+    if (address != Z502InterruptDevice || ReadOrWrite != SYSNUM_MEM_WRITE)
+        return FALSE;
+    switch (mmio->Mode) {
+    case Z502SetInterruptBatching:
+    case Z502SetDeterministicMode:
+    case Z502SetTracing:
+    case Z502ExportStatistics:
+        return TRUE;
+    }
+    return FALSE;
+}                 // End of IsConfigurationWrite
+
 /*************************************************************************
  MemoryMappedIO
 
@@ -546,7 +644,8 @@ void MemoryMappedIO(INT32 address, MEMORY_MAPPED_IO *mmio, BOOL ReadOrWrite) {
         HardwareFault(PRIVILEGED_INSTRUCTION, 0);
         return;
     }
-    ChargeTimeAndCheckEvents(COST_OF_MEMORY_MAPPED_IO);
+    if (IsConfigurationWrite(address, mmio, ReadOrWrite) == FALSE)
+        ChargeTimeAndCheckEvents(COST_OF_MEMORY_MAPPED_IO);
 
     // Switch off the IO Function that the user has defined when
     // doing the memory request
@@ -580,6 +679,22 @@ void MemoryMappedIO(INT32 address, MEMORY_MAPPED_IO *mmio, BOOL ReadOrWrite) {
                 && (mmio->Mode == Z502GetInterruptInfo)) {
             mmio->Field1 = -1;
             Temporary = 1;
+            // Batched events wait on the completion rings.  Only the
+            // interrupt thread posts to them and takes from them.
+            if (InterruptBatching == TRUE && GetMyTid() == InterruptTid) {
+                for (index = 0; index <= LARGEST_STAT_VECTOR_INDEX; index++) {
+                    if (CompletionRing[index].head != CompletionRing[index].tail) {
+                        mmio->Field1 = index;                     // Device ID
+                        mmio->Field2 = CompletionRing[index].status[
+                                CompletionRing[index].head % COMPLETION_RING_SIZE];
+                        CompletionRing[index].head++;
+                        mmio->Field4 = ERR_SUCCESS;
+                        break;
+                    }
+                }
+                if (mmio->Field1 != -1)
+                    break;
+            }
             // We want to find the target device and assure that it was activated by
             // the thread that's now looking for it.  This means that if a thread
             // took a memory fault, that it will be THAT thread in the OS fault
@@ -606,6 +721,54 @@ void MemoryMappedIO(INT32 address, MEMORY_MAPPED_IO *mmio, BOOL ReadOrWrite) {
             }
             break;
         }
+        // The OS can ask for device events to be batched.  Field1 is
+        // TRUE or FALSE.
+        if ((ReadOrWrite == SYSNUM_MEM_WRITE)
+                && (mmio->Mode == Z502SetInterruptBatching)) {
+            InterruptBatching = (mmio->Field1 != FALSE);
+            mmio->Field4 = ERR_SUCCESS;
+            break;
+        }
+        // The OS can ask for a deterministic simulation.  Field1 is the
+        // seed (0 keeps the one the hardware picked), Field2 is one of
+        // the EVENT_LOG_ modes and Field3 points at a string naming the
+        // options that change the timing of the run, or is 0.
+        if ((ReadOrWrite == SYSNUM_MEM_WRITE)
+                && (mmio->Mode == Z502SetDeterministicMode)) {
+            if (mmio->Field2 < EVENT_LOG_OFF
+                    || mmio->Field2 > EVENT_LOG_REPLAY) {
+                mmio->Field4 = ERR_BAD_PARAM;
+                break;
+            }
+            SetDeterministicMode((UINT32) mmio->Field1, (INT32) mmio->Field2,
+                    (char *) mmio->Field3);
+            mmio->Field4 = ERR_SUCCESS;
+            break;
+        }
+        // The OS can turn on the binary trace.  Field1 is TRUE or FALSE.
+        if ((ReadOrWrite == SYSNUM_MEM_WRITE)
+                && (mmio->Mode == Z502SetTracing)) {
+            TracingEnabled = (mmio->Field1 != FALSE);
+            mmio->Field4 = ERR_SUCCESS;
+            break;
+        }
+        // The OS can have the statistics written out.  Field1 holds the
+        // STATS_ formats and Field2 is STATS_EXPORT_NOW or _AT_HALT.
+        if ((ReadOrWrite == SYSNUM_MEM_WRITE)
+                && (mmio->Mode == Z502ExportStatistics)) {
+            if ((mmio->Field1 & ~(STATS_JSON | STATS_CSV)) != 0
+                    || (mmio->Field2 != STATS_EXPORT_NOW
+                            && mmio->Field2 != STATS_EXPORT_AT_HALT)) {
+                mmio->Field4 = ERR_BAD_PARAM;
+                break;
+            }
+            if (mmio->Field2 == STATS_EXPORT_NOW)
+                ExportStatistics((INT32) mmio->Field1);
+            else
+                StatisticsAtHalt = (INT32) mmio->Field1;
+            mmio->Field4 = ERR_SUCCESS;
+            break;
+        }
         // We want to clear the interrupt status of the device we were working with
         // The code for Z502ClearInterruptStatus was removed in Rev 4.40
         if (Temporary == 0) {
@@ -721,12 +884,20 @@ void MemoryMappedIO(INT32 address, MEMORY_MAPPED_IO *mmio, BOOL ReadOrWrite) {
 
         if (mmio->Mode == Z502InitializeContext) {
             MakeContext(&LongTemporary, mmio->Field2, (UINT16 *) mmio->Field3,
-            KERNEL_MODE);
+            KERNEL_MODE, FALSE);
             mmio->Field1 = LongTemporary;    // Context pointer
             mmio->Field4 = ERR_SUCCESS;      // Error code
             break;
         }  // End of Mode == InitializeContext
 
+        if (mmio->Mode == Z502InitializeSparseContext) {
+            MakeContext(&LongTemporary, mmio->Field2, (UINT16 *) mmio->Field3,
+            KERNEL_MODE, TRUE);
+            mmio->Field1 = LongTemporary;    // Context pointer
+            mmio->Field4 = ERR_SUCCESS;      // Error code
+            break;
+        }  // End of Mode == InitializeSparseContext
+
         if (mmio->Mode == Z502GetPageTable) {
             mmio->Field1 = (long) GetPageTableAddress();
             mmio->Field4 = ERR_SUCCESS;      // Error code
@@ -882,6 +1053,7 @@ void HardwareReadDisk(INT16 disk_id, INT16 sector, char *buffer_ptr) {
         HardwareFault(PRIVILEGED_INSTRUCTION, 0);
         return;
     }
+    TraceEvent(TRACE_DISK_READ, CurrentTracePid(), disk_id, sector);
     // This SHOULD have been checked in MemoryMappedIO
     if (disk_id < 0 || disk_id >= MAX_NUMBER_OF_DISKS) {
         disk_id = 0; /* To aim at legal vector  */
@@ -920,11 +1092,11 @@ void HardwareReadDisk(INT16 disk_id, INT16 sector, char *buffer_ptr) {
         //memcpy(buffer_ptr, sector_ptr, PGSIZE);   // Bugfix 07/2014
         DiskState[disk_id].Destination = buffer_ptr;
         DiskState[disk_id].Source = sector_ptr;
-        access_time = CurrentSimulationTime + 100
+        access_time = ProcessorTime() + 100
                 + abs(DiskState[disk_id].LastSector - sector) / 20;
         HardwareStats.DiskReads[disk_id]++;
         HardwareStats.DiskBusyTime[disk_id] += access_time
-                - CurrentSimulationTime;
+                - ProcessorTime();
         if (DO_DEVICE_DEBUG) {
             aprintf("\nDEVICE_DEBUG: Time = %d: ", CurrentSimulationTime);
             aprintf("  Disk %d READ will interrupt at time = %d\n", disk_id,
@@ -970,6 +1142,7 @@ void HardwareWriteDisk(INT16 disk_id, INT16 sector, char *buffer_ptr) {
 		HardwareFault(PRIVILEGED_INSTRUCTION, 0);
 		return;
 	}
+	TraceEvent(TRACE_DISK_WRITE, CurrentTracePid(), disk_id, sector);
 
 	if (disk_id < 0 || disk_id >= MAX_NUMBER_OF_DISKS) {
 		disk_id = 1; /* To aim at legal vector  */
@@ -1003,11 +1176,11 @@ void HardwareWriteDisk(INT16 disk_id, INT16 sector, char *buffer_ptr) {
 		DiskState[disk_id].Destination = sector_ptr;
 		DiskState[disk_id].Source = buffer_ptr;
 
-		access_time = (INT32) CurrentSimulationTime + 100
+		access_time = (INT32) ProcessorTime() + 100
 				+ abs(DiskState[disk_id].LastSector - sector) / 20;
 		HardwareStats.DiskWrites[disk_id]++;
 		HardwareStats.DiskBusyTime[disk_id] += access_time
-				- CurrentSimulationTime;
+				- ProcessorTime();
 		if (DO_DEVICE_DEBUG) {
 			aprintf("\nDEVICE_DEBUG: Time = %d:  ", CurrentSimulationTime);
 			aprintf("Disk %d WRITE will cause interrupt at time = %d\n", disk_id,
@@ -1099,6 +1272,8 @@ void HardwareTimer(INT32 time_to_delay) {
 	// too soon.  We really need a lock here and on HardwareInterrupt
 	if (time_to_delay == 0)
 		time_to_delay = 1;
+	TraceEvent(TRACE_TIMER_ARM, CurrentTracePid(), time_to_delay,
+			(INT32) ProcessorTime() + time_to_delay);
 
 	if (DO_DEVICE_DEBUG) {           // Print lots of info
 		aprintf("\nDEVICE_DEBUG: HardwareTimer:  ");
@@ -1145,7 +1320,7 @@ void HardwareTimer(INT32 time_to_delay) {
 		return;
 	}
 
-	AddEventToInterruptQueue(CurrentSimulationTime + time_to_delay,
+	AddEventToInterruptQueue(ProcessorTime() + time_to_delay,
 	TIMER_INTERRUPT, (INT16) ERR_SUCCESS, &timer_state.event_ptr);
 	timer_state.timer_in_use = TRUE;
 	ChargeTimeAndCheckEvents(COST_OF_TIMER);
@@ -1159,7 +1334,7 @@ void HardwareTimer(INT32 time_to_delay) {
  This is the routine that makes the current simulation
  time visible to the OS502.  Actions include:
  o If not in KERNEL_MODE, then cause priv inst trap.
- o Read the simulation time from "CurrentSimulationTime"
+ o Read the virtual time of the caller's processor
  o Return it to the caller.
 
  *****************************************************************/
@@ -1173,7 +1348,7 @@ void HardwareClock(INT32 *current_time_returned) {
 	}
 
 	ChargeTimeAndCheckEvents(COST_OF_CLOCK);
-	*current_time_returned = (INT32) CurrentSimulationTime;
+	*current_time_returned = (INT32) ProcessorTime();
 
 }           // End of HardwareClock
 
@@ -1193,6 +1368,10 @@ void HaltSimulation(void) {
 		HardwareFault(PRIVILEGED_INSTRUCTION, 0);
 		return;
 	}
+	DumpTrace();
+	CloseEventLog();
+	if (StatisticsAtHalt != 0)
+		ExportStatistics(StatisticsAtHalt);
 	PrintHardwareStats();
 
 	aprintf("The Z502 halts execution and Ends at Time %d\n",
@@ -1249,11 +1428,11 @@ void IdleSimulation(void) {
 		aprintf("   the event-check and Z502Idle\n");
 		HardwareInternalPanic(ERR_OS502_GENERATED_BUG);
 	}
-	if ((time_of_next_event > 0)
-			&& (CurrentSimulationTime < (UINT32) time_of_next_event))
-		CurrentSimulationTime = time_of_next_event;
+	if (time_of_next_event > 0)
+		AdvanceProcessorClock((UINT32) time_of_next_event);
 	ReleaseLock(HardwareLock, "Z502Simulation");
-	SignalCondition(InterruptCondition, "Z502Simulation");
+	SignalDueEvents("Z502Simulation");
+	RunDueInterrupts();
 }                    // End of Z502Idle
 
 /*****************************************************************
@@ -1266,7 +1445,8 @@ void IdleSimulation(void) {
  o Allocate a structure for a context.  The "calloc" sets the contents
  of this memory to 0.
  o Ensure that memory was actually obtained.
- o Initialize the structure.
+ o Initialize the structure.  A sparse context has a two level page
+ table, see PTBL_LEAF_ENTRIES in global.h.
  o Associate the Context with a thread that will run it
  o Advance time and see if an interrupt has occurred.
  o Return the structure pointer to the caller.
@@ -1274,7 +1454,7 @@ void IdleSimulation(void) {
  *****************************************************************/
 
 void MakeContext(long *ReturningContextPointer, long starting_address,
-		UINT16* PageTable, BOOL user_or_kernel) {
+		UINT16* PageTable, BOOL user_or_kernel, BOOL sparse) {
 	Z502CONTEXT *our_ptr;
 	int Temporary;
 
@@ -1299,17 +1479,27 @@ void MakeContext(long *ReturningContextPointer, long starting_address,
 	// We assume that the page table handed to us is valid, and that it
 	// has a length of VIRTUAL_MEM_PAGES.  Check that we can touch this
 	// much memory.  If not, then we will crash here rather than later.
-	Temporary = PageTable[0];
-	PageTable[NUMBER_VIRTUAL_PAGES - 1] = Temporary;
+	// A sparse page table only has to have its whole directory.
+	if (sparse) {
+		UINT16 **Directory = (UINT16 **) PageTable;
+		UINT16 *TemporaryLeaf = Directory[PTBL_DIRECTORY_ENTRIES - 1];
+		Directory[PTBL_DIRECTORY_ENTRIES - 1] = TemporaryLeaf;
+	} else {
+		Temporary = PageTable[0];
+		PageTable[NUMBER_VIRTUAL_PAGES - 1] = Temporary;
+	}
 	// Well, if we get here, then the OS correctly allocated memory.
 
 	our_ptr->StructureID = CONTEXT_STRUCTURE_ID;
 	our_ptr->CodeEntry = (void *) starting_address;
 	our_ptr->PageTablePointer = (void *) PageTable;
+	our_ptr->SparsePageTable = sparse;
 	our_ptr->ContextStartCount = 0;
 	// our_ptr->program_mode = user_or_kernel;    BUGFIX  4.10 - July 2014
 	our_ptr->ProgramMode = KERNEL_MODE;  // Always start process in Kernel Mode
 	our_ptr->FaultInProgress = FALSE;
+	our_ptr->TracePid = -1;
+	our_ptr->WaitTime = 0;
 	*ReturningContextPointer = (long) our_ptr;
 
 	// Attach the Context to a thread
@@ -1461,6 +1651,8 @@ void SwitchContext(void **IncomingContextPointer, BOOL DoStartSuspend) {
         //      aprintf("Z502Switch... - returning with no switch\n");
         return;
     }
+    TraceContextSwitch(DoStartSuspend != SUSPEND_CURRENT_CONTEXT_ONLY ?
+            *TargetContextPtr : NULL, DoStartSuspend);
     // GENERAL CAUTION make sure that the suspend is the last instruction 
         //     in this routine and we don't do any work after it.
 
@@ -1502,6 +1694,8 @@ void SwitchContext(void **IncomingContextPointer, BOOL DoStartSuspend) {
     }
     // We're going to do both the start AND the suspend
     if (DoStartSuspend == START_NEW_CONTEXT_AND_SUSPEND) {
+        // Our clock stops before the new context's starts
+        StopProcessorClock(GetProcessorID());
         ResumeProcessExecution(NextContextPtr);
     }
 
@@ -1514,8 +1708,10 @@ void SwitchContext(void **IncomingContextPointer, BOOL DoStartSuspend) {
     // processors and scheduling policy.
     ReleaseLock(HardwareLock, "SwitchContext-E");
     ThreadTable[ourLocalID].CurrentState = SUSPENDED_AFTER_BEING_ACTIVE;
+    StopProcessorClock(GetProcessorID());
     SuspendProcessExecution(CallersPtr);
     ThreadTable[ourLocalID].CurrentState = ACTIVE;
+    StartProcessorClock(GetProcessorID());
 
     //  MAKE SURE NO SIGNIFICANT WORK IS INSERTED AT THIS POINT
 
@@ -1533,22 +1729,38 @@ void SwitchContext(void **IncomingContextPointer, BOOL DoStartSuspend) {
  * GetPageTableAddress() - Function returns address of Page Table
  *       in use by the caller.
  ****************************************************************/
+
+/*
+ The ThreadTable index of the calling thread, or -1 if it isn't in
+ the table.  This is the one place the table is searched by TID.  A
+ thread keeps its entry for its whole life, so once found the index is
+ kept in thread local storage and the search is not done again.
+ */
+int ThreadTableIndex(void) {
+    static THREAD_LOCAL int MyIndex = -1;
+    int myTid;
+    int i;
+
+    if (MyIndex != -1)
+        return MyIndex;
+    myTid = GetMyTid();
+    for (i = 0; i < MAX_THREAD_TABLE_SIZE; i++) {
+        if (ThreadTable[i].ThreadID == myTid) {
+            MyIndex = i;
+            return i;
+        }
+    }
+    return -1;
+}                 // End of ThreadTableIndex
+
 //
 // Finds which processor is being run for the process that makes this call
 // This is a mapping between our local ID and the processor number
 int GetProcessorID() {
 	//if (MULTIPROCESSOR_IMPLEMENTED) {
-	int i;
-	int myTid = GetMyTid();
-	int ourLocalID = -1;
+	int ourLocalID = ThreadTableIndex();
 
-	// Find my TID in the table & make sure all is OK
-	for (i = 0; i < MAX_THREAD_TABLE_SIZE; i++) {
-		if (ThreadTable[i].ThreadID == myTid) {
-			ourLocalID = i;
-			break;
-		}
-	}
+	// Make sure all is OK
 	if (ourLocalID == -1) {
 		aprintf("Error in GetProcessorID\n");
 		aprintf("This should never happen!");
@@ -1575,6 +1787,24 @@ UINT16 *GetPageTableAddress() {
 	return ThreadTable[GetProcessorID()].Context->PageTablePointer;
 }    // End of  GetPageTableAddress()
 
+// Return the address of the page table entry for VirtualPageNumber in
+//   the page table of the process that's currently running on the
+//   processor of the caller.  For a sparse page table this walks the
+//   directory and returns NULL if the leaf holding the entry is missing.
+UINT16 *GetPageTableEntry(INT16 VirtualPageNumber) {
+	Z502CONTEXT *Context = ThreadTable[GetProcessorID()].Context;
+	UINT16 **Directory;
+	UINT16 *Leaf;
+
+	if (Context->SparsePageTable == FALSE)
+		return &Context->PageTablePointer[VirtualPageNumber];
+	Directory = (UINT16 **) Context->PageTablePointer;
+	Leaf = Directory[VirtualPageNumber / PTBL_LEAF_ENTRIES];
+	if (Leaf == NULL)
+		return NULL;
+	return &Leaf[VirtualPageNumber % PTBL_LEAF_ENTRIES];
+}    // End of  GetPageTableEntry()
+
 // Sets the Page Table of the  process that's
 //   currently running on the processor of the caller
 void SetPageTableAddress(UINT16 *address) {
@@ -1627,31 +1857,292 @@ void SetMode(char *CallerLocation, INT16 mode)  {
  This is the routine that will increment the simulation
  clock and then check that no event has occurred.
  Actions include:
- o Increment the clock.
- o Determine if the current time is greater than that of when
-   the last interrupt should have occurred.
- o If we're past that time, AND we have not previously signalled
-   this interrupt, do the signal.
+ o Increment the clock of the caller's processor.
+ o Wake the interrupt thread for every event that has now come due.
 
  ******************************************************************/
 
 void ChargeTimeAndCheckEvents(INT32 time_to_charge) {
-    static INT32  TimeOfNextSignalledEvent = 0;
-    INT32 TimeOfNextEvent;;
-
-    CurrentSimulationTime += time_to_charge;
+    int Index;
+    UINT32 OldClock;
+    UINT32 NewClock;
+
+    Index = RunningClockIndex();
+    if (Index == -1) {
+        // The interrupt thread and the boot thread run on global time
+        AdvanceGlobalClock(ATOMIC_LOAD32(&CurrentSimulationTime)
+                + time_to_charge);
+    } else {
+        OldClock = ThreadTable[Index].LocalClock;
+        NewClock = ATOMIC_LOAD32(&CurrentSimulationTime);
+        if (OldClock > NewClock)
+            NewClock = OldClock;
+        ATOMIC_STORE32(&ThreadTable[Index].LocalClock,
+                NewClock + time_to_charge);
+        // Only a processor that was holding back the global time can
+        // move it.  The global time is read after the new clock is
+        // published, so a processor that is syncing at the same time
+        // either sees the new clock or has already moved the global
+        // time up to the old one.
+        if (OldClock <= ATOMIC_LOAD32(&CurrentSimulationTime))
+            SynchronizeGlobalClock();
+    }
     HardwareStats.NumberChargeTimes++;
 
     //printf( "Charge_Time... -- current time = %ld\n", CurrentSimulationTime );
-    GetNextEventTime(&TimeOfNextEvent);
-    if (( TimeOfNextEvent > 0 )
-            && ( TimeOfNextEvent <= (INT32) CurrentSimulationTime) 
-            && ( TimeOfNextSignalledEvent != TimeOfNextEvent )  ) {
-        SignalCondition(InterruptCondition, "Charge_Time");
-        TimeOfNextSignalledEvent = TimeOfNextEvent;;
-    }
+    SignalDueEvents("Charge_Time");
 }              // End of ChargeTimeAndCheckEvents
 
+/*****************************************************************
+
+ Processor clocks
+
+ Every thread that is running a context is a processor with its own
+ virtual clock, LocalClock.  Charging time only moves the clock of
+ the processor doing the work, so processors don't fight over one
+ counter.  CurrentSimulationTime is the global time.  It is the
+ earliest clock of the running processors and only moves forward.
+ Events are released against the global time, so none is delivered
+ until every running processor has reached it.  A processor that
+ stops (its thread is suspended) no longer holds back the global
+ time, and one that starts again picks up from it.  The interrupt
+ thread and the boot thread have no clock of their own and charge
+ the global time directly.
+
+ Each clock is only written by its own thread and read by the others,
+ so LocalClock and ClockRunning are stored and loaded atomically
+ rather than under a lock.
+
+ ******************************************************************/
+
+/*
+ Return the ThreadTable index of the caller if it is a processor with
+ a running clock, otherwise -1.
+ */
+int RunningClockIndex(void) {
+    int i = ThreadTableIndex();
+
+    if (i == -1 || ThreadTable[i].ClockRunning != TRUE)
+        return -1;
+    return i;
+}              // End of RunningClockIndex
+
+/*
+ Move the global time forward to NewTime if it is later.  Several
+ processors can try this at once so it is done with compare and swap.
+ */
+void AdvanceGlobalClock(UINT32 NewTime) {
+    UINT32 Now = ATOMIC_LOAD32(&CurrentSimulationTime);
+
+    while (NewTime > Now) {
+#ifdef WINDOWS
+        if ((UINT32) InterlockedCompareExchange(
+                (volatile LONG *) &CurrentSimulationTime, (LONG) NewTime,
+                (LONG) Now) == Now)
+            break;
+#else
+        if (__sync_bool_compare_and_swap(&CurrentSimulationTime, Now, NewTime))
+            break;
+#endif
+        Now = ATOMIC_LOAD32(&CurrentSimulationTime);
+    }
+}              // End of AdvanceGlobalClock
+
+/*
+ Bring the global time up to the earliest clock of the running
+ processors.  With none running it is left where it is.  A clock read
+ here may be moved on by its processor straight after; if that
+ processor then saw the old global time it left the syncing to us, so
+ after moving the global time the clocks are looked at again.
+ */
+void SynchronizeGlobalClock(void) {
+    UINT32 Earliest;
+    UINT32 Clock;
+    UINT32 Before;
+    int Running;
+    int i;
+
+    do {
+        Earliest = 0;
+        Running = 0;
+        for (i = 0; i < MAX_THREAD_TABLE_SIZE; i++) {
+            if (ATOMIC_LOAD32(&ThreadTable[i].ClockRunning) != TRUE)
+                continue;
+            Clock = ATOMIC_LOAD32(&ThreadTable[i].LocalClock);
+            if (Running == 0 || Clock < Earliest)
+                Earliest = Clock;
+            Running++;
+        }
+        if (Running == 0)
+            return;
+        Before = ATOMIC_LOAD32(&CurrentSimulationTime);
+        AdvanceGlobalClock(Earliest);
+        // With only one clock running no other processor can have left
+        // the syncing to us
+    } while (Running > 1 && Earliest > Before);
+}              // End of SynchronizeGlobalClock
+
+/*
+ The time as seen by the caller.  A processor that has fallen behind
+ the global time (the interrupt thread charged time while it waited)
+ is brought up to it.
+ */
+UINT32 ProcessorTime(void) {
+    int Index = RunningClockIndex();
+    UINT32 Now = ATOMIC_LOAD32(&CurrentSimulationTime);
+
+    if (Index != -1 && ThreadTable[Index].LocalClock > Now)
+        return ThreadTable[Index].LocalClock;
+    return Now;
+}              // End of ProcessorTime
+
+/*
+ Move the caller's clock forward to NewTime.  Used by Z502Idle to skip
+ ahead to the next event.
+ */
+void AdvanceProcessorClock(UINT32 NewTime) {
+    int Index = RunningClockIndex();
+
+    if (Index == -1) {
+        AdvanceGlobalClock(NewTime);
+        return;
+    }
+    if (ThreadTable[Index].LocalClock < NewTime)
+        ATOMIC_STORE32(&ThreadTable[Index].LocalClock, NewTime);
+    SynchronizeGlobalClock();
+}              // End of AdvanceProcessorClock
+
+/*
+ The thread at Index starts or stops running a context.
+ */
+void StartProcessorClock(int Index) {
+    UINT32 Now = ATOMIC_LOAD32(&CurrentSimulationTime);
+
+    if (ThreadTable[Index].LocalClock < Now)
+        ATOMIC_STORE32(&ThreadTable[Index].LocalClock, Now);
+    ATOMIC_STORE32(&ThreadTable[Index].ClockRunning, TRUE);
+}              // End of StartProcessorClock
+
+void StopProcessorClock(int Index) {
+    ATOMIC_STORE32(&ThreadTable[Index].ClockRunning, FALSE);
+    SynchronizeGlobalClock();
+}              // End of StopProcessorClock
+
+/*****************************************************************
+
+ SignalDueEvents()
+
+ Walk the front of the event queue and mark every event that is due
+ but hasn't been signalled yet.  The interrupt thread gets one wakeup
+ for each of them.  An event is never signalled twice, and none is
+ missed since the wakeups are counted rather than just set.
+ In a deterministic simulation nothing is signalled here; the events
+ wait for the next RunDueInterrupts().
+
+ ******************************************************************/
+
+void SignalDueEvents(char *CallingRoutine) {
+    if (DeterministicMode == TRUE)
+        return;
+    PostDueEvents(CallingRoutine);
+}              // End of SignalDueEvents
+
+void PostDueEvents(char *CallingRoutine) {
+    EVENT *ep;
+    INT32 NewlyDue = 0;
+
+    GetLock(EventLock, "SignalDueEvents");
+    ep = (EVENT *) EventQueue.queue;
+    while (ep != NULL && ep->time_of_event <= (INT32) CurrentSimulationTime) {
+        if (ep->signalled == FALSE) {
+            ep->signalled = TRUE;
+            NewlyDue++;
+        }
+        ep = (EVENT *) ep->queue;
+    }
+    if (ReleaseLock(EventLock, "SignalDueEvents") == FALSE)
+        aprintf("Took error on ReleaseLock in SignalDueEvents\n");
+    if (NewlyDue == 0)
+        return;
+
+    HardwareStats.InterruptWakeups += NewlyDue;
+#if defined LINUX || defined MAC
+    pthread_mutex_lock(&InterruptDueMutex);
+    InterruptWakeupsPending += NewlyDue;
+    pthread_cond_signal(&InterruptDueCondition);
+    pthread_mutex_unlock(&InterruptDueMutex);
+#endif
+#ifdef WINDOWS
+    SignalCondition(InterruptCondition, CallingRoutine);
+#endif
+}              // End of PostDueEvents
+
+/*****************************************************************
+
+ RunDueInterrupts()
+
+ Called by a processor at a point where it holds no locks: a system
+ call, a user memory reference or Z502Idle.  In a deterministic
+ simulation this is the only place the interrupt thread is let go.
+ The processor wakes it and then waits until it has handled every
+ event that is due, so the two threads never run at the same time
+ and the order of events depends only on simulated time.
+ On Windows the simulation is never deterministic.
+
+ ******************************************************************/
+
+void RunDueInterrupts(void) {
+#if defined LINUX || defined MAC
+    INT32 time_of_event;
+
+    if (DeterministicMode == FALSE || GetMyTid() == InterruptTid)
+        return;
+    GetNextEventTime(&time_of_event);
+    if (time_of_event < 0 || time_of_event > (INT32) CurrentSimulationTime)
+        return;
+    PostDueEvents("RunDueInterrupts");
+    pthread_mutex_lock(&InterruptDueMutex);
+    // The thread may have seen every event signalled already, so make
+    // sure it has a wakeup to take.
+    InterruptThreadIdle = FALSE;
+    InterruptWakeupsPending++;
+    pthread_cond_signal(&InterruptDueCondition);
+    while (InterruptThreadIdle == FALSE)
+        pthread_cond_wait(&InterruptIdleCondition, &InterruptDueMutex);
+    pthread_mutex_unlock(&InterruptDueMutex);
+#endif
+}              // End of RunDueInterrupts
+
+/*****************************************************************
+
+ WaitForDueEvent()
+
+ Put the interrupt thread to sleep until SignalDueEvents says an
+ event has come due.  Every wakeup waiting is taken at once since the
+ caller services everything that is due.
+
+ ******************************************************************/
+
+void WaitForDueEvent(void) {
+#if defined LINUX || defined MAC
+    pthread_mutex_lock(&InterruptDueMutex);
+    // Nothing is due, so a processor waiting in RunDueInterrupts can go
+    if (InterruptWakeupsPending == 0) {
+        InterruptThreadIdle = TRUE;
+        pthread_cond_broadcast(&InterruptIdleCondition);
+    }
+    while (InterruptWakeupsPending == 0)
+        pthread_cond_wait(&InterruptDueCondition, &InterruptDueMutex);
+    InterruptWakeupsPending = 0;
+    pthread_mutex_unlock(&InterruptDueMutex);
+#endif
+#ifdef WINDOWS
+    GetLock(InterruptLock, "HardwareInterrupt-1");
+    WaitForCondition(InterruptCondition, InterruptLock, 30,
+            "HardwareInterrupt");
+#endif
+}              // End of WaitForDueEvent
+
 /*****************************************************************
 
  SaveTimeOfCall()
@@ -1702,8 +2193,7 @@ void HardwareInterrupt(void) {
     INT16 event_type;
     INT16 event_error;
     INT32 local_error;
-    INT32 TimeToWaitForCondition = 30; // Millisecs before Condition will go off
-    INT32 *DataPointer;
+    INT32 Batched;
     // void (*InterruptHandler)(void);
 
     InterruptTid = GetMyTid();
@@ -1711,10 +2201,7 @@ void HardwareInterrupt(void) {
         GetNextEventTime(&time_of_event);
         while (time_of_event < 0
                 || time_of_event > (INT32) CurrentSimulationTime) {
-            GetLock(InterruptLock, "HardwareInterrupt-1");
-            WaitForCondition(InterruptCondition, InterruptLock,
-                    TimeToWaitForCondition, "HardwareInterrupt");
-            //ReleaseLock(InterruptLock, "HardwareInterrupt-1");
+            WaitForDueEvent();
             GetNextEventTime(&time_of_event);
             // PrintEventQueue( );
             if (DEBUG_CONDITION) {
@@ -1736,68 +2223,7 @@ void HardwareInterrupt(void) {
             HardwareInternalPanic(ERR_OS502_GENERATED_BUG);
         }
 
-        if (event_type >= DISK_INTERRUPT
-                && event_type <= DISK_INTERRUPT + MAX_NUMBER_OF_DISKS - 1) {
-            // Note - if we get a disk error, we simply enqueued an event
-            // and incremented (hopefully momentarily) the DiskInUse value
-            // If we have an error because we started an already started disk,
-            // then when both of those interrupts, interleaved among themselves
-            // in some fashion, could be confusing.  We need to guard against
-            // the case that we now have the ERR_DISK_BUSY handled here but
-            // the first (original) disk request has already cleared the
-            // DiskInUse flag.    Rev 4.50, 04/2018
-            if ((DiskState[event_type - DISK_INTERRUPT ].DiskInUse == FALSE)
-                       & ( event_error != ERR_DISK_IN_USE ))  {
-            aprintf("False interrupt - the Z502 got an interrupt from a\n");
-            aprintf("DISK - but that disk wasn't in use.\n");
-            aprintf("This often happens if your disk has had an error.\n");
-            aprintf("You may be able to avoid this by checking and correcting.\n");
-            aprintf("any errors that show up in your interrupt handler.\n");
-            HardwareInternalPanic(ERR_Z502_INTERNAL_BUG);
-            }
-
-            //  We MAYBE should be clearing all these as well - and not just the current one.
-            memcpy(DiskState[event_type - DISK_INTERRUPT ].Destination, // Bugfix 07/2014
-                    DiskState[event_type - DISK_INTERRUPT ].Source, PGSIZE);
-            if (DO_DEVICE_DEBUG) {
-                DataPointer =
-                        (INT32 *) DiskState[event_type - DISK_INTERRUPT ].Source;
-                aprintf(
-                        "\nDEVICE_DEBUG: HardwareInterrupt - Moving Disk data\n");
-                aprintf("DEVICE_DEBUG:    Source Addr = %lX  ",
-                        (unsigned long) DiskState[event_type - DISK_INTERRUPT
-                                + 1].Source);
-                aprintf("Dest Addr = %lX\n",
-                        (unsigned long) DiskState[event_type - DISK_INTERRUPT
-                                + 1].Destination);
-                aprintf("DEVICE_DEBUG:    Contents = %d  ", DataPointer[0]);
-                aprintf("%d  ", DataPointer[1]);
-                aprintf("%d  ", DataPointer[2]);
-                aprintf("%d\n", DataPointer[3]);
-    	    }
-            // OK - here's the fix for a bug that has plagued many students.  Rev 4.50 04/2018
-            // If there's been a valid disk request, then that request will cause an interrupt.
-            // But if the student has mistakenly asked the disk for a second request, she will
-            // get a DISK-IS-BUSY error.  The interrupt for that second request will happen
-            // immediately.  If that second request tries to clear the DiskInUse flag, then when
-            // the FIRST request gets here, it will take a fatal error above since we got an
-            // interrupt for a disk not in use.
-            if ( event_error != ERR_DISK_IN_USE ) {
-                DiskState[event_type - DISK_INTERRUPT ].DiskInUse = FALSE;
-                        }
-            // aprintf("3. Setting %d FALSE\n", event_type );
-            DiskState[event_type - DISK_INTERRUPT ].EventPtr = NULL;
-        }
-
-        if (event_type == TIMER_INTERRUPT && event_error == ERR_SUCCESS) {
-            if (timer_state.timer_in_use == FALSE) {
-                aprintf("False interrupt - the Z502 got an interrupt from a\n");
-                aprintf("TIMER - but that timer wasn't in use.\n");
-                HardwareInternalPanic(ERR_Z502_INTERNAL_BUG);
-            }
-            timer_state.timer_in_use = FALSE;
-            timer_state.event_ptr = NULL;
-        }
+        CompleteDeviceEvent(time_of_event, event_type, event_error);
 
         /*******************************************************************************
          * Here we set the STAT_VECTOR.  This conveys to the OS what device and device
@@ -1812,9 +2238,29 @@ void HardwareInterrupt(void) {
          * NOTE:  That we set the contents of the record, and the last thing we do
          *        here is set the flag [SV_VALUE] saying the record is valid.
          ******************************************************************************/
-        STAT_VECTOR[SV_VALUE ][event_type] = event_error;
-        STAT_VECTOR[SV_TID ][event_type] = GetMyTid(); // This is Interrupt Thread
-        STAT_VECTOR[SV_ACTIVE ][event_type] = 1;
+        PostDeviceEvent(event_type, event_error);
+
+        /*******************************************************************************
+         * With batched interrupts every other event that is already due is
+         * taken now as well, so the OS handles them all in one pass.  The
+         * rings are emptied by each pass so a batch can't overflow them.
+         ******************************************************************************/
+        if (InterruptBatching == TRUE) {
+            Batched = 1;
+            GetNextEventTime(&time_of_event);
+            while (time_of_event >= 0
+                    && time_of_event <= (INT32) CurrentSimulationTime
+                    && Batched < COMPLETION_RING_SIZE - 1) {
+                GetNextOrderedEvent(&time_of_event, &event_type, &event_error,
+                        &local_error);
+                if (local_error != 0)
+                    break;
+                CompleteDeviceEvent(time_of_event, event_type, event_error);
+                PostDeviceEvent(event_type, event_error);
+                Batched++;
+                GetNextEventTime(&time_of_event);
+            }
+        }
 
         if (DO_DEVICE_DEBUG) {
             aprintf("DEVICE_DEBUG: HardwareInterrupt: Time = %d: ",
@@ -1848,6 +2294,804 @@ void HardwareInterrupt(void) {
     }         // End of while TRUE
 }                 // End of HardwareInterrupt
 
+/*****************************************************************
+
+ CompleteDeviceEvent()
+
+ An event for a timer or a disk has come due.  Show that the device
+ is no longer busy and, for a disk read, move the data to the
+ caller's buffer.  The time since the event was due is its interrupt
+ latency.  HardwareLock is held.
+ *****************************************************************/
+
+void CompleteDeviceEvent(INT32 time_of_event, INT16 event_type,
+        INT16 event_error) {
+    INT32 *DataPointer;
+    INT32 Latency;
+
+    Latency = (INT32) CurrentSimulationTime - time_of_event;
+    HardwareStats.InterruptLatencyTotal += Latency;
+    Z502AddToStatistic(InterruptLatencyStat, Latency);
+    if (Latency > HardwareStats.InterruptLatencyMax)
+        HardwareStats.InterruptLatencyMax = Latency;
+    LogDeviceEvent(time_of_event, event_type, event_error);
+    if (event_type == TIMER_INTERRUPT)
+        TraceEvent(TRACE_TIMER_FIRE, -1, time_of_event, 0);
+    else
+        TraceEvent(TRACE_DISK_DONE, -1, event_type - DISK_INTERRUPT,
+                event_error);
+
+    if (event_type >= DISK_INTERRUPT
+            && event_type <= DISK_INTERRUPT + MAX_NUMBER_OF_DISKS - 1) {
+        // Note - if we get a disk error, we simply enqueued an event
+        // and incremented (hopefully momentarily) the DiskInUse value
+        // If we have an error because we started an already started disk,
+        // then when both of those interrupts, interleaved among themselves
+        // in some fashion, could be confusing.  We need to guard against
+        // the case that we now have the ERR_DISK_BUSY handled here but
+        // the first (original) disk request has already cleared the
+        // DiskInUse flag.    Rev 4.50, 04/2018
+        if ((DiskState[event_type - DISK_INTERRUPT ].DiskInUse == FALSE)
+                   & ( event_error != ERR_DISK_IN_USE ))  {
+        aprintf("False interrupt - the Z502 got an interrupt from a\n");
+        aprintf("DISK - but that disk wasn't in use.\n");
+        aprintf("This often happens if your disk has had an error.\n");
+        aprintf("You may be able to avoid this by checking and correcting.\n");
+        aprintf("any errors that show up in your interrupt handler.\n");
+        HardwareInternalPanic(ERR_Z502_INTERNAL_BUG);
+        }
+
+        //  We MAYBE should be clearing all these as well - and not just the current one.
+        memcpy(DiskState[event_type - DISK_INTERRUPT ].Destination, // Bugfix 07/2014
+                DiskState[event_type - DISK_INTERRUPT ].Source, PGSIZE);
+        if (DO_DEVICE_DEBUG) {
+            DataPointer =
+                    (INT32 *) DiskState[event_type - DISK_INTERRUPT ].Source;
+            aprintf(
+                    "\nDEVICE_DEBUG: HardwareInterrupt - Moving Disk data\n");
+            aprintf("DEVICE_DEBUG:    Source Addr = %lX  ",
+                    (unsigned long) DiskState[event_type - DISK_INTERRUPT
+                            + 1].Source);
+            aprintf("Dest Addr = %lX\n",
+                    (unsigned long) DiskState[event_type - DISK_INTERRUPT
+                            + 1].Destination);
+            aprintf("DEVICE_DEBUG:    Contents = %d  ", DataPointer[0]);
+            aprintf("%d  ", DataPointer[1]);
+            aprintf("%d  ", DataPointer[2]);
+            aprintf("%d\n", DataPointer[3]);
+	    }
+        // OK - here's the fix for a bug that has plagued many students.  Rev 4.50 04/2018
+        // If there's been a valid disk request, then that request will cause an interrupt.
+        // But if the student has mistakenly asked the disk for a second request, she will
+        // get a DISK-IS-BUSY error.  The interrupt for that second request will happen
+        // immediately.  If that second request tries to clear the DiskInUse flag, then when
+        // the FIRST request gets here, it will take a fatal error above since we got an
+        // interrupt for a disk not in use.
+        if ( event_error != ERR_DISK_IN_USE ) {
+            DiskState[event_type - DISK_INTERRUPT ].DiskInUse = FALSE;
+                    }
+        // aprintf("3. Setting %d FALSE\n", event_type );
+        DiskState[event_type - DISK_INTERRUPT ].EventPtr = NULL;
+    }
+
+    if (event_type == TIMER_INTERRUPT && event_error == ERR_SUCCESS) {
+        if (timer_state.timer_in_use == FALSE) {
+            aprintf("False interrupt - the Z502 got an interrupt from a\n");
+            aprintf("TIMER - but that timer wasn't in use.\n");
+            HardwareInternalPanic(ERR_Z502_INTERNAL_BUG);
+        }
+        timer_state.timer_in_use = FALSE;
+        timer_state.event_ptr = NULL;
+    }
+}                 // End of CompleteDeviceEvent
+
+/*****************************************************************
+
+ PostDeviceEvent()
+
+ Tell the OS which device caused the interrupt and its status.
+ Normally this goes in the STAT_VECTOR.  With batched interrupts it
+ goes on the completion ring of the device.  HardwareLock is held.
+ *****************************************************************/
+
+void PostDeviceEvent(INT16 event_type, INT16 event_error) {
+    COMPLETION_RING *Ring;
+
+    HardwareStats.NumberOfDeviceEvents++;
+    if (InterruptBatching == FALSE) {
+        STAT_VECTOR[SV_VALUE ][event_type] = event_error;
+        STAT_VECTOR[SV_TID ][event_type] = GetMyTid(); // This is Interrupt Thread
+        STAT_VECTOR[SV_ACTIVE ][event_type] = 1;
+        return;
+    }
+    Ring = &CompletionRing[event_type];
+    if (Ring->tail - Ring->head >= COMPLETION_RING_SIZE) {
+        aprintf("The completion ring for device %d is full.\n", event_type);
+        HardwareInternalPanic(ERR_Z502_INTERNAL_BUG);
+    }
+    Ring->status[Ring->tail % COMPLETION_RING_SIZE] = event_error;
+    Ring->tail++;
+}                 // End of PostDeviceEvent
+
+/*****************************************************************
+
+ SetDeterministicMode()
+
+ From now on the interrupt thread runs only inside RunDueInterrupts().
+ A nonzero Seed replaces the one picked at Z502Init.  When recording,
+ the seed and the Options that change the timing start the event log;
+ when replaying, the seed is read back from the log so the run uses the
+ same random numbers.  A replay only matches if it is run with the same
+ options, so a difference is reported before the run starts.
+ *****************************************************************/
+
+void SetDeterministicMode(UINT32 Seed, INT32 LogMode, char *Options) {
+    UINT32 LoggedSeed;
+    char LoggedOptions[EVENT_LOG_OPTIONS_LENGTH];
+    long HeaderEnd;
+
+    if (Seed != 0)
+        RandomSeed = Seed;
+    if (Options == NULL)
+        Options = "";
+    if (LogMode == EVENT_LOG_RECORD) {
+        EventLogFile = fopen(EVENT_LOG_FILE, "w");
+        if (EventLogFile != NULL)
+            fprintf(EventLogFile, "seed %u\noptions %.*s\n", RandomSeed,
+                    EVENT_LOG_OPTIONS_LENGTH - 1, Options);
+        else
+            aprintf("\n\nERROR: Can't create the event log %s\n\n",
+                    EVENT_LOG_FILE);
+    }
+    if (LogMode == EVENT_LOG_REPLAY) {
+        EventLogFile = fopen(EVENT_LOG_FILE, "r");
+        if (EventLogFile != NULL
+                && fscanf(EventLogFile, "seed %u ", &LoggedSeed) == 1) {
+            RandomSeed = LoggedSeed;
+            // A log written before the options were kept goes straight
+            // on to the events
+            HeaderEnd = ftell(EventLogFile);
+            if (fgets(LoggedOptions, EVENT_LOG_OPTIONS_LENGTH, EventLogFile)
+                    != NULL && strncmp(LoggedOptions, "options ", 8) == 0) {
+                LoggedOptions[strcspn(LoggedOptions, "\n")] = '\0';
+                if (strncmp(LoggedOptions + 8, Options,
+                        EVENT_LOG_OPTIONS_LENGTH - 9) != 0)
+                    aprintf("\n\nWARNING: Replay is not run with the options "
+                            "it was recorded with\n  Recorded: %s\n  "
+                            "Now:      %s\nThe events may not match.\n\n",
+                            LoggedOptions + 8, Options);
+            } else
+                fseek(EventLogFile, HeaderEnd, SEEK_SET);
+        } else {
+            aprintf("\n\nERROR: Can't replay - %s is missing or has no seed\n\n",
+                    EVENT_LOG_FILE);
+            if (EventLogFile != NULL)
+                fclose(EventLogFile);
+            EventLogFile = NULL;
+        }
+    }
+    EventLogMode = (EventLogFile != NULL ? LogMode : EVENT_LOG_OFF);
+    DeterministicMode = TRUE;
+}                 // End of SetDeterministicMode
+
+/*****************************************************************
+
+ LogDeviceEvent()
+
+ Write a delivered device event to the event log, or check it against
+ the next one in the log when replaying.  Only the first difference is
+ reported; the rest are counted.  HardwareLock is held.
+ *****************************************************************/
+
+void LogDeviceEvent(INT32 time_of_event, INT16 event_type,
+        INT16 event_error) {
+    int LoggedNow, LoggedTime, LoggedType, LoggedError;
+
+    if (EventLogFile == NULL)
+        return;
+    HardwareStats.EventsLogged++;
+    if (EventLogMode == EVENT_LOG_RECORD) {
+        fprintf(EventLogFile, "%d %d %d %d\n", CurrentSimulationTime,
+                time_of_event, event_type, event_error);
+        return;
+    }
+    if (fscanf(EventLogFile, "%d %d %d %d", &LoggedNow, &LoggedTime,
+            &LoggedType, &LoggedError) == 4
+            && LoggedNow == (INT32) CurrentSimulationTime
+            && LoggedTime == time_of_event && LoggedType == event_type
+            && LoggedError == event_error)
+        return;
+    if (HardwareStats.EventLogMismatches == 0)
+        aprintf("\n\nERROR: Replay differs from the event log at event %d: "
+                "Time = %d  Device = %d\n\n", HardwareStats.EventsLogged,
+                CurrentSimulationTime, event_type);
+    HardwareStats.EventLogMismatches++;
+}                 // End of LogDeviceEvent
+
+/*****************************************************************
+
+ CloseEventLog()
+
+ Called at halt.  When replaying, every event left in the log never
+ happened in this run, so each one is counted as a mismatch.  Then the
+ log is closed.  HardwareLock is held.
+ *****************************************************************/
+
+void CloseEventLog(void) {
+    int LoggedNow, LoggedTime, LoggedType, LoggedError;
+    INT32 Unreplayed = 0;
+
+    if (EventLogFile == NULL)
+        return;
+    if (EventLogMode == EVENT_LOG_REPLAY) {
+        while (fscanf(EventLogFile, "%d %d %d %d", &LoggedNow, &LoggedTime,
+                &LoggedType, &LoggedError) == 4)
+            Unreplayed++;
+        if (Unreplayed > 0 && HardwareStats.EventLogMismatches == 0)
+            aprintf("\n\nERROR: Replay ended with %d events of the event "
+                    "log not replayed\n\n", Unreplayed);
+        HardwareStats.EventLogMismatches += Unreplayed;
+    }
+    fclose(EventLogFile);
+    EventLogFile = NULL;
+}                 // End of CloseEventLog
+
+/*****************************************************************
+
+ Z502RandomSeed()
+
+ The seed for the random numbers of the test programs.  It may be
+ called from user mode.
+ *****************************************************************/
+
+UINT32 Z502RandomSeed(void) {
+    return RandomSeed;
+}                 // End of Z502RandomSeed
+
+/*****************************************************************
+
+ Binary trace
+
+ TraceEvent() adds one record to the ring of the calling thread.
+ Only that thread writes its ring, so there is no lock, and with
+ tracing off it costs a single test.  The rings are written out by
+ DumpTrace() when the simulation halts.
+ *****************************************************************/
+
+void TraceEvent(INT16 Kind, INT32 Pid, INT32 Arg1, INT32 Arg2) {
+    TRACE_RING *Ring;
+    TRACE_RECORD *Record;
+    int Index;
+
+    if (TracingEnabled == FALSE)
+        return;
+    Index = ThreadTableIndex();
+    if (Index == -1)
+        return;
+    Ring = &TraceRing[Index];
+    if (Ring->Records == NULL) {
+        Ring->Records = (TRACE_RECORD *) calloc(TRACE_RING_SIZE,
+                sizeof(TRACE_RECORD));
+        if (Ring->Records == NULL)
+            return;
+    }
+    Record = &Ring->Records[Ring->Written % TRACE_RING_SIZE];
+    Record->Time = ProcessorTime();
+    Record->Processor = (INT16) Index;
+    Record->Kind = Kind;
+    Record->Pid = Pid;
+    Record->Arg1 = Arg1;
+    Record->Arg2 = Arg2;
+    Ring->Written++;
+}                 // End of TraceEvent
+
+/*
+ The PID of the context running on the calling thread, or -1 if the
+ OS hasn't dispatched it (or this is the interrupt thread).
+ */
+INT32 CurrentTracePid(void) {
+    Z502CONTEXT *Context;
+
+    if (TracingEnabled == FALSE)
+        return -1;
+    Context = GetCurrentContext();
+    if (Context == NULL || Context->StructureID != CONTEXT_STRUCTURE_ID)
+        return -1;
+    return Context->TracePid;
+}                 // End of CurrentTracePid
+
+/*
+ The hardware doesn't know PIDs.  The OS names the process it is about
+ to start in its TRACE_DISPATCH record and the next context this thread
+ starts takes that PID.
+ */
+void TraceContextSwitch(Z502CONTEXT *Target, BOOL How) {
+    TRACE_RING *Ring;
+    int Index;
+
+    if (TracingEnabled == FALSE)
+        return;
+    Index = ThreadTableIndex();
+    if (Index == -1)
+        return;
+    Ring = &TraceRing[Index];
+    if (Target != NULL && Ring->DispatchedPid != -1) {
+        Target->TracePid = Ring->DispatchedPid;
+        Ring->DispatchedPid = -1;
+    }
+    TraceEvent(TRACE_CONTEXT_SWITCH, CurrentTracePid(),
+            Target != NULL ? Target->TracePid : -1, How);
+}                 // End of TraceContextSwitch
+
+/*
+ Write the trace file: a TRACE_HEADER and then each ring, oldest
+ record first.  Records overwritten in a full ring are counted as
+ dropped.
+ */
+void DumpTrace(void) {
+    FILE *Output;
+    TRACE_HEADER Header;
+    UINT32 First, Record;
+    int i;
+
+    if (TracingEnabled == FALSE)
+        return;
+    TracingEnabled = FALSE;         // Nothing more goes in the rings
+    memset(&Header, 0, sizeof(Header));
+    strcpy(Header.Magic, TRACE_MAGIC);
+    Header.Version = TRACE_VERSION;
+    Header.RecordSize = sizeof(TRACE_RECORD);
+    for (i = 0; i < MAX_THREAD_TABLE_SIZE; i++) {
+        if (TraceRing[i].Written > TRACE_RING_SIZE) {
+            Header.NumberOfRecords += TRACE_RING_SIZE;
+            HardwareStats.TraceRecordsDropped += TraceRing[i].Written
+                    - TRACE_RING_SIZE;
+        } else
+            Header.NumberOfRecords += TraceRing[i].Written;
+    }
+    Output = fopen(TRACE_FILE, "wb");
+    if (Output == NULL) {
+        aprintf("\n\nERROR: Can't create the trace file %s\n\n", TRACE_FILE);
+        return;
+    }
+    fwrite(&Header, sizeof(Header), 1, Output);
+    for (i = 0; i < MAX_THREAD_TABLE_SIZE; i++) {
+        if (TraceRing[i].Records == NULL)
+            continue;
+        First = 0;
+        if (TraceRing[i].Written > TRACE_RING_SIZE)
+            First = TraceRing[i].Written - TRACE_RING_SIZE;
+        for (Record = First; Record < TraceRing[i].Written; Record++)
+            fwrite(&TraceRing[i].Records[Record % TRACE_RING_SIZE],
+                    sizeof(TRACE_RECORD), 1, Output);
+    }
+    fclose(Output);
+    HardwareStats.TraceRecords = Header.NumberOfRecords;
+}                 // End of DumpTrace
+
+/*****************************************************************
+
+ Z502TraceEvent()
+
+ Lets the OS add its own records to the trace.  A TRACE_DISPATCH
+ record also names the PID of the context this thread starts next.
+ *****************************************************************/
+
+void Z502TraceEvent(INT16 Kind, INT32 Pid, INT32 Arg1, INT32 Arg2) {
+    int Index;
+
+    if (TracingEnabled == FALSE)
+        return;
+    if (Kind == TRACE_DISPATCH) {
+        Index = ThreadTableIndex();
+        if (Index != -1)
+            TraceRing[Index].DispatchedPid = Pid;
+    }
+    TraceEvent(Kind, Pid, Arg1, Arg2);
+}                 // End of Z502TraceEvent
+
+/*****************************************************************
+
+ Statistics registry
+
+ Counters and histograms kept by name for the hardware and the OS.
+ Entries are only ever added, so the id a statistic is registered
+ under stays good and samples go in with atomic operations rather
+ than StatisticsLock.  ExportStatistics() adds the HARDWARE_STATS as
+ counters and writes the whole registry as JSON and/or CSV.
+ *****************************************************************/
+
+void AtomicAdd64(volatile INT64 *Target, INT64 Value) {
+#ifdef WINDOWS
+    InterlockedExchangeAdd64((volatile LONGLONG *) Target, Value);
+#else
+    __sync_fetch_and_add(Target, Value);
+#endif
+}                 // End of AtomicAdd64
+
+/*
+ Replace *Target by Value if Value is smaller (Smaller is TRUE) or
+ larger than it.
+ */
+void AtomicExtreme64(volatile INT64 *Target, INT64 Value, BOOL Smaller) {
+    INT64 Now = *Target;
+
+    while (Smaller == TRUE ? Value < Now : Value > Now) {
+#ifdef WINDOWS
+        if (InterlockedCompareExchange64((volatile LONGLONG *) Target,
+                Value, Now) == Now)
+            break;
+#else
+        if (__sync_bool_compare_and_swap(Target, Now, Value))
+            break;
+#endif
+        Now = *Target;
+    }
+}                 // End of AtomicExtreme64
+
+/*
+ The bucket of a sample.  Shifting a large sample right until it is
+ below 2 * HISTOGRAM_SUB_BUCKETS leaves its top bits, which pick the
+ bucket within its power of two.
+ */
+int HistogramBucket(INT64 Value) {
+    int Shift = 0;
+    int Bucket;
+
+    if (Value <= 0)
+        return 0;
+    while ((Value >> Shift) >= 2 * HISTOGRAM_SUB_BUCKETS)
+        Shift++;
+    Bucket = Shift * HISTOGRAM_SUB_BUCKETS + (int) (Value >> Shift);
+    if (Bucket >= HISTOGRAM_BUCKETS)
+        Bucket = HISTOGRAM_BUCKETS - 1;
+    return Bucket;
+}                 // End of HistogramBucket
+
+/*
+ The largest sample that goes in a bucket.
+ */
+INT64 HistogramLimit(int Bucket) {
+    int Shift;
+
+    if (Bucket < 2 * HISTOGRAM_SUB_BUCKETS)
+        return Bucket;
+    Shift = Bucket / HISTOGRAM_SUB_BUCKETS - 1;
+    return ((INT64) (Bucket - Shift * HISTOGRAM_SUB_BUCKETS + 1) << Shift) - 1;
+}                 // End of HistogramLimit
+
+/*
+ The sample Percent percent of the samples are at or below, to the
+ resolution of the buckets.
+ */
+INT64 HistogramPercentile(STATISTIC *Stat, INT32 Percent) {
+    INT64 Wanted, Seen = 0;
+    int b;
+
+    if (Stat->Value == 0)
+        return 0;
+    Wanted = (Stat->Value * Percent + 99) / 100;
+    if (Wanted < 1)
+        Wanted = 1;
+    for (b = 0; b < HISTOGRAM_BUCKETS - 1; b++) {
+        Seen += Stat->Buckets[b];
+        if (Seen >= Wanted)
+            return HistogramLimit(b) < Stat->Max ? HistogramLimit(b) : Stat->Max;
+    }
+    return Stat->Max;
+}                 // End of HistogramPercentile
+
+/*****************************************************************
+
+ Z502RegisterStatistic()
+
+ Returns the id of the statistic called Name, adding it to the
+ registry if it isn't there yet.  Returns -1 if the registry is full.
+ *****************************************************************/
+
+INT32 Z502RegisterStatistic(char *Name, INT32 Kind) {
+    STATISTIC *Stat;
+    INT32 Id;
+
+    GetLock(StatisticsLock, "Z502RegisterStatistic");
+    for (Id = 0; Id < NumberOfStatistics; Id++) {
+        if (strcmp(Statistics[Id].Name, Name) == 0)
+            break;
+    }
+    if (Id == NumberOfStatistics) {
+        if (Id == MAX_STATISTICS) {
+            aprintf("\n\nERROR: No room in the registry for statistic %s\n\n",
+                    Name);
+            Id = -1;
+        } else {
+            Stat = &Statistics[Id];
+            memset(Stat, 0, sizeof(STATISTIC));
+            strncpy(Stat->Name, Name, STATISTIC_NAME_LENGTH - 1);
+            Stat->Kind = Kind;
+            Stat->Min = STATISTIC_MIN_UNSET;
+            NumberOfStatistics++;
+        }
+    }
+    ReleaseLock(StatisticsLock, "Z502RegisterStatistic");
+    return Id;
+}                 // End of Z502RegisterStatistic
+
+/*****************************************************************
+
+ Z502AddToStatistic()
+
+ Adds Value to a counter, or records it as one sample of a histogram.
+ It may be called from user mode and charges no time.
+ *****************************************************************/
+
+void Z502AddToStatistic(INT32 Id, INT64 Value) {
+    STATISTIC *Stat;
+
+    if (Id < 0 || Id >= NumberOfStatistics)
+        return;
+    Stat = &Statistics[Id];
+    if (Stat->Kind == STAT_COUNTER) {
+        AtomicAdd64(&Stat->Value, Value);
+        return;
+    }
+    AtomicAdd64(&Stat->Value, 1);
+    AtomicAdd64(&Stat->Sum, Value);
+    AtomicExtreme64(&Stat->Min, Value, TRUE);
+    AtomicExtreme64(&Stat->Max, Value, FALSE);
+    AtomicAdd64(&Stat->Buckets[HistogramBucket(Value)], 1);
+}                 // End of Z502AddToStatistic
+
+/*****************************************************************
+
+ Z502StatisticsClock()
+
+ The simulated time of the caller's processor, for timing samples.
+ Unlike Z502Clock it charges no time, so measuring doesn't change
+ what is measured.
+ *****************************************************************/
+
+UINT32 Z502StatisticsClock(void) {
+    return ProcessorTime();
+}                 // End of Z502StatisticsClock
+
+/*****************************************************************
+
+ Z502HostNanoseconds()
+
+ The host's monotonic clock in nanoseconds, for timing samples in
+ real rather than simulated time.
+ *****************************************************************/
+
+UINT64 Z502HostNanoseconds(void) {
+#ifdef WINDOWS
+    static LARGE_INTEGER TicksPerSecond;
+    LARGE_INTEGER Ticks;
+
+    if (TicksPerSecond.QuadPart == 0)
+        QueryPerformanceFrequency(&TicksPerSecond);
+    QueryPerformanceCounter(&Ticks);
+    return (UINT64) ((double) Ticks.QuadPart * 1E9
+            / (double) TicksPerSecond.QuadPart);
+#else
+    struct timespec Now;
+
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return (UINT64) Now.tv_sec * 1000000000 + (UINT64) Now.tv_nsec;
+#endif
+}                 // End of Z502HostNanoseconds
+
+/*****************************************************************
+
+ Z502ContextWaitTime()
+
+ Every context has a counter for the time it has spent waiting in the
+ OS dispatcher.  Adds Wait to the counter of the caller's context and
+ returns the new total, or 0 if there is no context.
+ *****************************************************************/
+
+UINT32 Z502ContextWaitTime(UINT32 Wait) {
+    Z502CONTEXT *Context = GetCurrentContext();
+
+    if (Context == NULL || Context->StructureID != CONTEXT_STRUCTURE_ID)
+        return 0;
+    Context->WaitTime += Wait;
+    return Context->WaitTime;
+}                 // End of Z502ContextWaitTime
+
+/*****************************************************************
+
+ Z502ReadStatistic()
+
+ Returns the count (number of samples for a histogram), sum and
+ maximum of a statistic, and the value at or below which Percent
+ percent of its samples fall.
+ *****************************************************************/
+
+void Z502ReadStatistic(INT32 Id, INT32 Percent, INT64 *Count, INT64 *Sum,
+        INT64 *Max, INT64 *AtPercent) {
+    STATISTIC *Stat;
+
+    *Count = *Sum = *Max = *AtPercent = 0;
+    if (Id < 0 || Id >= NumberOfStatistics)
+        return;
+    Stat = &Statistics[Id];
+    *Count = Stat->Value;
+    *Sum = Stat->Sum;
+    *Max = Stat->Max;
+    if (Stat->Kind == STAT_HISTOGRAM)
+        *AtPercent = HistogramPercentile(Stat, Percent);
+}                 // End of Z502ReadStatistic
+
+/*
+ Set a counter to Value, registering it if need be.
+ */
+void SetStatistic(char *Name, INT64 Value) {
+    INT32 Id = Z502RegisterStatistic(Name, STAT_COUNTER);
+
+    if (Id != -1)
+        Statistics[Id].Value = Value;
+}                 // End of SetStatistic
+
+/*
+ Copy the HARDWARE_STATS into the registry.
+ */
+void PublishHardwareStats(void) {
+    char Name[STATISTIC_NAME_LENGTH];
+    int i;
+
+    SetStatistic("simulation_time", CurrentSimulationTime);
+    SetStatistic("random_seed", RandomSeed);
+    SetStatistic("context_switches", HardwareStats.ContextSwitches);
+    SetStatistic("time_weighted_running_processes",
+            HardwareStats.TimeWeightedNumberRunningProcesses);
+    SetStatistic("system_calls", HardwareStats.NumberOfSystemCalls);
+    SetStatistic("faults", HardwareStats.NumberOfFaults);
+    SetStatistic("charge_times", HardwareStats.NumberChargeTimes);
+    SetStatistic("interrupts", NumberOfInterruptsStarted);
+    SetStatistic("device_events", HardwareStats.NumberOfDeviceEvents);
+    SetStatistic("interrupt_wakeups", HardwareStats.InterruptWakeups);
+    SetStatistic("locks", GetTotalNumberOfLocks());
+    for (i = 0; i < MAX_NUMBER_OF_DISKS; i++) {
+        if (HardwareStats.DiskReads[i] + HardwareStats.DiskWrites[i] == 0)
+            continue;
+        sprintf(Name, "disk%d.reads", i);
+        SetStatistic(Name, HardwareStats.DiskReads[i]);
+        sprintf(Name, "disk%d.writes", i);
+        SetStatistic(Name, HardwareStats.DiskWrites[i]);
+        sprintf(Name, "disk%d.busy_time", i);
+        SetStatistic(Name, HardwareStats.DiskBusyTime[i]);
+    }
+}                 // End of PublishHardwareStats
+
+/*
+ The registry as a JSON object with a member for each counter and an
+ object for each histogram.  Only buckets holding samples are listed;
+ "le" is the largest sample a bucket holds, null for the last one.
+ */
+void WriteStatisticsJson(FILE *Output) {
+    STATISTIC *Stat;
+    BOOL First = TRUE;
+    char *Separator;
+    int i, b;
+
+    fprintf(Output, "{\n  \"counters\": {");
+    for (i = 0; i < NumberOfStatistics; i++) {
+        Stat = &Statistics[i];
+        if (Stat->Kind != STAT_COUNTER)
+            continue;
+        fprintf(Output, "%s\n    \"%s\": %lld", First == TRUE ? "" : ",",
+                Stat->Name, Stat->Value);
+        First = FALSE;
+    }
+    fprintf(Output, "\n  },\n  \"histograms\": {");
+    First = TRUE;
+    for (i = 0; i < NumberOfStatistics; i++) {
+        Stat = &Statistics[i];
+        if (Stat->Kind != STAT_HISTOGRAM)
+            continue;
+        fprintf(Output, "%s\n    \"%s\": {\"count\": %lld, \"sum\": %lld, "
+                "\"min\": %lld, \"max\": %lld, \"mean\": %.2f,\n      "
+                "\"p50\": %lld, \"p90\": %lld, \"p99\": %lld,\n      "
+                "\"buckets\": [", First == TRUE ? "" : ",", Stat->Name,
+                Stat->Value, Stat->Sum, Stat->Value > 0 ? Stat->Min : 0,
+                Stat->Max, Stat->Value > 0 ?
+                        (double) Stat->Sum / (double) Stat->Value : 0.0,
+                HistogramPercentile(Stat, 50), HistogramPercentile(Stat, 90),
+                HistogramPercentile(Stat, 99));
+        First = FALSE;
+        Separator = "";
+        for (b = 0; b < HISTOGRAM_BUCKETS; b++) {
+            if (Stat->Buckets[b] == 0)
+                continue;
+            if (b == HISTOGRAM_BUCKETS - 1)
+                fprintf(Output, "%s{\"le\": null, \"count\": %lld}",
+                        Separator, Stat->Buckets[b]);
+            else
+                fprintf(Output, "%s{\"le\": %lld, \"count\": %lld}",
+                        Separator, HistogramLimit(b), Stat->Buckets[b]);
+            Separator = ", ";
+        }
+        fprintf(Output, "]}");
+    }
+    fprintf(Output, "\n  }\n}\n");
+}                 // End of WriteStatisticsJson
+
+/*
+ The registry as CSV with one row per value: name,kind,field,value.
+ Bucket rows have the field le_<largest sample in the bucket>.
+ */
+void WriteStatisticsCsv(FILE *Output) {
+    STATISTIC *Stat;
+    int i, b;
+
+    fprintf(Output, "name,kind,field,value\n");
+    for (i = 0; i < NumberOfStatistics; i++) {
+        Stat = &Statistics[i];
+        if (Stat->Kind == STAT_COUNTER) {
+            fprintf(Output, "%s,counter,value,%lld\n", Stat->Name,
+                    Stat->Value);
+            continue;
+        }
+        fprintf(Output, "%s,histogram,count,%lld\n", Stat->Name, Stat->Value);
+        fprintf(Output, "%s,histogram,sum,%lld\n", Stat->Name, Stat->Sum);
+        fprintf(Output, "%s,histogram,min,%lld\n", Stat->Name,
+                Stat->Value > 0 ? Stat->Min : 0);
+        fprintf(Output, "%s,histogram,max,%lld\n", Stat->Name, Stat->Max);
+        fprintf(Output, "%s,histogram,p50,%lld\n", Stat->Name,
+                HistogramPercentile(Stat, 50));
+        fprintf(Output, "%s,histogram,p90,%lld\n", Stat->Name,
+                HistogramPercentile(Stat, 90));
+        fprintf(Output, "%s,histogram,p99,%lld\n", Stat->Name,
+                HistogramPercentile(Stat, 99));
+        for (b = 0; b < HISTOGRAM_BUCKETS; b++) {
+            if (Stat->Buckets[b] == 0)
+                continue;
+            if (b == HISTOGRAM_BUCKETS - 1)
+                fprintf(Output, "%s,histogram,le_inf,%lld\n", Stat->Name,
+                        Stat->Buckets[b]);
+            else
+                fprintf(Output, "%s,histogram,le_%lld,%lld\n", Stat->Name,
+                        HistogramLimit(b), Stat->Buckets[b]);
+        }
+    }
+}                 // End of WriteStatisticsCsv
+
+/*
+ Write the registry in each of the STATS_ Formats.
+ */
+void ExportStatistics(INT32 Formats) {
+    FILE *Output;
+    char FileName[64];
+
+    PublishHardwareStats();
+    GetLock(StatisticsLock, "ExportStatistics");
+    if ((Formats & STATS_JSON) != 0) {
+        sprintf(FileName, "%s.json", STATISTICS_FILE);
+        Output = fopen(FileName, "w");
+        if (Output == NULL)
+            aprintf("\n\nERROR: Can't create the statistics file %s\n\n",
+                    FileName);
+        else {
+            WriteStatisticsJson(Output);
+            fclose(Output);
+            StatisticsExported |= STATS_JSON;
+        }
+    }
+    if ((Formats & STATS_CSV) != 0) {
+        sprintf(FileName, "%s.csv", STATISTICS_FILE);
+        Output = fopen(FileName, "w");
+        if (Output == NULL)
+            aprintf("\n\nERROR: Can't create the statistics file %s\n\n",
+                    FileName);
+        else {
+            WriteStatisticsCsv(Output);
+            fclose(Output);
+            StatisticsExported |= STATS_CSV;
+        }
+    }
+    ReleaseLock(StatisticsLock, "ExportStatistics");
+}                 // End of ExportStatistics
+
 /*****************************************************************
 
  HardwareFault()
@@ -1866,7 +3110,9 @@ void HardwareInterrupt(void) {
  *****************************************************************/
 void HardwareFault(INT16 fault_type, INT16 argument) {
     INT16 IncomingMode;
+    UINT32 FaultStart;
 
+    TraceEvent(TRACE_FAULT, CurrentTracePid(), fault_type, argument);
     STAT_VECTOR[SV_ACTIVE ][fault_type] = 1;
     STAT_VECTOR[SV_VALUE ][fault_type] = (INT16) argument;
     STAT_VECTOR[SV_TID ][fault_type] = GetMyTid();
@@ -1877,7 +3123,9 @@ void HardwareFault(INT16 fault_type, INT16 argument) {
 
     //  We're about to get out of the hardware - release the lock
     // ReleaseLock( HardwareLock );
+    FaultStart = ProcessorTime();
     FaultHandler();
+    Z502AddToStatistic(FaultServiceStat, (INT32) (ProcessorTime() - FaultStart));
     // GetLock( HardwareLock, "HardwareFault" );
     if (GetCurrentContext() != NULL
             && GetCurrentContext()->StructureID != CONTEXT_STRUCTURE_ID) {
@@ -1917,10 +3165,15 @@ void SoftwareTrap(SYSTEM_CALL_DATA *SystemCallData) {
         aprintf("   OS is illegal.  Undefined errors may occur.\n");
         GoToExit(1);
     }
+    RunDueInterrupts();
     SetMode("SoftwareTrap1", KERNEL_MODE);
     ChargeTimeAndCheckEvents(COST_OF_SOFTWARE_TRAP);
     HardwareStats.NumberOfSystemCalls++;
+    TraceEvent(TRACE_SVC_ENTER, CurrentTracePid(),
+            SystemCallData->SystemCallNumber, 0);
     svc(SystemCallData);
+    TraceEvent(TRACE_SVC_EXIT, CurrentTracePid(),
+            SystemCallData->SystemCallNumber, 0);
     STAT_VECTOR[SV_ACTIVE ][SOFTWARE_TRAP ] = 0;
     STAT_VECTOR[SV_VALUE ][SOFTWARE_TRAP ] = 0;
     STAT_VECTOR[SV_TID ][SOFTWARE_TRAP ] = 0;
@@ -2000,6 +3253,7 @@ void AddEventToInterruptQueue(INT32 time_of_event, INT16 event_type,
 	ep->structure_id = EVENT_STRUCTURE_ID;
 	ep->event_type = event_type;
 	ep->event_error = event_error;
+	ep->signalled = FALSE;
 	*returned_event_ptr = ep;
 	if (DO_DEVICE_DEBUG) {
 		aprintf(
@@ -2046,7 +3300,7 @@ void AddEventToInterruptQueue(INT32 time_of_event, INT16 event_type,
 		GetTryLock(HardwareLock, "AddEventToIntQ");
 		if (ReleaseLock(HardwareLock, "AddEvent") == FALSE)
 			aprintf("Took error on ReleaseLock in AddEvent\n");
-		SignalCondition(InterruptCondition, "AddEvent");
+		SignalDueEvents("AddEvent");
 	}
 	return;
 }             // End of  AddEventToInterruptQueue
@@ -2255,6 +3509,33 @@ void PrintHardwareStats(void) {
             aprintf("Disk Utilization = %6.3f\n", util);
         }
     }
+    aprintf("Interrupts = %d  Device Events = %d  Batched = %s\n",
+            NumberOfInterruptsStarted, HardwareStats.NumberOfDeviceEvents,
+            InterruptBatching == TRUE ? "Yes" : "No");
+    if (HardwareStats.NumberOfDeviceEvents > 0)
+        aprintf("Interrupt Wakeups = %d  Latency: Mean = %.2f  Max = %d\n",
+                HardwareStats.InterruptWakeups,
+                (double) HardwareStats.InterruptLatencyTotal
+                        / (double) HardwareStats.NumberOfDeviceEvents,
+                HardwareStats.InterruptLatencyMax);
+    aprintf("Random Seed = %u  Deterministic = %s\n", RandomSeed,
+            DeterministicMode == TRUE ? "Yes" : "No");
+    if (EventLogMode == EVENT_LOG_RECORD)
+        aprintf("Event Log: %d events recorded\n", HardwareStats.EventsLogged);
+    if (EventLogMode == EVENT_LOG_REPLAY)
+        aprintf("Event Log: %d events replayed  Mismatches = %d\n",
+                HardwareStats.EventsLogged, HardwareStats.EventLogMismatches);
+    if (HardwareStats.TraceRecords + HardwareStats.TraceRecordsDropped > 0)
+        aprintf("Trace: %d records written to %s  Dropped = %d\n",
+                HardwareStats.TraceRecords, TRACE_FILE,
+                HardwareStats.TraceRecordsDropped);
+    if (StatisticsExported != 0)
+        aprintf("Statistics: %d entries written to%s%s\n",
+                NumberOfStatistics,
+                (StatisticsExported & STATS_JSON) ?
+                        " " STATISTICS_FILE ".json" : "",
+                (StatisticsExported & STATS_CSV) ?
+                        " " STATISTICS_FILE ".csv" : "");
     aprintf( "Total number of locks = %d    ", GetTotalNumberOfLocks());
     if (HardwareStats.NumberOfFaults > 0)
         aprintf("Faults = %5d:  ", HardwareStats.NumberOfFaults);
@@ -2270,7 +3551,7 @@ void PrintHardwareStats(void) {
     aprintf( "System Calls: %4d  Level Of Multiprogramming: %5.1f,  ",
         HardwareStats.NumberOfSystemCalls, 
         MeanNumberRunningProcesses );
-    aprintf("CALLS: %5d\n  ", HardwareStats.NumberChargeTimes);
+    aprintf("CALLS: %5lld\n  ", HardwareStats.NumberChargeTimes);
 
 }               // End of PrintHardwareStats
 /*****************************************************************
@@ -2533,22 +3814,14 @@ void Z502CreateUserThread(void *ThreadStartAddress) {
  to execute, and returns that address to the caller in test.c
  **************************************************************************/
 void *Z502PrepareProcessForExecution() {
-    int myTid = GetMyTid();
-    int ourLocalID = -1;
-    int i;
+    int ourLocalID;
     UINT32 RequestedCondition;
     INT32 RequestedMutex;
 
-    srand(myTid);        // Every thread has a unique random number - 2014
     GetLock(ThreadTableLock, "Z502PrepareProcessForExecution");
     PrintThreadTable("Entering -> PrepareProcessForExecution\n");
     // Find my TID in the table & make sure all is OK
-    for (i = 0; i < MAX_THREAD_TABLE_SIZE; i++) {
-        if (ThreadTable[i].ThreadID == myTid) {
-            ourLocalID = i;
-            break;
-        }
-    }
+    ourLocalID = ThreadTableIndex();
     if (ourLocalID == -1) {
         aprintf("Error 2 in Z502PrepareProcessForExecution\n");
         HardwareInternalPanic(ERR_Z502_INTERNAL_BUG);
@@ -2579,6 +3852,8 @@ void *Z502PrepareProcessForExecution() {
         HardwareInternalPanic(ERR_Z502_INTERNAL_BUG);
     }
     ReleaseLock(ThreadTableLock, "Z502PrepareProcessForExecution");
+    // This processor now runs on its own clock
+    StartProcessorClock(ourLocalID);
 
     //  If the code we're calling is the sample code, then keep
     //  us in kernel mode.
@@ -3641,6 +4916,11 @@ void Z502Init() {
         CreateLock(&InterruptLock, "Z502Init");
         CreateLock(&HardwareLock, "Z502Init");
         CreateLock(&ThreadTableLock, "Z502Init");
+        CreateLock(&StatisticsLock, "Z502Init");
+        FaultServiceStat = Z502RegisterStatistic("fault_service_time",
+                STAT_HISTOGRAM);
+        InterruptLatencyStat = Z502RegisterStatistic("interrupt_latency",
+                STAT_HISTOGRAM);
         CreateCondition(&InterruptCondition);
         for (i = 0; i < MAX_NUMBER_OF_DISKS ; i++) {
             sector_queue[i].queue = NULL;
@@ -3657,6 +4937,17 @@ void Z502Init() {
         HardwareStats.NumberChargeTimes = 0;
         HardwareStats.NumberOfFaults = 0;
         HardwareStats.NumberOfSystemCalls = 0;
+        HardwareStats.NumberOfDeviceEvents = 0;
+        HardwareStats.InterruptWakeups = 0;
+        HardwareStats.InterruptLatencyTotal = 0;
+        HardwareStats.InterruptLatencyMax = 0;
+        HardwareStats.EventsLogged = 0;
+        HardwareStats.EventLogMismatches = 0;
+        HardwareStats.TraceRecords = 0;
+        HardwareStats.TraceRecordsDropped = 0;
+        for (i = 0; i < MAX_THREAD_TABLE_SIZE; i++)
+            TraceRing[i].DispatchedPid = -1;
+        RandomSeed = (UINT32) time(NULL);
 
         timer_state.timer_in_use = FALSE;
         timer_state.event_ptr = NULL;
@@ -31,6 +31,20 @@
 #define THREAD_PRIORITY_HIGH                2
 #define LOCK_TYPE                       pthread_mutex_t
 #endif
+// Storage that each thread has its own copy of, and sequentially
+// consistent loads and stores of 32 bit values shared between threads
+#ifdef WINDOWS
+#define THREAD_LOCAL                  __declspec(thread)
+#define ATOMIC_LOAD32(Source)         \
+        InterlockedCompareExchange((volatile LONG *) (Source), 0, 0)
+#define ATOMIC_STORE32(Target, Value) \
+        InterlockedExchange((volatile LONG *) (Target), (LONG) (Value))
+#else
+#define THREAD_LOCAL                  __thread
+#define ATOMIC_LOAD32(Source)         __atomic_load_n((Source), __ATOMIC_SEQ_CST)
+#define ATOMIC_STORE32(Target, Value) \
+        __atomic_store_n((Target), (Value), __ATOMIC_SEQ_CST)
+#endif
 #define LESS_FAVORABLE_PRIORITY             -5
 #define MORE_FAVORABLE_PRIORITY              5
 
@@ -78,6 +92,7 @@ typedef struct
     INT16               ring_buffer_location;
     INT16               event_error;
     INT16               event_type;
+    BOOL                signalled;      // interrupt thread told it is due
     unsigned char       structure_id;
 } EVENT;
 
@@ -96,13 +111,21 @@ typedef struct {
 typedef struct {
     INT32               ContextSwitches;
     INT32               NumberRunningProcesses;
-    INT32               TimeWeightedNumberRunningProcesses;
+    INT64               TimeWeightedNumberRunningProcesses;
     INT32               DiskReads[MAX_NUMBER_OF_DISKS];
     INT32               DiskWrites[MAX_NUMBER_OF_DISKS];
-    INT32               DiskBusyTime[MAX_NUMBER_OF_DISKS];
-    INT32               NumberChargeTimes;
+    INT64               DiskBusyTime[MAX_NUMBER_OF_DISKS];
+    INT64               NumberChargeTimes;
     INT32               NumberOfFaults;
     INT32               NumberOfSystemCalls;
+    INT32               NumberOfDeviceEvents;
+    INT32               InterruptWakeups;
+    INT64               InterruptLatencyTotal;
+    INT32               InterruptLatencyMax;
+    INT32               EventsLogged;
+    INT32               EventLogMismatches;
+    INT32               TraceRecords;
+    INT32               TraceRecordsDropped;
 } HARDWARE_STATS;
 
 typedef struct {
@@ -117,12 +140,15 @@ typedef struct {
     unsigned char       StructureID;          // A unique ID so we know it's a CONTEXT
     void                *CodeEntry;           // Location where program starts
     UINT16              *PageTablePointer;    // Address of page table for this process
+    BOOL                SparsePageTable;      // Page table is two level
     INT32               ContextStartCount;     // How many times this context has been started
  //   INT16               PC;                    // Current address of the process
  //   INT32               CallType;
     INT16               ProgramMode;          // When last run, is it KEERNEL or USER
  //   INT16               mode_at_first_interrupt;
     BOOL                FaultInProgress;
+    INT32               TracePid;             // PID the OS dispatched it as
+    UINT32              WaitTime;             // Time spent in the OS dispatcher
 } Z502CONTEXT;
 
 // We create a thread for every potential process a user might create.
@@ -136,6 +162,8 @@ typedef struct {
         UINT32 Condition;
         UINT32 Mutex;
         INT16 Mode;
+        volatile UINT32 LocalClock;   // virtual time of this processor
+        volatile BOOL ClockRunning;   // TRUE while running a context
 } THREAD_INFO;
 
 // These are the states defined for a thread and stored in CurrentState
@@ -169,4 +197,85 @@ typedef struct
     INT16               timer_in_use;
 } TIMER_STATE;
 
+/* With batched interrupts the interrupt thread posts each device event  */
+/* it finds due into that device's completion ring, and the OS takes     */
+/* them all in one pass of its InterruptHandler.  The interrupt thread   */
+/* is both the only producer and the only consumer, so no lock is used.  */
+
+#define         COMPLETION_RING_SIZE            8
+
+typedef struct
+    {
+    INT32               status[COMPLETION_RING_SIZE];
+    volatile UINT32     head;               // next slot to take
+    volatile UINT32     tail;               // next slot to fill
+} COMPLETION_RING;
+
+/* In a deterministic run every device event delivered can be written  */
+/* to the event log, or checked against one recorded earlier.  The     */
+/* first line holds the seed and the second the options that change    */
+/* the timing of the run.  A replay must be run with the same options. */
+
+#define         EVENT_LOG_FILE                  "EventLog"
+
+/* The binary trace.  Every thread writes fixed size records to its own */
+/* ring, so no lock is needed; when a ring is full the oldest records  */
+/* are overwritten.  HaltSimulation writes a TRACE_HEADER and then the */
+/* records of every ring, oldest first, to TRACE_FILE.  traceToJson.py */
+/* turns the file into Chrome trace / Perfetto JSON.                   */
+
+#define         TRACE_FILE                      "TraceData"
+#define         TRACE_MAGIC                     "Z502TRC"
+#define         TRACE_VERSION                   1
+#define         TRACE_RING_SIZE                 16384
+
+typedef struct {
+    UINT32              Time;
+    INT16               Processor;          // ThreadTable index
+    INT16               Kind;               // TRACE_ in global.h
+    INT32               Pid;
+    INT32               Arg1;
+    INT32               Arg2;
+} TRACE_RECORD;
+
+typedef struct {
+    char                Magic[8];
+    UINT32              Version;
+    UINT32              RecordSize;
+    UINT32              NumberOfRecords;
+} TRACE_HEADER;
+
+typedef struct {
+    TRACE_RECORD        *Records;
+    UINT32              Written;            // all records ever written
+    INT32               DispatchedPid;      // PID of the next context started
+} TRACE_RING;
+
+/* The statistics registry.  The hardware and the OS register counters */
+/* and histograms by name and add to them with atomic operations.      */
+/* Histograms have HDR style log buckets: samples below               */
+/* 2 * HISTOGRAM_SUB_BUCKETS have a bucket each, and every power of two */
+/* above that is split into HISTOGRAM_SUB_BUCKETS buckets, so a bucket  */
+/* is never wider than a quarter of its smallest sample.  Samples of   */
+/* 0 or less go in bucket 0; the last bucket takes everything too big  */
+/* for the others.  The registry is written to STATISTICS_FILE.json    */
+/* and/or .csv on demand or when the simulation halts.                 */
+
+#define         STATISTICS_FILE                 "Statistics"
+#define         MAX_STATISTICS                  160
+#define         STATISTIC_NAME_LENGTH           40
+#define         HISTOGRAM_SUB_BUCKETS           4
+#define         HISTOGRAM_BUCKETS               176
+#define         STATISTIC_MIN_UNSET             ((INT64) 1 << 62)
+
+typedef struct {
+    char                Name[STATISTIC_NAME_LENGTH];
+    INT32               Kind;               // STAT_ in global.h
+    volatile INT64      Value;              // The count, or number of samples
+    volatile INT64      Sum;
+    volatile INT64      Min;
+    volatile INT64      Max;
+    volatile INT64      Buckets[HISTOGRAM_BUCKETS];
+} STATISTIC;
+
 #endif